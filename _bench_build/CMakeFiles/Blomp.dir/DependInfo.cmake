@@ -0,0 +1,27 @@
+
+# Consider dependencies only in project.
+set(CMAKE_DEPENDS_IN_PROJECT_ONLY OFF)
+
+# The set of languages for which implicit dependencies are needed:
+set(CMAKE_DEPENDS_LANGUAGES
+  )
+
+# The set of dependency files which are needed:
+set(CMAKE_DEPENDS_DEPENDENCY_FILES
+  "/root/repo/src/BitStream.cpp" "CMakeFiles/Blomp.dir/src/BitStream.cpp.o" "gcc" "CMakeFiles/Blomp.dir/src/BitStream.cpp.o.d"
+  "/root/repo/src/BlockTree.cpp" "CMakeFiles/Blomp.dir/src/BlockTree.cpp.o" "gcc" "CMakeFiles/Blomp.dir/src/BlockTree.cpp.o.d"
+  "/root/repo/src/Blocks.cpp" "CMakeFiles/Blomp.dir/src/Blocks.cpp.o" "gcc" "CMakeFiles/Blomp.dir/src/Blocks.cpp.o.d"
+  "/root/repo/src/Blomp.cpp" "CMakeFiles/Blomp.dir/src/Blomp.cpp.o" "gcc" "CMakeFiles/Blomp.dir/src/Blomp.cpp.o.d"
+  "/root/repo/src/Image.cpp" "CMakeFiles/Blomp.dir/src/Image.cpp.o" "gcc" "CMakeFiles/Blomp.dir/src/Image.cpp.o.d"
+  "/root/repo/src/ImgCompare.cpp" "CMakeFiles/Blomp.dir/src/ImgCompare.cpp.o" "gcc" "CMakeFiles/Blomp.dir/src/ImgCompare.cpp.o.d"
+  "/root/repo/src/RDOptimizer.cpp" "CMakeFiles/Blomp.dir/src/RDOptimizer.cpp.o" "gcc" "CMakeFiles/Blomp.dir/src/RDOptimizer.cpp.o.d"
+  "/root/repo/vendor/stb_image/stb_image.cpp" "CMakeFiles/Blomp.dir/vendor/stb_image/stb_image.cpp.o" "gcc" "CMakeFiles/Blomp.dir/vendor/stb_image/stb_image.cpp.o.d"
+  "/root/repo/vendor/stb_image/stb_image_write.cpp" "CMakeFiles/Blomp.dir/vendor/stb_image/stb_image_write.cpp.o" "gcc" "CMakeFiles/Blomp.dir/vendor/stb_image/stb_image_write.cpp.o.d"
+  )
+
+# Targets to which this target links.
+set(CMAKE_TARGET_LINKED_INFO_FILES
+  )
+
+# Fortran module output directory.
+set(CMAKE_Fortran_TARGET_MODULE_DIR "")
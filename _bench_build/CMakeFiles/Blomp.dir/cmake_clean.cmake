@@ -0,0 +1,27 @@
+file(REMOVE_RECURSE
+  "Blomp"
+  "Blomp.pdb"
+  "CMakeFiles/Blomp.dir/src/BitStream.cpp.o"
+  "CMakeFiles/Blomp.dir/src/BitStream.cpp.o.d"
+  "CMakeFiles/Blomp.dir/src/BlockTree.cpp.o"
+  "CMakeFiles/Blomp.dir/src/BlockTree.cpp.o.d"
+  "CMakeFiles/Blomp.dir/src/Blocks.cpp.o"
+  "CMakeFiles/Blomp.dir/src/Blocks.cpp.o.d"
+  "CMakeFiles/Blomp.dir/src/Blomp.cpp.o"
+  "CMakeFiles/Blomp.dir/src/Blomp.cpp.o.d"
+  "CMakeFiles/Blomp.dir/src/Image.cpp.o"
+  "CMakeFiles/Blomp.dir/src/Image.cpp.o.d"
+  "CMakeFiles/Blomp.dir/src/ImgCompare.cpp.o"
+  "CMakeFiles/Blomp.dir/src/ImgCompare.cpp.o.d"
+  "CMakeFiles/Blomp.dir/src/RDOptimizer.cpp.o"
+  "CMakeFiles/Blomp.dir/src/RDOptimizer.cpp.o.d"
+  "CMakeFiles/Blomp.dir/vendor/stb_image/stb_image.cpp.o"
+  "CMakeFiles/Blomp.dir/vendor/stb_image/stb_image.cpp.o.d"
+  "CMakeFiles/Blomp.dir/vendor/stb_image/stb_image_write.cpp.o"
+  "CMakeFiles/Blomp.dir/vendor/stb_image/stb_image_write.cpp.o.d"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang CXX)
+  include(CMakeFiles/Blomp.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
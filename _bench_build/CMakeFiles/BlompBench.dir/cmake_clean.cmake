@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "BlompBench"
+  "BlompBench.pdb"
+  "CMakeFiles/BlompBench.dir/bench/BlompBench.cpp.o"
+  "CMakeFiles/BlompBench.dir/bench/BlompBench.cpp.o.d"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang CXX)
+  include(CMakeFiles/BlompBench.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
@@ -0,0 +1,12 @@
+# CMake generated Testfile for 
+# Source directory: /root/repo
+# Build directory: /root/repo/_bench_build
+# 
+# This file includes the relevant testing commands required for 
+# testing this directory and lists subdirectories to be tested as well.
+add_test(bench_1mp "/root/repo/_bench_build/BlompBench" "--blomp" "/root/repo/_bench_build/Blomp" "--work" "/root/repo/_bench_build/bench" "--baseline" "/root/repo/bench/baseline.txt" "--mp" "1" "--modes" "enc,dec,maxv,opti" "--tolerance" "0.25")
+set_tests_properties(bench_1mp PROPERTIES  LABELS "benchmark" RUN_SERIAL "TRUE" TIMEOUT "3600" _BACKTRACE_TRIPLES "/root/repo/CMakeLists.txt;73;add_test;/root/repo/CMakeLists.txt;0;")
+add_test(bench_16mp "/root/repo/_bench_build/BlompBench" "--blomp" "/root/repo/_bench_build/Blomp" "--work" "/root/repo/_bench_build/bench" "--baseline" "/root/repo/bench/baseline.txt" "--mp" "16" "--modes" "enc,dec,maxv,opti" "--tolerance" "0.25")
+set_tests_properties(bench_16mp PROPERTIES  LABELS "benchmark" RUN_SERIAL "TRUE" TIMEOUT "3600" _BACKTRACE_TRIPLES "/root/repo/CMakeLists.txt;73;add_test;/root/repo/CMakeLists.txt;0;")
+add_test(bench_64mp "/root/repo/_bench_build/BlompBench" "--blomp" "/root/repo/_bench_build/Blomp" "--work" "/root/repo/_bench_build/bench" "--baseline" "/root/repo/bench/baseline.txt" "--mp" "64" "--modes" "enc,dec,maxv" "--tolerance" "0.25")
+set_tests_properties(bench_64mp PROPERTIES  LABELS "benchmark" RUN_SERIAL "TRUE" TIMEOUT "3600" _BACKTRACE_TRIPLES "/root/repo/CMakeLists.txt;73;add_test;/root/repo/CMakeLists.txt;0;")
@@ -0,0 +1,381 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+extern char** environ;
+
+// End-to-end throughput suite for the blomp CLI.
+// Every mode runs as a separate process on a generated image, so the real
+// code paths including file IO are measured and the peak RSS of each run
+// can be taken from the kernel. A single spawn of a short run is dominated
+// by exec and cache effects, so each mode is repeated until it has run for
+// a minimum time and the fastest run is kept.
+
+struct BenchResult
+{
+    double mpPerSec = 0.0;
+    uint64_t nBytes = 0;
+    uint64_t peakRssKiB = 0;
+};
+
+struct BenchConfig
+{
+    std::string blompPath;
+    std::string workDir;
+    std::string baselinePath;
+    std::vector<std::string> modes = { "enc", "dec", "maxv", "opti" };
+    int megapixels = 1;
+    int minRuns = 3;
+    int maxRuns = 50;
+    double minSeconds = 2.0;
+    double tolerance = 0.25;
+    bool writeBaseline = false;
+};
+
+class Random
+{
+public:
+    Random(uint64_t seed)
+        : m_state(seed)
+    {}
+public:
+    uint32_t next()
+    {
+        // xorshift64*
+        m_state ^= m_state >> 12;
+        m_state ^= m_state << 25;
+        m_state ^= m_state >> 27;
+        return uint32_t((m_state * 0x2545F4914F6CDD1DULL) >> 32);
+    }
+    int nextInt(int maxVal)
+    {
+        return int(next() % (uint32_t)maxVal);
+    }
+private:
+    uint64_t m_state;
+};
+
+void calcImageDims(int megapixels, int& width, int& height)
+{
+    // 1 MP -> 1024x1024, 16 MP -> 4096x4096, 64 MP -> 8192x8192
+    width = 1024;
+    height = 1024;
+    while (width * height < megapixels * 1024 * 1024)
+    {
+        if (width == height)
+            width *= 2;
+        else
+            height *= 2;
+    }
+}
+
+void generateImage(const std::string& filename, int width, int height)
+{
+    // Smooth gradients, flat rectangles and a few noisy areas,
+    // so both the coarse and the fine levels of the tree get work.
+    std::vector<uint8_t> data((uint64_t)width * height * 3);
+
+    for (int y = 0; y < height; ++y)
+    {
+        for (int x = 0; x < width; ++x)
+        {
+            uint8_t* px = &data[((uint64_t)y * width + x) * 3];
+            px[0] = uint8_t(x * 255 / width);
+            px[1] = uint8_t(y * 255 / height);
+            px[2] = uint8_t((x + y) * 127 / (width + height) + 64);
+        }
+    }
+
+    Random rand(0x426C6F6D70ULL + width * 31 + height);
+
+    int nRects = width * height / (64 * 64);
+    for (int i = 0; i < nRects; ++i)
+    {
+        int rw = 8 + rand.nextInt(width / 16);
+        int rh = 8 + rand.nextInt(height / 16);
+        int rx = rand.nextInt(width - rw);
+        int ry = rand.nextInt(height - rh);
+        uint8_t color[3] = { (uint8_t)rand.next(), (uint8_t)rand.next(), (uint8_t)rand.next() };
+        bool noisy = rand.nextInt(8) == 0;
+
+        for (int y = ry; y < ry + rh; ++y)
+        {
+            for (int x = rx; x < rx + rw; ++x)
+            {
+                uint8_t* px = &data[((uint64_t)y * width + x) * 3];
+                int noise = noisy ? rand.nextInt(64) - 32 : 0;
+                for (int c = 0; c < 3; ++c)
+                    px[c] = (uint8_t)std::min(255, std::max(0, color[c] + noise));
+            }
+        }
+    }
+
+    std::ofstream ofStream(filename, std::ios::binary | std::ios::out | std::ios::trunc);
+    if (!ofStream.is_open())
+        throw std::runtime_error("Unable to create corpus image '" + filename + "'.");
+
+    ofStream << "P6\n" << width << " " << height << "\n255\n";
+    ofStream.write((const char*)data.data(), data.size());
+}
+
+double spawnBlomp(const std::vector<std::string>& args, uint64_t& peakRssKiB)
+{
+    std::vector<char*> argv;
+    for (auto& arg : args)
+        argv.push_back((char*)arg.c_str());
+    argv.push_back(nullptr);
+
+    posix_spawn_file_actions_t fileActions;
+    posix_spawn_file_actions_init(&fileActions);
+    posix_spawn_file_actions_addopen(&fileActions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+
+    auto begin = std::chrono::steady_clock::now();
+
+    pid_t pid;
+    int err = posix_spawn(&pid, argv[0], &fileActions, nullptr, argv.data(), environ);
+    posix_spawn_file_actions_destroy(&fileActions);
+    if (err != 0)
+        throw std::runtime_error("Unable to run '" + args[0] + "': " + std::strerror(err));
+
+    int status = 0;
+    rusage usage;
+    if (wait4(pid, &status, 0, &usage) != pid)
+        throw std::runtime_error("Unable to wait for '" + args[0] + "'.");
+
+    auto end = std::chrono::steady_clock::now();
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        throw std::runtime_error("Mode '" + args[1] + "' failed.");
+
+    peakRssKiB = usage.ru_maxrss;
+    return std::chrono::duration<double>(end - begin).count();
+}
+
+BenchResult runBlomp(const std::vector<std::string>& args, int width, int height, const std::string& outFile, const BenchConfig& cfg)
+{
+    double bestSeconds = 0.0;
+    double totalSeconds = 0.0;
+    uint64_t peakRssKiB = 0;
+
+    for (int run = 0; run < cfg.maxRuns && (run < cfg.minRuns || totalSeconds < cfg.minSeconds); ++run)
+    {
+        uint64_t runRssKiB;
+        double seconds = spawnBlomp(args, runRssKiB);
+        bestSeconds = run == 0 ? seconds : std::min(bestSeconds, seconds);
+        totalSeconds += seconds;
+        peakRssKiB = std::max(peakRssKiB, runRssKiB);
+    }
+
+    BenchResult result;
+    result.mpPerSec = (double)width * height / (1024.0 * 1024.0) / bestSeconds;
+    result.nBytes = std::filesystem::file_size(outFile);
+    result.peakRssKiB = peakRssKiB;
+    return result;
+}
+
+std::map<std::string, BenchResult> loadBaseline(const std::string& filename)
+{
+    std::map<std::string, BenchResult> baseline;
+
+    std::ifstream ifStream(filename);
+    std::string line;
+    while (std::getline(ifStream, line))
+    {
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        std::istringstream lineStream(line);
+        std::string key;
+        BenchResult result;
+        if (lineStream >> key >> result.mpPerSec >> result.nBytes >> result.peakRssKiB)
+            baseline[key] = result;
+    }
+
+    return baseline;
+}
+
+void saveBaseline(const std::string& filename, const std::map<std::string, BenchResult>& baseline)
+{
+    std::ofstream ofStream(filename, std::ios::out | std::ios::trunc);
+    if (!ofStream.is_open())
+        throw std::runtime_error("Unable to write baseline file '" + filename + "'.");
+
+    ofStream << "# mode@megapixels  MP/s  bytes  peakRSS[KiB]" << std::endl;
+    for (auto& [key, result] : baseline)
+        ofStream << key << " " << std::fixed << std::setprecision(3) << result.mpPerSec << " " << result.nBytes << " " << result.peakRssKiB << std::endl;
+}
+
+bool checkResult(const std::string& key, const BenchResult& result, const BenchResult& base, double tolerance)
+{
+    bool passed = true;
+
+    if (result.mpPerSec < base.mpPerSec * (1.0 - tolerance))
+    {
+        std::cout << "  REGRESSION " << key << ": " << result.mpPerSec << " MP/s < " << base.mpPerSec << " MP/s" << std::endl;
+        passed = false;
+    }
+    // The output is deterministic, so any growth is a compression regression.
+    if (result.nBytes > base.nBytes)
+    {
+        std::cout << "  REGRESSION " << key << ": " << result.nBytes << " bytes > " << base.nBytes << " bytes" << std::endl;
+        passed = false;
+    }
+    if (result.peakRssKiB > base.peakRssKiB * (1.0 + tolerance))
+    {
+        std::cout << "  REGRESSION " << key << ": " << result.peakRssKiB << " KiB > " << base.peakRssKiB << " KiB peak RSS" << std::endl;
+        passed = false;
+    }
+
+    return passed;
+}
+
+std::vector<std::string> splitList(const std::string& str)
+{
+    std::vector<std::string> items;
+    std::istringstream stream(str);
+    std::string item;
+    while (std::getline(stream, item, ','))
+        if (!item.empty())
+            items.push_back(item);
+    return items;
+}
+
+int main(int argc, const char** argv)
+{
+    BenchConfig cfg;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (arg == "--blomp" && hasValue)
+            cfg.blompPath = argv[++i];
+        else if (arg == "--work" && hasValue)
+            cfg.workDir = argv[++i];
+        else if (arg == "--baseline" && hasValue)
+            cfg.baselinePath = argv[++i];
+        else if (arg == "--mp" && hasValue)
+            cfg.megapixels = std::stoi(argv[++i]);
+        else if (arg == "--modes" && hasValue)
+            cfg.modes = splitList(argv[++i]);
+        else if (arg == "--min-runs" && hasValue)
+            cfg.minRuns = std::max(1, std::stoi(argv[++i]));
+        else if (arg == "--max-runs" && hasValue)
+            cfg.maxRuns = std::max(1, std::stoi(argv[++i]));
+        else if (arg == "--min-time" && hasValue)
+            cfg.minSeconds = std::stod(argv[++i]);
+        else if (arg == "--tolerance" && hasValue)
+            cfg.tolerance = std::stod(argv[++i]);
+        else if (arg == "--write-baseline")
+            cfg.writeBaseline = true;
+        else
+        {
+            std::cout << "Usage: BlompBench --blomp [path] --work [dir] --baseline [file] "
+                "[--mp int] [--modes enc,dec,maxv,opti] [--min-runs int] [--max-runs int] [--min-time seconds] "
+                "[--tolerance float] [--write-baseline]" << std::endl;
+            return 1;
+        }
+    }
+
+    if (cfg.blompPath.empty() || cfg.workDir.empty() || cfg.baselinePath.empty())
+    {
+        std::cout << "Missing --blomp, --work or --baseline." << std::endl;
+        return 1;
+    }
+
+    try
+    {
+        std::filesystem::create_directories(cfg.workDir);
+
+        int width, height;
+        calcImageDims(cfg.megapixels, width, height);
+
+        std::string prefix = cfg.workDir + "/corpus_" + std::to_string(cfg.megapixels) + "mp";
+        std::string imgFile = prefix + ".ppm";
+        std::string blpFile = prefix + ".blp";
+        std::string decFile = prefix + "_DEC.bmp";
+        std::string optFile = prefix + "_OPT.blp";
+
+        if (!std::filesystem::exists(imgFile))
+            generateImage(imgFile, width, height);
+
+        // Target a 10:1 compression ratio for the optimizing modes.
+        std::string targetSize = std::to_string((uint64_t)width * height * 3 / 10);
+
+        auto baseline = loadBaseline(cfg.baselinePath);
+        bool passed = true;
+
+        for (auto& mode : cfg.modes)
+        {
+            std::vector<std::string> args = { cfg.blompPath, mode };
+            std::string outFile;
+
+            if (mode == "enc")
+            {
+                args.insert(args.end(), { imgFile, "-o", blpFile, "-d", "6", "-v", "0.02", "-q" });
+                outFile = blpFile;
+            }
+            else if (mode == "dec")
+            {
+                if (!std::filesystem::exists(blpFile))
+                    throw std::runtime_error("Mode 'dec' requires 'enc' to run first.");
+                args.insert(args.end(), { blpFile, "-o", decFile, "-q" });
+                outFile = decFile;
+            }
+            else if (mode == "maxv" || mode == "opti")
+            {
+                args.insert(args.end(), { imgFile, "-o", optFile, "-d", "6", "-i", "6", "-x", "size", targetSize, "-q" });
+                outFile = optFile;
+            }
+            else
+            {
+                throw std::runtime_error("Unknown benchmark mode '" + mode + "'.");
+            }
+
+            BenchResult result = runBlomp(args, width, height, outFile, cfg);
+            std::string key = mode + "@" + std::to_string(cfg.megapixels);
+
+            std::cout << std::left << std::setw(8) << key << std::right
+                << std::fixed << std::setprecision(3)
+                << std::setw(12) << result.mpPerSec << " MP/s"
+                << std::setw(12) << result.nBytes << " bytes"
+                << std::setw(10) << result.peakRssKiB << " KiB" << std::endl;
+
+            auto it = baseline.find(key);
+            if (cfg.writeBaseline)
+                baseline[key] = result;
+            else if (it == baseline.end())
+                std::cout << "  No baseline for " << key << "." << std::endl;
+            else if (!checkResult(key, result, it->second, cfg.tolerance))
+                passed = false;
+        }
+
+        if (cfg.writeBaseline)
+            saveBaseline(cfg.baselinePath, baseline);
+
+        return passed ? 0 : 1;
+    }
+    catch (std::exception& e)
+    {
+        std::cout << "ERROR: " << e.what() << std::endl;
+        return 1;
+    }
+}
\ No newline at end of file
@@ -0,0 +1,278 @@
+#include "Archive.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "Trace.h"
+
+namespace Blomp
+{
+    MappedFile::MappedFile(const std::string& filename)
+    {
+        // The mapping keeps the file open, so its handles are closed right away.
+#ifdef _WIN32
+        HANDLE hFile = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (hFile == INVALID_HANDLE_VALUE)
+            throw std::runtime_error("Unable to open file.");
+
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(hFile, &size))
+        {
+            CloseHandle(hFile);
+            throw std::runtime_error("Unable to open file.");
+        }
+
+        m_size = (uint64_t)size.QuadPart;
+        if (m_size == 0)
+        {
+            CloseHandle(hFile);
+            return;
+        }
+
+        HANDLE hMapping = CreateFileMappingA(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        CloseHandle(hFile);
+        if (!hMapping)
+            throw std::runtime_error("Unable to map file.");
+
+        m_data = (const uint8_t*)MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(hMapping);
+        if (!m_data)
+            throw std::runtime_error("Unable to map file.");
+#else
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw std::runtime_error("Unable to open file.");
+
+        struct stat st;
+        if (fstat(fd, &st) != 0)
+        {
+            close(fd);
+            throw std::runtime_error("Unable to open file.");
+        }
+
+        // Empty files can't be mapped.
+        m_size = (uint64_t)st.st_size;
+        if (m_size == 0)
+        {
+            close(fd);
+            return;
+        }
+
+        void* data = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED)
+            throw std::runtime_error("Unable to map file.");
+
+        m_data = (const uint8_t*)data;
+#endif
+    }
+
+    MappedFile::~MappedFile()
+    {
+        if (!m_data)
+            return;
+
+#ifdef _WIN32
+        UnmapViewOfFile(m_data);
+#else
+        munmap((void*)m_data, m_size);
+#endif
+    }
+
+    bool ArchiveHeader::isValid() const
+    {
+        for (int i = 0; i < 4; ++i)
+            if (identifier[i] != DEFAULT_IDENTIFIER[i])
+                return false;
+        return 0 < version && version <= CURRENT_VERSION;
+    }
+
+    Archive::Archive(const std::string& filename)
+        : m_file(filename)
+    {
+        TraceScope trace("map", "io");
+        trace.arg("file", filename);
+
+        uint64_t size = m_file.size();
+        if (size < sizeof(ArchiveHeader))
+            throw std::runtime_error("Invalid archive header.");
+
+        std::memcpy(&m_header, m_file.data(), sizeof(m_header));
+        if (!m_header.isValid() || m_header.indexOffset % ArchiveHeader::ALIGNMENT != 0 ||
+            m_header.indexOffset < sizeof(ArchiveHeader) || m_header.indexOffset > size ||
+            m_header.nEntries > (size - m_header.indexOffset) / sizeof(ArchiveEntry) ||
+            m_header.namesOffset < m_header.indexOffset + m_header.nEntries * sizeof(ArchiveEntry) ||
+            m_header.namesOffset > size)
+            throw std::runtime_error("Invalid archive header.");
+
+        trace.arg("entries", m_header.nEntries);
+    }
+
+    std::string_view Archive::name(uint64_t index) const
+    {
+        auto& e = entry(index);
+
+        uint64_t namesSize = m_file.size() - m_header.namesOffset;
+        if (e.nameOffset > namesSize || e.nameSize > namesSize - e.nameOffset)
+            throw std::runtime_error("Unable to read damaged archive file.");
+
+        return std::string_view((const char*)m_file.data() + m_header.namesOffset + e.nameOffset, e.nameSize);
+    }
+
+    ArchiveFile Archive::file(uint64_t index) const
+    {
+        auto& e = entry(index);
+
+        if (e.dataOffset < sizeof(ArchiveHeader) || e.dataOffset > m_header.indexOffset || e.dataSize > m_header.indexOffset - e.dataOffset)
+            throw std::runtime_error("Unable to read damaged archive file.");
+
+        ArchiveFile file;
+        file.data = m_file.data() + e.dataOffset;
+        file.size = e.dataSize;
+        return file;
+    }
+
+    uint64_t Archive::find(std::string_view name) const
+    {
+        // Only the entries on the search path are touched.
+        uint64_t first = 0;
+        uint64_t last = nEntries();
+        while (first < last)
+        {
+            uint64_t mid = first + (last - first) / 2;
+            int order = this->name(mid).compare(name);
+            if (order == 0)
+                return mid;
+            if (order < 0)
+                first = mid + 1;
+            else
+                last = mid;
+        }
+
+        return nEntries();
+    }
+
+    const ArchiveEntry& Archive::entry(uint64_t index) const
+    {
+        if (index >= nEntries())
+            throw std::runtime_error("Unable to read out-of-bounds archive entry.");
+
+        // The index is aligned within the page aligned mapping.
+        return ((const ArchiveEntry*)(m_file.data() + m_header.indexOffset))[index];
+    }
+
+    ArchiveWriter::ArchiveWriter(const std::string& filename)
+        : m_filename(filename), m_tempFilename(filename + ".tmp"),
+        m_oStream(m_tempFilename, std::ios::binary | std::ios::out | std::ios::trunc)
+    {
+        if (!m_oStream.is_open())
+            throw std::runtime_error("Unable to open archive file.");
+
+        // Rewritten by finish() once the index is known.
+        ArchiveHeader header;
+        m_oStream.write((const char*)&header, sizeof(header));
+        m_offset = sizeof(header);
+    }
+
+    ArchiveWriter::~ArchiveWriter()
+    {
+        if (m_finished)
+            return;
+
+        m_oStream.close();
+        std::error_code ec;
+        std::filesystem::remove(m_tempFilename, ec);
+    }
+
+    void ArchiveWriter::add(const std::string& name, const void* data, uint64_t size)
+    {
+        if (!isValidArchiveName(name))
+            throw std::runtime_error("Invalid archive entry name '" + name + "'.");
+        if (!m_names.insert(name).second)
+            throw std::runtime_error("Duplicate archive entry name '" + name + "'.");
+
+        ArchiveEntry entry = {};
+        entry.dataOffset = m_offset;
+        entry.dataSize = size;
+        m_entries.emplace_back(name, entry);
+
+        m_oStream.write((const char*)data, size);
+        m_offset += size;
+        writePadding();
+
+        if (!m_oStream)
+            throw std::runtime_error("Unable to write archive file.");
+    }
+
+    void ArchiveWriter::finish()
+    {
+        TraceScope trace("index", "io");
+        trace.arg("entries", (uint64_t)m_entries.size());
+
+        std::sort(m_entries.begin(), m_entries.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+        ArchiveHeader header;
+        header.nEntries = m_entries.size();
+        header.indexOffset = m_offset;
+        header.namesOffset = m_offset + header.nEntries * sizeof(ArchiveEntry);
+
+        uint64_t nameOffset = 0;
+        for (auto& [name, entry] : m_entries)
+        {
+            entry.nameOffset = nameOffset;
+            entry.nameSize = name.size();
+            nameOffset += name.size();
+            m_oStream.write((const char*)&entry, sizeof(entry));
+        }
+
+        for (auto& [name, entry] : m_entries)
+            m_oStream.write(name.data(), name.size());
+
+        m_oStream.seekp(0);
+        m_oStream.write((const char*)&header, sizeof(header));
+        m_oStream.close();
+
+        if (!m_oStream)
+            throw std::runtime_error("Unable to write archive file.");
+
+        std::error_code ec;
+        std::filesystem::rename(m_tempFilename, m_filename, ec);
+        if (ec)
+            throw std::runtime_error("Unable to write archive file.");
+
+        m_finished = true;
+    }
+
+    void ArchiveWriter::writePadding()
+    {
+        static const char zeros[ArchiveHeader::ALIGNMENT] = {};
+
+        uint64_t nPadding = (ArchiveHeader::ALIGNMENT - m_offset % ArchiveHeader::ALIGNMENT) % ArchiveHeader::ALIGNMENT;
+        m_oStream.write(zeros, nPadding);
+        m_offset += nPadding;
+    }
+
+    bool isValidArchiveName(std::string_view name)
+    {
+        if (name.empty() || name == "." || name == "..")
+            return false;
+
+        for (char c : name)
+            if (c == '/' || c == '\\' || c == ':' || c == '\0')
+                return false;
+
+        return true;
+    }
+}
\ No newline at end of file
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <stdint.h>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+namespace Blomp
+{
+    // Read-only mapping of a whole file into memory.
+    class MappedFile
+    {
+    public:
+        MappedFile() = delete;
+        MappedFile(const MappedFile&) = delete;
+        MappedFile(const std::string& filename);
+        ~MappedFile();
+    public:
+        const uint8_t* data() const;
+        uint64_t size() const;
+    private:
+        const uint8_t* m_data = nullptr;
+        uint64_t m_size = 0;
+    };
+
+    // Archives hold many blomp files, each with its file header, followed by an index sorted by name:
+    //   ArchiveHeader | files | ArchiveEntry[nEntries] | names
+    // Every file and the index start at a multiple of ALIGNMENT bytes.
+    struct ArchiveHeader
+    {
+        static constexpr char DEFAULT_IDENTIFIER[4] = { 'B', 'L', 'M', 'A' };
+        static constexpr uint32_t CURRENT_VERSION = 1;
+        static constexpr uint64_t ALIGNMENT = 8;
+        char identifier[4] = { 'B', 'L', 'M', 'A' };
+        uint32_t version = CURRENT_VERSION;
+        uint64_t nEntries = 0;
+        uint64_t indexOffset = 0;
+        uint64_t namesOffset = 0;
+    public:
+        bool isValid() const;
+    };
+
+    struct ArchiveEntry
+    {
+        uint64_t dataOffset;
+        uint64_t dataSize;
+        // Relative to the start of the names.
+        uint64_t nameOffset;
+        uint64_t nameSize;
+    };
+
+    // A file of an archive, pointing into its mapping.
+    struct ArchiveFile
+    {
+        const uint8_t* data = nullptr;
+        uint64_t size = 0;
+    };
+
+    // Looks up the files of a mapped archive in place. Only the header is
+    // checked when opening it, entries are checked when they are accessed,
+    // so opening a large archive doesn't touch its whole index.
+    class Archive
+    {
+    public:
+        Archive() = delete;
+        Archive(const std::string& filename);
+    public:
+        uint64_t nEntries() const;
+        std::string_view name(uint64_t index) const;
+        ArchiveFile file(uint64_t index) const;
+        // Returns nEntries() when there is no file with the name.
+        uint64_t find(std::string_view name) const;
+    private:
+        const ArchiveEntry& entry(uint64_t index) const;
+    private:
+        MappedFile m_file;
+        ArchiveHeader m_header;
+    };
+
+    // Writes the files in the order they are added and the sorted index on finish().
+    // The archive is written to a temporary file next to it, which replaces the
+    // archive on finish(), so a failed run leaves no partial archive behind.
+    class ArchiveWriter
+    {
+    public:
+        ArchiveWriter() = delete;
+        ArchiveWriter(const ArchiveWriter&) = delete;
+        ArchiveWriter(const std::string& filename);
+        ~ArchiveWriter();
+    public:
+        void add(const std::string& name, const void* data, uint64_t size);
+        void finish();
+    private:
+        void writePadding();
+    private:
+        std::string m_filename;
+        std::string m_tempFilename;
+        std::ofstream m_oStream;
+        uint64_t m_offset = 0;
+        std::vector<std::pair<std::string, ArchiveEntry>> m_entries;
+        std::unordered_set<std::string> m_names;
+        bool m_finished = false;
+    };
+
+    // Names are used as file names when unpacking, so they must not contain directories.
+    bool isValidArchiveName(std::string_view name);
+
+    inline const uint8_t* MappedFile::data() const
+    {
+        return m_data;
+    }
+
+    inline uint64_t MappedFile::size() const
+    {
+        return m_size;
+    }
+
+    inline uint64_t Archive::nEntries() const
+    {
+        return m_header.nEntries;
+    }
+}
\ No newline at end of file
@@ -13,12 +13,97 @@ namespace Blomp
         iStream >> *this;
     }
 
+    BitStream BitStream::view(const void* data, uint64_t nBits)
+    {
+        BitStream bs;
+        bs.m_pView = (const char*)data;
+        bs.m_size = nBits;
+        bs.m_writeOffset = nBits;
+        return bs;
+    }
+
+    void BitStream::append(const BitStream& src, uint64_t srcOffset, uint64_t nBits)
+    {
+        if (srcOffset + nBits > src.m_size)
+            throw std::runtime_error("Unable to append out-of-bounds bits of bitstream.");
+
+        uint64_t dstOffset = m_writeOffset;
+        m_writeOffset += nBits;
+        if (m_writeOffset > m_size)
+            resize(m_writeOffset);
+
+        const uint8_t* srcData = (const uint8_t*)src.readData();
+        uint8_t* dstData = (uint8_t*)m_data.data();
+
+        // Copy whole bytes by shifting them into place, the rest bit by bit.
+        uint64_t i = 0;
+        for (; i + 8 <= nBits; i += 8)
+        {
+            uint64_t srcByte, srcBit, dstByte, dstBit;
+            splitOffset(srcByte, srcBit, srcOffset + i);
+            splitOffset(dstByte, dstBit, dstOffset + i);
+
+            uint8_t value = srcData[srcByte] >> srcBit;
+            if (srcBit)
+                value |= srcData[srcByte + 1] << (8 - srcBit);
+
+            dstData[dstByte] = (dstData[dstByte] & ((1 << dstBit) - 1)) | (value << dstBit);
+            if (dstBit)
+                dstData[dstByte + 1] = (dstData[dstByte + 1] & ~((1 << dstBit) - 1)) | (value >> (8 - dstBit));
+        }
+
+        for (; i < nBits; ++i)
+            setBit(m_data.data(), dstOffset + i, src.getBit(src.readData(), srcOffset + i));
+    }
+
+    void BitStream::setSink(std::ostream* pSink)
+    {
+        if (m_readOffset != 0 || m_size != 0)
+            throw std::runtime_error("Unable to set the sink of a non-empty bitstream.");
+
+        m_pSink = pSink;
+        m_nSunkBits = 0;
+    }
+
+    uint64_t BitStream::flushSink()
+    {
+        if (!m_pSink)
+            throw std::runtime_error("Unable to flush a bitstream without a sink.");
+
+        // Drained chunks leave old bits behind the last written one, the padding is cleared.
+        if (m_size % 8)
+            m_data[m_size / 8] &= (1 << (m_size % 8)) - 1;
+
+        m_pSink->write(m_data.data(), minBytes(m_size));
+        m_nSunkBits += m_size;
+        m_writeOffset = 0;
+        m_size = 0;
+
+        return m_nSunkBits;
+    }
+
+    void BitStream::drainToSink()
+    {
+        // Only whole bytes below the current size are complete,
+        // the partially written last byte moves to the front.
+        uint64_t nBytes = m_size / 8;
+        m_pSink->write(m_data.data(), nBytes);
+        if (m_size % 8)
+            m_data[0] = m_data[nBytes];
+
+        m_nSunkBits += nBytes * 8;
+        m_writeOffset -= nBytes * 8;
+        m_size -= nBytes * 8;
+    }
+
     void BitStream::reset() noexcept
     {
         m_readOffset = 0;
         m_writeOffset = 0;
         m_size = 0;
+        m_reserved = 0;
         m_data.clear();
+        m_pView = nullptr;
     }
 
     std::istream& operator>>(std::istream& iStream, BitStream& bs)
@@ -27,9 +112,30 @@ namespace Blomp
         iStream.read((char*)&nBits, sizeof(nBits));
 
         bs.reset();
+        if (!iStream)
+            return iStream;
+
+        // Don't trust the stored size of truncated or damaged streams.
+        auto beginPos = iStream.tellg();
+        if (beginPos != std::istream::pos_type(-1))
+        {
+            iStream.seekg(0, std::ios::end);
+            auto endPos = iStream.tellg();
+            iStream.seekg(beginPos);
+
+            if (uint64_t(endPos - beginPos) < BitStream::minBytes(nBits))
+            {
+                iStream.setstate(std::ios::failbit);
+                return iStream;
+            }
+        }
+
+        bs.reserve(nBits);
         bs.resize(nBits);
 
         iStream.read((char*)bs.data(), BitStream::minBytes(nBits));
+        if ((uint64_t)iStream.gcount() != BitStream::minBytes(nBits))
+            iStream.setstate(std::ios::failbit);
 
         return iStream;
     }
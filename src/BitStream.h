@@ -2,8 +2,11 @@
 
 #include <stdint.h>
 #include <iostream>
+#include <stdexcept>
 #include <vector>
 
+#include "MemoryTracker.h"
+
 namespace Blomp
 {
     class BitStream
@@ -12,34 +15,60 @@ namespace Blomp
         BitStream() = default;
         BitStream(uint64_t nBits);
         BitStream(std::istream& iStream);
+        // Reads the bits in place instead of copying them. The data must
+        // outlive the stream and the stream can't be written to.
+        static BitStream view(const void* data, uint64_t nBits);
     public:
         bool readBit();
         void writeBit(bool value);
         void read(void* dest, uint64_t nBits);
+        bool readBitNC();
+        void readNC(void* dest, uint64_t nBits);
         void write(const void* src, uint64_t nBits);
         template <typename T> void read(T& dest);
         template <typename T> void write(const T& src);
+        void skip(uint64_t nBits);
+        void append(const BitStream& src, uint64_t srcOffset, uint64_t nBits);
     public:
         void resize(uint64_t nBits);
         void reserve(uint64_t nBits);
         void reset() noexcept;
+    public:
+        // Bits written to a stream with a sink are passed on in chunks of whole
+        // bytes, so only the last chunk is held in memory. size() then only
+        // counts the bits that are not yet passed on.
+        void setSink(std::ostream* pSink);
+        // Writes the remaining bits and returns the total number of bits written to the sink.
+        uint64_t flushSink();
     public:
         uint64_t size() const;
+        uint64_t readOffset() const;
+        void seekRead(uint64_t offset);
         void* data();
         const void* data() const;
     private:
+        const char* readData() const;
         bool getBit(const char* data, uint64_t offset) const;
         void setBit(char* data, uint64_t offset, bool value);
+        static bool getBitNC(const char* data, uint64_t offset);
+        static void setBitNC(char* data, uint64_t offset, bool value);
     public:
         static uint64_t minBytes(uint64_t nBits);
     private:
         static void splitOffset(uint64_t& byteOut, uint64_t& bitOut, uint64_t offsetIn);
+    private:
+        void drainToSink();
+    private:
+        static constexpr uint64_t SINK_CHUNK_BITS = 1 << 20;
     private:
         uint64_t m_readOffset = 0;
         uint64_t m_writeOffset = 0;
         uint64_t m_size = 0;
         uint64_t m_reserved = 0;
-        std::vector<char> m_data;
+        std::vector<char, TrackedAllocator<char, MemoryCategory::BitStream>> m_data;
+        std::ostream* m_pSink = nullptr;
+        uint64_t m_nSunkBits = 0;
+        const char* m_pView = nullptr;
     };
 
     std::istream& operator>>(std::istream& iStream, BitStream& bs);
@@ -61,7 +90,7 @@ namespace Blomp
     {
         ++m_readOffset;
 
-        return getBit(m_data.data(), m_readOffset - 1);
+        return getBit(readData(), m_readOffset - 1);
     }
 
     inline void BitStream::writeBit(bool value)
@@ -69,7 +98,11 @@ namespace Blomp
         ++m_writeOffset;
 
         if (m_writeOffset > m_size)
+        {
+            if (m_pSink && m_size >= SINK_CHUNK_BITS)
+                drainToSink();
             resize(m_writeOffset);
+        }
 
         setBit(m_data.data(), m_writeOffset - 1, value);
     }
@@ -80,22 +113,67 @@ namespace Blomp
             setBit((char*)dest, i, readBit());
     }
 
+    // The NC (no check) functions must only be used on bitstreams
+    // that have been validated to contain the bits read.
+    inline bool BitStream::readBitNC()
+    {
+        return getBitNC(readData(), m_readOffset++);
+    }
+
+    inline void BitStream::readNC(void* dest, uint64_t nBits)
+    {
+        const uint8_t* srcData = (const uint8_t*)readData();
+        uint8_t* destData = (uint8_t*)dest;
+
+        uint64_t byte;
+        uint64_t bit;
+        splitOffset(byte, bit, m_readOffset);
+
+        uint64_t i = 0;
+        for (; i + 8 <= nBits; i += 8, ++byte)
+        {
+            uint8_t value = srcData[byte] >> bit;
+            if (bit)
+                value |= srcData[byte + 1] << (8 - bit);
+            destData[i / 8] = value;
+        }
+
+        for (; i < nBits; ++i)
+            setBitNC((char*)dest, i, getBitNC((const char*)srcData, m_readOffset + i));
+
+        m_readOffset += nBits;
+    }
+
     inline void BitStream::write(const void* src, uint64_t nBits)
     {
+        // The source holds exactly nBits, so its bits aren't checked against this stream.
         for (uint64_t i = 0; i < nBits; ++i)
-            writeBit(getBit((const char*)src, i));
+            writeBit(getBitNC((const char*)src, i));
+    }
+
+    inline void BitStream::skip(uint64_t nBits)
+    {
+        if (m_readOffset + nBits > m_size)
+            throw std::runtime_error("Unable to skip past the end of bitstream.");
+
+        m_readOffset += nBits;
     }
 
     inline void BitStream::resize(uint64_t nBits)
     {
         m_size = nBits;
         if (m_reserved < nBits)
-            reserve(nBits);
+            reserve(nBits + nBits / 2);
     }
 
     inline void BitStream::reserve(uint64_t nBits)
     {
-        m_reserved = nBits + nBits / 2;
+        if (nBits <= m_reserved)
+            return;
+        if (m_pView)
+            throw std::runtime_error("Unable to write to a bitstream view.");
+
+        m_reserved = nBits;
         m_data.resize(BitStream::minBytes(m_reserved));
     }
 
@@ -109,6 +187,19 @@ namespace Blomp
         return m_size;
     }
 
+    inline uint64_t BitStream::readOffset() const
+    {
+        return m_readOffset;
+    }
+
+    inline void BitStream::seekRead(uint64_t offset)
+    {
+        if (offset > m_size)
+            throw std::runtime_error("Unable to seek past the end of bitstream.");
+
+        m_readOffset = offset;
+    }
+
     inline void* BitStream::data()
     {
         return m_data.data();
@@ -116,7 +207,12 @@ namespace Blomp
 
     inline const void* BitStream::data() const
     {
-        return m_data.data();
+        return readData();
+    }
+
+    inline const char* BitStream::readData() const
+    {
+        return m_pView ? m_pView : m_data.data();
     }
 
     inline bool BitStream::getBit(const char* data, uint64_t offset) const
@@ -124,6 +220,19 @@ namespace Blomp
         if (offset >= m_size)
             throw std::runtime_error("Unable to get out-of-bounds bit of bitstream.");
 
+        return getBitNC(data, offset);
+    }
+
+    inline void BitStream::setBit(char* data, uint64_t offset, bool value)
+    {
+        if (offset >= m_size)
+            throw std::runtime_error("Unable to set out-of-bounds bit of bitstream.");
+
+        setBitNC(data, offset, value);
+    }
+
+    inline bool BitStream::getBitNC(const char* data, uint64_t offset)
+    {
         uint64_t byte;
         uint64_t bit;
         splitOffset(byte, bit, offset);
@@ -131,11 +240,8 @@ namespace Blomp
         return (data[byte] >> bit) & 1;
     }
 
-    inline void BitStream::setBit(char* data, uint64_t offset, bool value)
+    inline void BitStream::setBitNC(char* data, uint64_t offset, bool value)
     {
-        if (offset >= m_size)
-            throw std::runtime_error("Unable to set out-of-bounds bit of bitstream.");
-
         uint64_t byte;
         uint64_t bit;
         splitOffset(byte, bit, offset);
@@ -1,29 +1,176 @@
 #include "BlockTree.h"
+#include "ColorCache.h"
 #include "Descriptors.h"
+#include "Trace.h"
+#include <limits>
+#include <memory>
 #include <stdexcept>
 
 namespace Blomp
 {
     namespace BlockTree
     {
+        static BlockTreeDesc createBlockTreeDesc(BaseDescriptor bd, SplitMode splitMode, ColorMode colorMode, LeafCoding leafCoding, LeafShape leafShape, ColorCache& colorCache)
+        {
+            BlockTreeDesc btDesc;
+            btDesc.maxDepth = bd.maxDepth;
+            btDesc.variationThreshold = 0.0f;
+            btDesc.splitMode = splitMode;
+            btDesc.colorMode = colorMode;
+            btDesc.leafCoding = leafCoding;
+            btDesc.leafShape = leafShape;
+            btDesc.pColorCache = leafCoding == LeafCoding::Cache ? &colorCache : nullptr;
+            return btDesc;
+        }
+
+        static void checkBuffer(BaseDescriptor bd, const BufferDesc& bufDesc)
+        {
+            if (bufDesc.width != bd.imgWidth || bufDesc.height != bd.imgHeight)
+                throw std::runtime_error("Buffer dimensions do not match the blomp file.");
+            if (bufDesc.nChannels != 3 && bufDesc.nChannels != 4)
+                throw std::runtime_error("Unsupported buffer channel count.");
+            if (bufDesc.stride < bufDesc.width * bufDesc.nChannels)
+                throw std::runtime_error("Buffer stride too small.");
+        }
+
         ParentBlockRef fromImage(const Image &img, const BlockTreeDesc& btDesc)
         {
+            if (btDesc.colorMode == ColorMode::YCbCr)
+                return fromImage(img, btDesc, btDesc);
+
+            // A single build reads every block once, so no pyramid levels are
+            // built and the stats of each block are summed from the pixels.
+            return fromImage(StatsPyramid(img, btDesc.colorMode, btDesc.maxDepth, btDesc.maxDepth + 1), btDesc);
+        }
+
+        ParentBlockRef fromImage(const StatsPyramid& pyramid, const BlockTreeDesc& btDesc)
+        {
+            if (pyramid.colorMode() != btDesc.colorMode)
+                throw std::runtime_error("Color mode differs from the statistics pyramid.");
+            if (pyramid.maxLevel() < btDesc.maxDepth)
+                throw std::runtime_error("Block depth exceeds the statistics pyramid.");
+
             ParentBlockDesc pbDesc;
             pbDesc.x = 0;
             pbDesc.y = 0;
-            pbDesc.width = img.width();
-            pbDesc.height = img.height();
+            pbDesc.width = pyramid.image().width();
+            pbDesc.height = pyramid.image().height();
             pbDesc.depth = -1;
 
-            return ParentBlockRef(new ParentBlock(pbDesc, btDesc, img));
+            return makeBlockRef(new ParentBlock(pbDesc, btDesc, pyramid));
+        }
+
+        ParentBlockRef fromImage(const Image& img, const BlockTreeDesc& lumaDesc, const BlockTreeDesc& chromaDesc)
+        {
+            return makeBlockRef(new YCbCrBlock(lumaDesc, chromaDesc, img));
+        }
+
+        ParentBlockRef fromRDOptimizer(const RDOptimizer& rdo)
+        {
+            ParentBlockDesc pbDesc;
+            pbDesc.x = 0;
+            pbDesc.y = 0;
+            pbDesc.width = rdo.image().width();
+            pbDesc.height = rdo.image().height();
+            pbDesc.depth = -1;
+
+            BlockTreeDesc btDesc;
+            btDesc.maxDepth = rdo.maxDepth();
+            btDesc.variationThreshold = 0.0f;
+            btDesc.colorMode = rdo.colorMode();
+
+            return makeBlockRef(new ParentBlock(pbDesc, btDesc, rdo));
+        }
+
+        std::shared_ptr<FrameBlock> fromFrame(const Image& img, const BlockTreeDesc& btDesc, const ParentBlockRef prevFrame)
+        {
+            return makeBlockRef(new FrameBlock(btDesc, img, prevFrame.get()));
+        }
+
+        int updateRegions(BaseDescriptor bd, const BlockTreeDesc& btDesc, BitStream& srcStream, const Image& img, const std::vector<Rect>& dirtyRects, BitStream& dstStream, BlockCounts& dstCounts)
+        {
+            if (img.width() != bd.imgWidth || img.height() != bd.imgHeight)
+                throw std::runtime_error("Image dimensions differ from the blomp file.");
+            if (btDesc.maxDepth != bd.maxDepth)
+                throw std::runtime_error("Block depth differs from the blomp file.");
+            if (btDesc.colorMode == ColorMode::YCbCr)
+                throw std::runtime_error("Regions of the 'ycbcr' color mode can't be updated.");
+            // Cached leaves depend on all previous tiles, so tiles can't be copied on their own.
+            if (btDesc.leafCoding == LeafCoding::Cache)
+                throw std::runtime_error("Regions of a color cached blomp file can't be updated.");
+
+            if (!isValid(bd, btDesc.splitMode, btDesc.colorMode, btDesc.leafCoding, btDesc.leafShape, srcStream))
+                throw std::runtime_error("Unable to read damaged blomp file.");
+            srcStream.readBitNC();
+
+            dstStream.reserve(srcStream.size());
+            dstStream.writeBit(true);
+
+            dstCounts = BlockCounts();
+            ++dstCounts.nBlocks;
+            ++dstCounts.nBits;
+
+            int nRebuiltTiles = 0;
+            int blockDim = ParentBlock::tileDim(btDesc);
+
+            // Only dirty tiles are rebuilt, so no pyramid levels are built.
+            StatsPyramid pyramid(img, btDesc.colorMode, 0);
+
+            for (int y = 0; y < bd.imgHeight; y += blockDim)
+            {
+                for (int x = 0; x < bd.imgWidth; x += blockDim)
+                {
+                    uint64_t tileOffset = srcStream.readOffset();
+                    BlockCounts tileCounts;
+                    ParentBlock::skipTile(x, y, btDesc, bd.imgWidth, bd.imgHeight, srcStream, tileCounts);
+
+                    if (!ParentBlock::intersects(x, y, blockDim, blockDim, dirtyRects))
+                    {
+                        dstStream.append(srcStream, tileOffset, srcStream.readOffset() - tileOffset);
+                        dstCounts.nBlocks += tileCounts.nBlocks;
+                        dstCounts.nColorBlocks += tileCounts.nColorBlocks;
+                        dstCounts.nBits += tileCounts.nBits;
+                        continue;
+                    }
+
+                    auto tile = ParentBlock::createTile(x, y, btDesc, pyramid);
+                    tile->serialize(dstStream);
+                    dstCounts.nBlocks += tile->nBlocks();
+                    dstCounts.nColorBlocks += tile->nColorBlocks();
+                    dstCounts.nBits += tile->nBits();
+                    ++nRebuiltTiles;
+                }
+            }
+
+            return nRebuiltTiles;
         }
 
         void serialize(ParentBlockRef pbRef, BitStream& bitStream)
         {
+            TraceScope trace("serialize", "io");
+            trace.arg("blocks", pbRef->nBlocks());
+            trace.arg("bits", pbRef->nBits());
+
             pbRef->serialize(bitStream);
         }
 
-        ParentBlockRef deserialize(BaseDescriptor bd, BitStream& bitStream)
+        void serialize(ParentBlockRef pbRef, const BlockTreeDesc& btDesc, BitStream& bitStream)
+        {
+            TraceScope trace("serialize", "io");
+            trace.arg("blocks", pbRef->nBlocks());
+            trace.arg("bits", pbRef->nBits());
+
+            if (btDesc.leafCoding == LeafCoding::Literal)
+            {
+                pbRef->serialize(bitStream);
+                return;
+            }
+
+            ColorCache colorCache;
+            pbRef->serialize(bitStream, &colorCache);
+        }
+
+        ParentBlockRef deserialize(BaseDescriptor bd, SplitMode splitMode, ColorMode colorMode, LeafCoding leafCoding, LeafShape leafShape, BitStream& bitStream)
         {
             ParentBlockDesc pbDesc;
             pbDesc.x = 0;
@@ -31,15 +178,219 @@ namespace Blomp
             pbDesc.width = bd.imgWidth;
             pbDesc.height = bd.imgHeight;
             pbDesc.depth = -1;
-            
-            BlockTreeDesc btDesc;
-            btDesc.maxDepth = bd.maxDepth;
-            btDesc.variationThreshold = 0.0f;
+
+            if (!isValid(bd, splitMode, colorMode, leafCoding, leafShape, bitStream))
+                throw std::runtime_error("Unable to read damaged blomp file.");
+
+            ColorCache colorCache;
+            BlockTreeDesc btDesc = createBlockTreeDesc(bd, splitMode, colorMode, leafCoding, leafShape, colorCache);
+            bitStream.readBitNC();
+
+            if (colorMode == ColorMode::YCbCr)
+                return makeBlockRef(new YCbCrBlock(btDesc, bd.imgWidth, bd.imgHeight, bitStream));
+
+            return makeBlockRef(new ParentBlock(pbDesc, btDesc, bd.imgWidth, bd.imgHeight, bitStream));
+        }
+
+        BlockCounts decodeToBuffer(BaseDescriptor bd, SplitMode splitMode, ColorMode colorMode, LeafCoding leafCoding, LeafShape leafShape, BitStream& bitStream, const BufferDesc& bufDesc)
+        {
+            if (!isValid(bd, splitMode, colorMode, leafCoding, leafShape, bitStream))
+                throw std::runtime_error("Unable to read damaged blomp file.");
+
+            checkBuffer(bd, bufDesc);
+
+            ParentBlockDesc pbDesc;
+            pbDesc.x = 0;
+            pbDesc.y = 0;
+            pbDesc.width = bd.imgWidth;
+            pbDesc.height = bd.imgHeight;
+            pbDesc.depth = -1;
+
+            ColorCache colorCache;
+            BlockTreeDesc btDesc = createBlockTreeDesc(bd, splitMode, colorMode, leafCoding, leafShape, colorCache);
+            bitStream.readBitNC();
+
+            TraceScope trace("write", "io");
+
+            BlockCounts counts;
+            if (colorMode == ColorMode::YCbCr)
+                YCbCrBlock::decodeToBuffer(btDesc, bufDesc, bitStream, counts);
+            else
+                ParentBlock::decodeToBuffer(pbDesc, btDesc, bufDesc, bitStream, counts);
+
+            trace.arg("blocks", counts.nBlocks);
+            return counts;
+        }
+
+        BlockCounts decodeFrameToBuffer(BaseDescriptor bd, SplitMode splitMode, BitStream& bitStream, const BufferDesc& bufDesc, bool hasPrevFrame)
+        {
+            if (!isValidFrame(bd, splitMode, bitStream, hasPrevFrame))
+                throw std::runtime_error("Unable to read damaged blomp sequence file.");
+
+            checkBuffer(bd, bufDesc);
+
+            ColorCache colorCache;
+            BlockTreeDesc btDesc = createBlockTreeDesc(bd, splitMode, ColorMode::RGB, LeafCoding::Literal, LeafShape::Flat, colorCache);
+            bitStream.readBitNC();
+
+            TraceScope trace("write", "io");
+
+            BlockCounts counts;
+            FrameBlock::decodeToBuffer(btDesc, bufDesc, bitStream, counts);
+
+            trace.arg("blocks", counts.nBlocks);
+
+            return counts;
+        }
+
+        TreeReport report(BaseDescriptor bd, SplitMode splitMode, ColorMode colorMode, LeafCoding leafCoding, LeafShape leafShape, BitStream& bitStream, const Image* pSourceImg)
+        {
+            if (!isValid(bd))
+                throw std::runtime_error("Unable to read damaged blomp file.");
+            if (pSourceImg && (pSourceImg->width() != bd.imgWidth || pSourceImg->height() != bd.imgHeight))
+                throw std::runtime_error("Image dimensions differ from the block tree.");
+
+            // The leaves are compared in the color space they were built from.
+            std::unique_ptr<Image> pPlaneImg;
+            if (pSourceImg)
+            {
+                pPlaneImg.reset(new Image(*pSourceImg));
+                if (colorMode == ColorMode::Gray)
+                    pPlaneImg->toGray();
+                else if (colorMode == ColorMode::YCbCr)
+                    pPlaneImg->toYCbCr();
+            }
+
+            ColorCache colorCache;
+            BlockTreeDesc btDesc = createBlockTreeDesc(bd, splitMode, colorMode, leafCoding, leafShape, colorCache);
+
+            TreeReport report;
+            report.hasVariations = pSourceImg != nullptr;
 
             if (!bitStream.readBit())
                 throw std::runtime_error("Unable to read damaged blomp file.");
 
-            return ParentBlockRef(new ParentBlock(pbDesc, btDesc, bd.imgWidth, bd.imgHeight, bitStream));
+            if (colorMode == ColorMode::YCbCr)
+            {
+                YCbCrBlock::report(btDesc, bd.imgWidth, bd.imgHeight, bitStream, pPlaneImg.get(), report);
+            }
+            else
+            {
+                report.nRootBlocks = 1;
+                report.rootBits = 1;
+                report.planes.emplace_back();
+                report.planes.back().name = colorMode == ColorMode::Gray ? "gray" : "rgb";
+                report.planes.back().maxDepth = bd.maxDepth;
+
+                int blockDim = ParentBlock::tileDim(btDesc);
+                for (int y = 0; y < bd.imgHeight; y += blockDim)
+                    for (int x = 0; x < bd.imgWidth; x += blockDim)
+                        ParentBlock::reportTile(x, y, btDesc, bd.imgWidth, bd.imgHeight, bitStream, pPlaneImg.get(), report.planes.back());
+            }
+
+            if (bitStream.readOffset() != bitStream.size())
+                throw std::runtime_error("Unable to read damaged blomp file.");
+
+            return report;
+        }
+
+        bool isValid(BaseDescriptor bd)
+        {
+            // Buffers of 4 channels per pixel must still be addressable with int strides.
+            return
+                bd.imgWidth > 0 && bd.imgHeight > 0 &&
+                0 <= bd.maxDepth && bd.maxDepth <= 30 &&
+                (int64_t)bd.imgWidth * 4 <= std::numeric_limits<int>::max() &&
+                (int64_t)bd.imgWidth * bd.imgHeight <= std::numeric_limits<int>::max();
+        }
+
+        bool isValid(BaseDescriptor bd, SplitMode splitMode, ColorMode colorMode, LeafCoding leafCoding, LeafShape leafShape, BitStream& bitStream)
+        {
+            BlockCounts counts;
+            return scan(bd, splitMode, colorMode, leafCoding, leafShape, bitStream, counts);
+        }
+
+        bool scan(BaseDescriptor bd, SplitMode splitMode, ColorMode colorMode, LeafCoding leafCoding, LeafShape leafShape, BitStream& bitStream, BlockCounts& counts)
+        {
+            counts = BlockCounts();
+            if (!isValid(bd))
+                return false;
+
+            ColorCache colorCache;
+            BlockTreeDesc btDesc = createBlockTreeDesc(bd, splitMode, colorMode, leafCoding, leafShape, colorCache);
+            uint64_t beginOffset = bitStream.readOffset();
+            bool valid = false;
+
+            try
+            {
+                if (bitStream.readBit())
+                {
+                    if (colorMode == ColorMode::YCbCr)
+                    {
+                        YCbCrBlock::skip(btDesc, bd.imgWidth, bd.imgHeight, bitStream, counts);
+                    }
+                    else
+                    {
+                        ++counts.nBlocks;
+                        ++counts.nBits;
+
+                        int blockDim = ParentBlock::tileDim(btDesc);
+                        for (int y = 0; y < bd.imgHeight; y += blockDim)
+                            for (int x = 0; x < bd.imgWidth; x += blockDim)
+                                ParentBlock::skipTile(x, y, btDesc, bd.imgWidth, bd.imgHeight, bitStream, counts);
+                    }
+
+                    valid = bitStream.readOffset() == bitStream.size();
+                }
+            }
+            catch (std::runtime_error&)
+            {
+                valid = false;
+            }
+
+            bitStream.seekRead(beginOffset);
+            return valid;
+        }
+
+        bool isValidFrame(BaseDescriptor bd, SplitMode splitMode, BitStream& bitStream, bool hasPrevFrame)
+        {
+            if (!isValid(bd))
+                return false;
+
+            ColorCache colorCache;
+            BlockTreeDesc btDesc = createBlockTreeDesc(bd, splitMode, ColorMode::RGB, LeafCoding::Literal, LeafShape::Flat, colorCache);
+            BlockCounts counts;
+            uint64_t beginOffset = bitStream.readOffset();
+            bool valid = false;
+
+            try
+            {
+                if (bitStream.readBit())
+                {
+                    valid = true;
+
+                    int blockDim = ParentBlock::tileDim(btDesc);
+                    for (int y = 0; y < bd.imgHeight && valid; y += blockDim)
+                    {
+                        for (int x = 0; x < bd.imgWidth && valid; x += blockDim)
+                        {
+                            if (bitStream.readBit())
+                                valid = hasPrevFrame;
+                            else
+                                ParentBlock::skipTile(x, y, btDesc, bd.imgWidth, bd.imgHeight, bitStream, counts);
+                        }
+                    }
+
+                    valid = valid && bitStream.readOffset() == bitStream.size();
+                }
+            }
+            catch (std::runtime_error&)
+            {
+                valid = false;
+            }
+
+            bitStream.seekRead(beginOffset);
+            return valid;
         }
     }
 }
\ No newline at end of file
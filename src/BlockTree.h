@@ -2,6 +2,7 @@
 
 #include "Blocks.h"
 #include "Descriptors.h"
+#include "TreeReport.h"
 
 namespace Blomp
 {
@@ -9,8 +10,39 @@ namespace Blomp
     {
         ParentBlockRef fromImage(const Image& img, const BlockTreeDesc& btDesc);
 
+        // Reuses the statistics of the pyramid, which has to cover btDesc.maxDepth levels.
+        ParentBlockRef fromImage(const StatsPyramid& pyramid, const BlockTreeDesc& btDesc);
+
+        ParentBlockRef fromImage(const Image& img, const BlockTreeDesc& lumaDesc, const BlockTreeDesc& chromaDesc);
+
+        ParentBlockRef fromRDOptimizer(const RDOptimizer& rdo);
+
+        std::shared_ptr<FrameBlock> fromFrame(const Image& img, const BlockTreeDesc& btDesc, const ParentBlockRef prevFrame);
+
+        int updateRegions(BaseDescriptor bd, const BlockTreeDesc& btDesc, BitStream& srcStream, const Image& img, const std::vector<Rect>& dirtyRects, BitStream& dstStream, BlockCounts& dstCounts);
+
         void serialize(ParentBlockRef pbRef, BitStream& bitStream);
 
-        ParentBlockRef deserialize(BaseDescriptor bd, BitStream& bitStream);
+        void serialize(ParentBlockRef pbRef, const BlockTreeDesc& btDesc, BitStream& bitStream);
+
+        bool isValid(BaseDescriptor bd);
+
+        bool isValid(BaseDescriptor bd, SplitMode splitMode, ColorMode colorMode, LeafCoding leafCoding, LeafShape leafShape, BitStream& bitStream);
+
+        // Walks the structure of a blomp file without building any blocks, which also validates it.
+        // Returns false for damaged files, the read offset is kept in both cases.
+        bool scan(BaseDescriptor bd, SplitMode splitMode, ColorMode colorMode, LeafCoding leafCoding, LeafShape leafShape, BitStream& bitStream, BlockCounts& counts);
+
+        bool isValidFrame(BaseDescriptor bd, SplitMode splitMode, BitStream& bitStream, bool hasPrevFrame);
+
+        ParentBlockRef deserialize(BaseDescriptor bd, SplitMode splitMode, ColorMode colorMode, LeafCoding leafCoding, LeafShape leafShape, BitStream& bitStream);
+
+        BlockCounts decodeToBuffer(BaseDescriptor bd, SplitMode splitMode, ColorMode colorMode, LeafCoding leafCoding, LeafShape leafShape, BitStream& bitStream, const BufferDesc& bufDesc);
+
+        // Gathers the structure of a blomp file in a single pass, which also validates it.
+        // With a source image the variation of every leaf against its pixels is included.
+        TreeReport report(BaseDescriptor bd, SplitMode splitMode, ColorMode colorMode, LeafCoding leafCoding, LeafShape leafShape, BitStream& bitStream, const Image* pSourceImg = nullptr);
+
+        BlockCounts decodeFrameToBuffer(BaseDescriptor bd, SplitMode splitMode, BitStream& bitStream, const BufferDesc& bufDesc, bool hasPrevFrame);
     }
 }
\ No newline at end of file
@@ -1,27 +1,283 @@
 #include "Blocks.h"
 #include "Descriptors.h"
+#include "Trace.h"
 #include <algorithm>
+#include <cstring>
 #include <iostream>
+#include <limits>
 #include <stdexcept>
+#include <type_traits>
 
 namespace Blomp
 {
+    // Number of splits the binary split choice looks ahead. The statistics of
+    // a block are gathered once on a grid of 2^SPLIT_LOOKAHEAD cells per side.
+    static constexpr int SPLIT_LOOKAHEAD = 2;
+
+    // Parent flag and 2 bit SplitType of a binary split parent.
+    static constexpr int SPLIT_PARENT_BITS = 1 + 2;
+
+    // The CLI limits the depth to 10. Deeper trees of other files use the
+    // generic functions until their blocks are small enough.
+    static constexpr int MAX_SPECIALIZED_LOG_DIM = 10;
+
+    // Calls func with the log2 of the block dimension as a compile-time constant.
+    template <int LOG_DIM = 0, typename Func>
+    static decltype(auto) dispatchLogDim(int logDim, Func&& func)
+    {
+        if constexpr (LOG_DIM < MAX_SPECIALIZED_LOG_DIM)
+        {
+            if (logDim > LOG_DIM)
+                return dispatchLogDim<LOG_DIM + 1>(logDim, func);
+        }
+        return func(std::integral_constant<int, LOG_DIM>());
+    }
+
+    // Visits the quadrants of a block of w x h pixels in the order they are serialized in,
+    // quadrants outside of the image are left out.
+    template <int HALF_DIM, typename Func>
+    static void forEachQuadrant(int x, int y, int w, int h, Func&& func)
+    {
+        func(x, y);
+        if (HALF_DIM < w)
+            func(x + HALF_DIM, y);
+        if (HALF_DIM < h)
+        {
+            func(x, y + HALF_DIM);
+            if (HALF_DIM < w)
+                func(x + HALF_DIM, y + HALF_DIM);
+        }
+    }
+
+    // Statistics of a block on a grid of up to 2^SPLIT_LOOKAHEAD x 2^SPLIT_LOOKAHEAD cells.
+    // Blocks of fewer pixels per side get one cell per pixel.
+    struct SplitGrid
+    {
+        static constexpr int MAX_CELLS = 1 << SPLIT_LOOKAHEAD;
+
+        ColorStats cells[MAX_CELLS][MAX_CELLS];
+
+        ColorStats sum(int col, int row, int logCols, int logRows) const
+        {
+            ColorStats cs;
+            for (int r = row; r < row + (1 << logRows); ++r)
+                for (int c = col; c < col + (1 << logCols); ++c)
+                    cs += cells[r][c];
+            return cs;
+        }
+    };
+
+    // Estimated bits of a block made of the given grid cells when it is split
+    // nLevels more times at most. Blocks that would still be split after that
+    // are counted as a parent with two leaves, the fewest bits they can take.
+    // Leaves outside of the image take no bits.
+    static int estimateSplitBits(const SplitGrid& grid, int col, int row, int logCols, int logRows, int logWidth, int logHeight, int nLevels, int leafBits, float variationThreshold);
+
+    static int estimateChildBits(const SplitGrid& grid, SplitType splitType, int col, int row, int logCols, int logRows, int logWidth, int logHeight, int nLevels, int leafBits, float variationThreshold)
+    {
+        int splitsWidth = splitType != SplitType::Horizontal ? 1 : 0;
+        int splitsHeight = splitType != SplitType::Vertical ? 1 : 0;
+        logCols -= splitsWidth;
+        logRows -= splitsHeight;
+        logWidth -= splitsWidth;
+        logHeight -= splitsHeight;
+
+        int nBits = 0;
+        for (int r = row; r < row + (1 << (logRows + splitsHeight)); r += 1 << logRows)
+            for (int c = col; c < col + (1 << (logCols + splitsWidth)); c += 1 << logCols)
+                nBits += estimateSplitBits(grid, c, r, logCols, logRows, logWidth, logHeight, nLevels, leafBits, variationThreshold);
+
+        return nBits;
+    }
+
+    static int estimateSplitBits(const SplitGrid& grid, int col, int row, int logCols, int logRows, int logWidth, int logHeight, int nLevels, int leafBits, float variationThreshold)
+    {
+        ColorStats cs = grid.sum(col, row, logCols, logRows);
+        if (cs.nPixels == 0)
+            return 0;
+        if (cs.meetsThreshold(variationThreshold) || (logWidth == 0 && logHeight == 0))
+            return leafBits;
+        if (nLevels == 0)
+            return SPLIT_PARENT_BITS + 2 * leafBits;
+
+        int minChildBits = std::numeric_limits<int>::max();
+        if (logCols > 0 && logRows > 0)
+            minChildBits = std::min(minChildBits, estimateChildBits(grid, SplitType::Quad, col, row, logCols, logRows, logWidth, logHeight, nLevels - 1, leafBits, variationThreshold));
+        if (logRows > 0)
+            minChildBits = std::min(minChildBits, estimateChildBits(grid, SplitType::Horizontal, col, row, logCols, logRows, logWidth, logHeight, nLevels - 1, leafBits, variationThreshold));
+        if (logCols > 0)
+            minChildBits = std::min(minChildBits, estimateChildBits(grid, SplitType::Vertical, col, row, logCols, logRows, logWidth, logHeight, nLevels - 1, leafBits, variationThreshold));
+
+        return SPLIT_PARENT_BITS + minChildBits;
+    }
+
+    static void fillBufferRect(const BufferDesc& bufDesc, int x, int y, int w, int h, const uint8_t* pixelData)
+    {
+        uint8_t* firstRow = bufDesc.data + (uint64_t)y * bufDesc.stride + (uint64_t)x * bufDesc.nChannels;
+        for (int rx = 0; rx < w; ++rx)
+            std::memcpy(firstRow + rx * bufDesc.nChannels, pixelData, bufDesc.nChannels);
+
+        uint64_t rowBytes = (uint64_t)w * bufDesc.nChannels;
+        for (int ry = 1; ry < h; ++ry)
+            std::memcpy(firstRow + (uint64_t)ry * bufDesc.stride, firstRow, rowBytes);
+    }
+
+    static void fillBufferChroma(const BufferDesc& bufDesc, int x, int y, int w, int h, const uint8_t* pixelData)
+    {
+        for (int ry = y; ry < y + h; ++ry)
+        {
+            uint8_t* row = bufDesc.data + (uint64_t)ry * bufDesc.stride + (uint64_t)x * bufDesc.nChannels;
+            for (int rx = 0; rx < w; ++rx)
+            {
+                row[rx * bufDesc.nChannels + 1] = pixelData[1];
+                row[rx * bufDesc.nChannels + 2] = pixelData[2];
+            }
+        }
+    }
+
+    static void fillImageRect(Image& img, int x, int y, int w, int h, Color color)
+    {
+        for (int ry = y; ry < y + h; ++ry)
+        {
+            for (int rx = x, n; rx < x + w; rx += n)
+            {
+                n = std::min(img.rowRunNC(rx), x + w - rx);
+                std::fill_n(&img.getNC(rx, ry), n, color);
+            }
+        }
+    }
+
+    // Whether two blocks serialize to the same bits with literal colors.
+    static bool hasSameBits(const Block& left, const Block& right)
+    {
+        if (left.nBits() != right.nBits())
+            return false;
+
+        BitStream leftStream;
+        BitStream rightStream;
+        left.serialize(leftStream);
+        right.serialize(rightStream);
+
+        return leftStream.size() == rightStream.size() &&
+            std::memcmp(leftStream.data(), rightStream.data(), (size_t)(leftStream.size() + 7) / 8) == 0;
+    }
+
+    void* Block::operator new(size_t size)
+    {
+        MemoryTracker::acquire(MemoryCategory::Tree, size);
+
+        try
+        {
+            return ::operator new(size);
+        }
+        catch (...)
+        {
+            MemoryTracker::release(MemoryCategory::Tree, size);
+            throw;
+        }
+    }
+
+    void Block::operator delete(void* ptr, size_t size)
+    {
+        ::operator delete(ptr, size);
+        MemoryTracker::release(MemoryCategory::Tree, size);
+    }
+
     Block::Block(int x, int y, int w, int h)
         : m_x(x), m_y(y), m_w(w), m_h(h)
     {}
 
-    ColorBlock::ColorBlock(int x, int y, int w, int h, Pixel color)
-        : Block(x, y, w, h), m_color(color)
+    ColorBlock::ColorBlock(int x, int y, int w, int h, Color color, bool hasShapeBit)
+        : Block(x, y, w, h), m_color(color), m_hasShapeBit(hasShapeBit)
     {}
 
-    void ColorBlock::writeToImg(Image &img) const
+    GrayBlock::GrayBlock(int x, int y, int w, int h, uint8_t value, bool hasShapeBit)
+        : ColorBlock(x, y, w, h, Color(value, value, value), hasShapeBit)
+    {}
+
+    void GrayBlock::serialize(BitStream &bitStream, ColorCache* pColorCache) const
+    {
+        writeLeafFlags(bitStream, false);
+        writeColor(bitStream, pColorCache, &m_color.r, 8);
+    }
+
+    ChromaBlock::ChromaBlock(int x, int y, int w, int h, uint8_t cb, uint8_t cr, bool hasShapeBit)
+        : ColorBlock(x, y, w, h, Color(0, cb, cr), hasShapeBit)
+    {}
+
+    void ChromaBlock::writeToImg(Image &img) const
     {
         if (m_x + m_w > img.width() || m_y + m_h > img.height())
             throw std::runtime_error("Image dimensions too small.");
 
         for (int y = m_y; y < m_y + m_h; ++y)
-            for (int x = m_x; x < m_x + m_w; ++x)
-                img.getNC(x, y) = m_color;
+        {
+            for (int x = m_x, n; x < m_x + m_w; x += n)
+            {
+                n = std::min(img.rowRunNC(x), m_x + m_w - x);
+                Color* row = &img.getNC(x, y);
+                for (int i = 0; i < n; ++i)
+                {
+                    row[i].g = m_color.g;
+                    row[i].b = m_color.b;
+                }
+            }
+        }
+    }
+
+    void ChromaBlock::writeToBuffer(const BufferDesc& bufDesc) const
+    {
+        if (m_x + m_w > bufDesc.width || m_y + m_h > bufDesc.height)
+            throw std::runtime_error("Buffer dimensions too small.");
+
+        uint8_t pixelData[3] = { 0, m_color.g, m_color.b };
+
+        fillBufferChroma(bufDesc, m_x, m_y, m_w, m_h, pixelData);
+    }
+
+    void ChromaBlock::serialize(BitStream &bitStream, ColorCache* pColorCache) const
+    {
+        writeLeafFlags(bitStream, false);
+        writeColor(bitStream, pColorCache, &m_color.g, 2 * 8);
+    }
+
+    uint64_t ChromaBlock::calcError(const Image& img) const
+    {
+        uint64_t error = 0;
+        for (int y = m_y; y < m_y + m_h; ++y)
+        {
+            for (int x = m_x, n; x < m_x + m_w; x += n)
+            {
+                n = std::min(img.rowRunNC(x), m_x + m_w - x);
+                const Color* row = &img.getNC(x, y);
+                for (int i = 0; i < n; ++i)
+                {
+                    int dcb = row[i].g - m_color.g;
+                    int dcr = row[i].b - m_color.b;
+                    error += uint32_t(dcb * dcb + dcr * dcr);
+                }
+            }
+        }
+
+        return error;
+    }
+
+    void ColorBlock::writeToImg(Image &img) const
+    {
+        if (m_x + m_w > img.width() || m_y + m_h > img.height())
+            throw std::runtime_error("Image dimensions too small.");
+
+        fillImageRect(img, m_x, m_y, m_w, m_h, m_color);
+    }
+
+    void ColorBlock::writeToBuffer(const BufferDesc& bufDesc) const
+    {
+        if (m_x + m_w > bufDesc.width || m_y + m_h > bufDesc.height)
+            throw std::runtime_error("Buffer dimensions too small.");
+
+        uint8_t pixelData[4] = { m_color.r, m_color.g, m_color.b, 255 };
+
+        fillBufferRect(bufDesc, m_x, m_y, m_w, m_h, pixelData);
     }
 
     void ColorBlock::writeHeatmap(Image &img, int maxDepth, int depth) const
@@ -29,39 +285,160 @@ namespace Blomp
         if (m_x + m_w > img.width() || m_y + m_h > img.height())
             throw std::runtime_error("Image dimensions too small.");
 
-        Pixel color = 1.0f / maxDepth * depth;
-        for (int y = m_y; y < m_y + m_h; ++y)
-            for (int x = m_x; x < m_x + m_w; ++x)
-                img.getNC(x, y) = color;
+        fillImageRect(img, m_x, m_y, m_w, m_h, Color::fromPixel(1.0f / maxDepth * depth));
     }
 
-    void ColorBlock::serialize(BitStream &bitStream) const
+    void ColorBlock::serialize(BitStream &bitStream, ColorCache* pColorCache) const
+    {
+        writeLeafFlags(bitStream, false);
+        writeColor(bitStream, pColorCache, &m_color.r, 3 * 8);
+    }
+
+    void ColorBlock::writeLeafFlags(BitStream& bitStream, bool isGradient) const
     {
         bitStream.writeBit(false);
-        uint8_t pixelData[3];
-        m_color.toCharArray(pixelData);
-        bitStream.write(pixelData, 3 * 8);
+        if (m_hasShapeBit)
+            bitStream.writeBit(isGradient);
+    }
+
+    void ColorBlock::writeColor(BitStream& bitStream, ColorCache* pColorCache, const uint8_t* colorData, int nColorBits) const
+    {
+        if (!pColorCache)
+        {
+            bitStream.write(colorData, nColorBits);
+            return;
+        }
+
+        // A set bit is followed by the cache index, a cleared bit by the literal color.
+        int index = pColorCache->find(m_color);
+        bitStream.writeBit(index >= 0);
+        if (index >= 0)
+        {
+            uint8_t indexCode = (uint8_t)index;
+            bitStream.write(&indexCode, ColorCache::INDEX_BITS);
+            pColorCache->moveToFront(index);
+            return;
+        }
+
+        bitStream.write(colorData, nColorBits);
+        pColorCache->insert(m_color);
+    }
+
+    uint64_t ColorBlock::calcError(const Image& img) const
+    {
+        uint64_t error = 0;
+        for (int y = m_y; y < m_y + m_h; ++y)
+        {
+            for (int x = m_x, n; x < m_x + m_w; x += n)
+            {
+                n = std::min(img.rowRunNC(x), m_x + m_w - x);
+                const Color* row = &img.getNC(x, y);
+                for (int i = 0; i < n; ++i)
+                {
+                    int dr = row[i].r - m_color.r;
+                    int dg = row[i].g - m_color.g;
+                    int db = row[i].b - m_color.b;
+                    error += uint32_t(dr * dr + dg * dg + db * db);
+                }
+            }
+        }
+
+        return error;
+    }
+
+    GradientBlock::GradientBlock(int x, int y, int w, int h, const Gradient& gradient, ColorMode colorMode)
+        : ColorBlock(x, y, w, h, gradient.mean, true), m_gradient(gradient), m_colorMode(colorMode)
+    {}
+
+    void GradientBlock::writeToImg(Image& img) const
+    {
+        if (m_x + m_w > img.width() || m_y + m_h > img.height())
+            throw std::runtime_error("Image dimensions too small.");
+
+        for (int y = 0; y < m_h; ++y)
+        {
+            for (int x = 0, n; x < m_w; x += n)
+            {
+                n = std::min(img.rowRunNC(m_x + x), m_w - x);
+                m_gradient.renderRun(y, x, n, m_w, m_h, m_colorMode, &img.getNC(m_x + x, m_y + y).r, 3);
+            }
+        }
+    }
+
+    void GradientBlock::writeToBuffer(const BufferDesc& bufDesc) const
+    {
+        if (m_x + m_w > bufDesc.width || m_y + m_h > bufDesc.height)
+            throw std::runtime_error("Buffer dimensions too small.");
+
+        writeToBuffer(bufDesc, m_x, m_y, m_w, m_h, m_gradient, m_colorMode);
+    }
+
+    void GradientBlock::serialize(BitStream& bitStream, ColorCache* /*pColorCache*/) const
+    {
+        // Gradient means rarely repeat, so they bypass the color cache.
+        writeLeafFlags(bitStream, true);
+
+        int first = Gradient::firstChannel(m_colorMode);
+        int nChannelBits = Gradient::nChannels(m_colorMode) * 8;
+        bitStream.write(&m_gradient.mean.r + first, nChannelBits);
+        bitStream.write(&m_gradient.dx[first], nChannelBits);
+        bitStream.write(&m_gradient.dy[first], nChannelBits);
     }
 
-    int ColorBlock::nBlocks() const
+    uint64_t GradientBlock::calcError(const Image& img) const
     {
-        return 1;
+        int first = Gradient::firstChannel(m_colorMode);
+        int last = m_colorMode == ColorMode::Gray ? 2 : first + Gradient::nChannels(m_colorMode) - 1;
+
+        std::vector<uint8_t> recRow((size_t)m_w * 3);
+
+        uint64_t error = 0;
+        for (int y = 0; y < m_h; ++y)
+        {
+            m_gradient.renderRow(y, m_w, m_h, m_colorMode, recRow.data(), 3);
+
+            for (int x = 0, n; x < m_w; x += n)
+            {
+                n = std::min(img.rowRunNC(m_x + x), m_w - x);
+                const uint8_t* row = &img.getNC(m_x + x, m_y + y).r;
+                const uint8_t* recRun = recRow.data() + x * 3;
+                for (int i = 0; i < n * 3; i += 3)
+                {
+                    for (int c = first; c <= last; ++c)
+                    {
+                        int d = row[i + c] - recRun[i + c];
+                        error += uint32_t(d * d);
+                    }
+                }
+            }
+        }
+
+        return error;
     }
 
-    int ColorBlock::nColorBlocks() const
+    void GradientBlock::writeToBuffer(const BufferDesc& bufDesc, int x, int y, int w, int h, const Gradient& gradient, ColorMode colorMode)
     {
-        return 1;
+        uint8_t* firstRow = bufDesc.data + (uint64_t)y * bufDesc.stride + (uint64_t)x * bufDesc.nChannels;
+        for (int ry = 0; ry < h; ++ry)
+            gradient.renderRow(ry, w, h, colorMode, firstRow + (uint64_t)ry * bufDesc.stride, bufDesc.nChannels);
     }
 
-    ParentBlock::ParentBlock(const ParentBlockDesc& pbDesc, const BlockTreeDesc& btDesc, const Image& img)
+    ParentBlock::ParentBlock(int x, int y, int w, int h)
+        : Block(x, y, w, h)
+    {}
+
+    ParentBlock::ParentBlock(const ParentBlockDesc& pbDesc, const BlockTreeDesc& btDesc, const StatsPyramid& pyramid)
         : Block(pbDesc.x, pbDesc.y, pbDesc.width, pbDesc.height)
     {
         int newDepth = pbDesc.depth + 1;
         int blockDim = calcDimVal(btDesc.maxDepth, newDepth);
 
+        const Image& img = pyramid.image();
         for (int y = m_y; y < (m_y + pbDesc.height) && y < img.height(); y += blockDim)
             for (int x = m_x; x < (m_x + pbDesc.width) && x < img.width(); x += blockDim)
-                m_subBlocks.push_back(createSubBlock(x, y, newDepth, btDesc, img));
+                m_subBlocks.push_back(newDepth == 0 ? createTile(x, y, btDesc, pyramid) : createSubBlock(x, y, newDepth, btDesc, pyramid));
+
+        updateCounts();
     }
 
     ParentBlock::ParentBlock(const ParentBlockDesc& pbDesc, const BlockTreeDesc& btDesc, int imgWidth, int imgHeight, BitStream& bitStream)
@@ -78,6 +455,24 @@ namespace Blomp
         for (int y = m_y; y < maxY; y += blockDim)
             for (int x = m_x; x < maxX; x += blockDim)
                 m_subBlocks.push_back(createSubBlock(x, y, newDepth, btDesc, imgWidth, imgHeight, bitStream));
+
+        updateCounts();
+    }
+
+    ParentBlock::ParentBlock(const ParentBlockDesc& pbDesc, const BlockTreeDesc& btDesc, const RDOptimizer& rdo)
+        : Block(pbDesc.x, pbDesc.y, pbDesc.width, pbDesc.height)
+    {
+        int newDepth = pbDesc.depth + 1;
+        int blockDim = calcDimVal(btDesc.maxDepth, newDepth);
+
+        int maxX = std::min(m_x + pbDesc.width, rdo.image().width());
+        int maxY = std::min(m_y + pbDesc.height, rdo.image().height());
+
+        for (int y = m_y; y < maxY; y += blockDim)
+            for (int x = m_x; x < maxX; x += blockDim)
+                m_subBlocks.push_back(createSubBlock(x, y, newDepth, btDesc, rdo));
+
+        updateCounts();
     }
 
     void ParentBlock::writeToImg(Image &img) const
@@ -86,45 +481,109 @@ namespace Blomp
             block->writeToImg(img);
     }
 
+    void ParentBlock::writeToBuffer(const BufferDesc& bufDesc) const
+    {
+        for (auto& block : m_subBlocks)
+            block->writeToBuffer(bufDesc);
+    }
+
     void ParentBlock::writeHeatmap(Image &img, int maxDepth, int depth) const
     {
         for (auto& block : m_subBlocks)
             block->writeHeatmap(img, maxDepth, depth + 1);
     }
 
-    void ParentBlock::serialize(BitStream &bitStream) const
+    void ParentBlock::serialize(BitStream &bitStream, ColorCache* pColorCache) const
     {
         bitStream.writeBit(true);
         for (auto& block : m_subBlocks)
-            block->serialize(bitStream);
+            block->serialize(bitStream, pColorCache);
+    }
+
+    uint64_t ParentBlock::calcError(const Image& img) const
+    {
+        uint64_t error = 0;
+        for (auto& block : m_subBlocks)
+            error += block->calcError(img);
+
+        return error;
+    }
+
+    void ParentBlock::updateCounts()
+    {
+        m_nBlocks = 1;
+        m_nColorBlocks = 0;
+        m_nBits = 1;
+
+        for (auto& block : m_subBlocks)
+        {
+            m_nBlocks += block->nBlocks();
+            m_nColorBlocks += block->nColorBlocks();
+            m_nBits += block->nBits();
+        }
     }
 
-    int ParentBlock::nBlocks() const
+    void ParentBlock::decodeToBuffer(const ParentBlockDesc& pbDesc, const BlockTreeDesc& btDesc, const BufferDesc& bufDesc, BitStream& bitStream, BlockCounts& counts)
     {
-        int count = 1;
+        ++counts.nBlocks;
+        ++counts.nBits;
+
+        int newDepth = pbDesc.depth + 1;
+        int blockDim = calcDimVal(btDesc.maxDepth, newDepth);
 
-        for (auto block : m_subBlocks)
-            count += block->nBlocks();
+        int maxX = std::min(pbDesc.x + pbDesc.width, bufDesc.width);
+        int maxY = std::min(pbDesc.y + pbDesc.height, bufDesc.height);
 
-        return count;
+        for (int y = pbDesc.y; y < maxY; y += blockDim)
+            for (int x = pbDesc.x; x < maxX; x += blockDim)
+                decodeSubBlock(x, y, newDepth, btDesc, bufDesc, bitStream, counts);
     }
 
-    int ParentBlock::nColorBlocks() const
+    BlockRef ParentBlock::createTile(int x, int y, const BlockTreeDesc& btDesc, const StatsPyramid& pyramid)
     {
-        int count = 0;
+        TraceScope trace("tile", "build");
+        BlockRef tile = createSubBlock(x, y, 0, btDesc, pyramid);
+        trace.arg("x", x);
+        trace.arg("y", y);
+        trace.arg("threshold", (double)btDesc.variationThreshold);
+        trace.arg("blocks", tile->nBlocks());
+        return tile;
+    }
 
-        for (auto block : m_subBlocks)
-            count += block->nColorBlocks();
+    void ParentBlock::skipTile(int x, int y, const BlockTreeDesc& btDesc, int imgWidth, int imgHeight, BitStream& bitStream, BlockCounts& counts)
+    {
+        skipSubBlock(x, y, 0, btDesc, imgWidth, imgHeight, bitStream, counts);
+    }
 
-        return count;
+    void ParentBlock::reportTile(int x, int y, const BlockTreeDesc& btDesc, int imgWidth, int imgHeight, BitStream& bitStream, const Image* pSourceImg, PlaneReport& report)
+    {
+        reportSubBlock(x, y, 0, btDesc, imgWidth, imgHeight, bitStream, pSourceImg, report);
     }
 
-    BlockRef ParentBlock::createSubBlock(int x, int y, int newDepth, const BlockTreeDesc& btDesc, const Image& img)
+    BlockRef ParentBlock::createSubBlock(int x, int y, int newDepth, const BlockTreeDesc& btDesc, const StatsPyramid& pyramid)
     {
-        BlockMetrics bm = calcBlockMetrics(x, y, btDesc.maxDepth, newDepth, img);
+        if (btDesc.splitMode == SplitMode::Binary)
+        {
+            int logDim = btDesc.maxDepth - newDepth;
+            return SplitBlock::createSubBlock(x, y, logDim, logDim, newDepth, btDesc, pyramid);
+        }
+
+        int logDim = btDesc.maxDepth - newDepth;
+        if (logDim <= MAX_SPECIALIZED_LOG_DIM)
+            return dispatchLogDim(logDim, [&](auto logDimTag) { return createQuadBlock<decltype(logDimTag)::value>(x, y, btDesc, pyramid); });
+
+        BlockMetrics bm = calcBlockMetrics(x, y, newDepth, btDesc, pyramid);
 
-        if (bm.variation <= btDesc.variationThreshold)
-            return BlockRef(new ColorBlock(x, y, bm.width, bm.height, bm.avgColor));
+        if (bm.stats.meetsThreshold(btDesc.variationThreshold))
+            return createColorBlock(x, y, bm.width, bm.height, bm.stats.avgColor(), btDesc);
+
+        // A gradient leaf always takes fewer bits than the four leaves of a quad split.
+        if (btDesc.leafShape == LeafShape::Gradient)
+        {
+            int maxDim = calcDimVal(btDesc.maxDepth, newDepth);
+            if (BlockRef leaf = createGradientBlock(x, y, maxDim, maxDim, bm, btDesc, pyramid))
+                return leaf;
+        }
 
         ParentBlockDesc pbDesc;
         pbDesc.x = x;
@@ -133,22 +592,88 @@ namespace Blomp
         pbDesc.height = bm.height;
         pbDesc.depth = newDepth;
 
-        return BlockRef(new ParentBlock(pbDesc, btDesc, img));
+        return makeBlockRef(new ParentBlock(pbDesc, btDesc, pyramid));
     }
 
     BlockRef ParentBlock::createSubBlock(int x, int y, int newDepth, const BlockTreeDesc& btDesc, int imgWidth, int imgHeight, BitStream& bitStream)
     {
-        bool isParent = bitStream.readBit();
+        if (btDesc.splitMode == SplitMode::Binary)
+        {
+            int logDim = btDesc.maxDepth - newDepth;
+            return SplitBlock::createSubBlock(x, y, logDim, logDim, newDepth, btDesc, imgWidth, imgHeight, bitStream);
+        }
+
+        int logDim = btDesc.maxDepth - newDepth;
+        if (logDim <= MAX_SPECIALIZED_LOG_DIM)
+            return dispatchLogDim(logDim, [&](auto logDimTag) { return readQuadBlockNC<decltype(logDimTag)::value>(x, y, btDesc, imgWidth, imgHeight, bitStream); });
+
+        bool isParent = bitStream.readBitNC();
 
         int maxDim = calcDimVal(btDesc.maxDepth, newDepth);
         int blockWidth = std::min(imgWidth - x, maxDim);
         int blockHeight = std::min(imgHeight - y, maxDim);
 
+        if (!isParent)
+            return readLeafNC(x, y, blockWidth, blockHeight, btDesc, bitStream);
+
+        ParentBlockDesc pbDesc;
+        pbDesc.x = x;
+        pbDesc.y = y;
+        pbDesc.width = blockWidth;
+        pbDesc.height = blockHeight;
+        pbDesc.depth = newDepth;
+
+        return makeBlockRef(new ParentBlock(pbDesc, btDesc, imgWidth, imgHeight, bitStream));
+    }
+
+    BlockRef ParentBlock::createSubBlock(int x, int y, int newDepth, const BlockTreeDesc& btDesc, const RDOptimizer& rdo)
+    {
+        int maxDim = calcDimVal(btDesc.maxDepth, newDepth);
+        int blockWidth = std::min(rdo.image().width() - x, maxDim);
+        int blockHeight = std::min(rdo.image().height() - y, maxDim);
+
+        if (!rdo.isSplit(x, y, newDepth))
+            return createColorBlock(x, y, blockWidth, blockHeight, rdo.avgColor(x, y, newDepth), btDesc);
+
+        ParentBlockDesc pbDesc;
+        pbDesc.x = x;
+        pbDesc.y = y;
+        pbDesc.width = blockWidth;
+        pbDesc.height = blockHeight;
+        pbDesc.depth = newDepth;
+
+        return makeBlockRef(new ParentBlock(pbDesc, btDesc, rdo));
+    }
+
+    void ParentBlock::decodeSubBlock(int x, int y, int newDepth, const BlockTreeDesc& btDesc, const BufferDesc& bufDesc, BitStream& bitStream, BlockCounts& counts)
+    {
+        if (btDesc.splitMode == SplitMode::Binary)
+        {
+            int logDim = btDesc.maxDepth - newDepth;
+            SplitBlock::decodeSubBlock(x, y, logDim, logDim, newDepth, btDesc, bufDesc, bitStream, counts);
+            return;
+        }
+
+        int logDim = btDesc.maxDepth - newDepth;
+        if (logDim <= MAX_SPECIALIZED_LOG_DIM)
+        {
+            dispatchLogDim(logDim, [&](auto logDimTag) { decodeQuadBlockNC<decltype(logDimTag)::value>(x, y, btDesc, bufDesc, bitStream, counts); });
+            return;
+        }
+
+        bool isParent = bitStream.readBitNC();
+
+        int maxDim = calcDimVal(btDesc.maxDepth, newDepth);
+        int blockWidth = std::min(bufDesc.width - x, maxDim);
+        int blockHeight = std::min(bufDesc.height - y, maxDim);
+
         if (!isParent)
         {
-            uint8_t pixelData[3];
-            bitStream.read(pixelData, 3 * 8);
-            return BlockRef(new ColorBlock(x, y, blockWidth, blockHeight, Pixel::fromCharArray(pixelData)));
+            int nLeafBits = decodeLeafNC(x, y, blockWidth, blockHeight, btDesc, bufDesc, bitStream);
+            ++counts.nBlocks;
+            ++counts.nColorBlocks;
+            counts.nBits += 1 + nLeafBits;
+            return;
         }
 
         ParentBlockDesc pbDesc;
@@ -158,39 +683,930 @@ namespace Blomp
         pbDesc.height = blockHeight;
         pbDesc.depth = newDepth;
 
-        return BlockRef(new ParentBlock(pbDesc, btDesc, imgWidth, imgHeight, bitStream));
+        decodeToBuffer(pbDesc, btDesc, bufDesc, bitStream, counts);
     }
 
-    BlockMetrics ParentBlock::calcBlockMetrics(int x, int y, int maxDepth, int newDepth, const Image& img)
+    void ParentBlock::skipSubBlock(int x, int y, int newDepth, const BlockTreeDesc& btDesc, int imgWidth, int imgHeight, BitStream& bitStream, BlockCounts& counts)
     {
-        BlockMetrics bm;
+        if (btDesc.splitMode == SplitMode::Binary)
+        {
+            int logDim = btDesc.maxDepth - newDepth;
+            SplitBlock::skipSubBlock(x, y, logDim, logDim, btDesc, imgWidth, imgHeight, bitStream, counts);
+            return;
+        }
+
+        int logDim = btDesc.maxDepth - newDepth;
+        if (logDim <= MAX_SPECIALIZED_LOG_DIM)
+        {
+            dispatchLogDim(logDim, [&](auto logDimTag) { skipQuadBlock<decltype(logDimTag)::value>(x, y, btDesc, imgWidth, imgHeight, bitStream, counts); });
+            return;
+        }
+
+        if (!bitStream.readBit())
+        {
+            bool isGradient = false;
+            int nLeafBits = skipLeaf(btDesc, bitStream, isGradient);
+            ++counts.nBlocks;
+            ++counts.nColorBlocks;
+            counts.nBits += 1 + nLeafBits;
+            return;
+        }
 
-        int maxDim = calcDimVal(maxDepth, newDepth);
+        ++counts.nBlocks;
+        ++counts.nBits;
 
-        bm.width = std::min(img.width() - x, maxDim);
-        bm.height = std::min(img.height() - y, maxDim);
-        int nPixels = bm.width * bm.height;
+        int blockDim = calcDimVal(btDesc.maxDepth, newDepth + 1);
+        int maxX = std::min(x + blockDim * 2, imgWidth);
+        int maxY = std::min(y + blockDim * 2, imgHeight);
 
-        // v = (a - p1)^2 + (a - p2)^2 + ...
-        // v = 2a^2 - 2a(p1 + p2 + ...) + p1^2 + p2^2 + ...
+        for (int ry = y; ry < maxY; ry += blockDim)
+            for (int rx = x; rx < maxX; rx += blockDim)
+                skipSubBlock(rx, ry, newDepth + 1, btDesc, imgWidth, imgHeight, bitStream, counts);
+    }
 
-        Pixel pxSum, px2Sum;
-        for (int ry = y; ry < y + bm.height; ++ry)
+    void ParentBlock::reportSubBlock(int x, int y, int newDepth, const BlockTreeDesc& btDesc, int imgWidth, int imgHeight, BitStream& bitStream, const Image* pSourceImg, PlaneReport& report)
+    {
+        if (btDesc.splitMode == SplitMode::Binary)
         {
-            for (int rx = x; rx < x + bm.width; ++rx)
-            {
-                const Pixel& px = img.getNC(rx, ry);
-                pxSum += px;
-                px2Sum += px * px;
-            }
+            int logDim = btDesc.maxDepth - newDepth;
+            SplitBlock::reportSubBlock(x, y, logDim, logDim, newDepth, btDesc, imgWidth, imgHeight, bitStream, pSourceImg, report);
+            return;
         }
 
-        bm.avgColor = pxSum /  Pixel(nPixels);
-
-        Pixel result = px2Sum - bm.avgColor * pxSum;
-        bm.variation = result.r + result.g + result.b;
-        bm.variation /= nPixels;
+        int maxDim = calcDimVal(btDesc.maxDepth, newDepth);
+
+        if (!bitStream.readBit())
+        {
+            bool isGradient = false;
+            int nLeafBits = skipLeaf(btDesc, bitStream, isGradient);
+            int blockWidth = std::min(imgWidth - x, maxDim);
+            int blockHeight = std::min(imgHeight - y, maxDim);
+            report.addLeaf(newDepth, x, y, blockWidth, blockHeight, nLeafBits, isGradient, btDesc.colorMode, pSourceImg);
+            return;
+        }
+
+        report.addParent(newDepth, 1);
+
+        int blockDim = calcDimVal(btDesc.maxDepth, newDepth + 1);
+        int maxX = std::min(x + blockDim * 2, imgWidth);
+        int maxY = std::min(y + blockDim * 2, imgHeight);
+
+        for (int ry = y; ry < maxY; ry += blockDim)
+            for (int rx = x; rx < maxX; rx += blockDim)
+                reportSubBlock(rx, ry, newDepth + 1, btDesc, imgWidth, imgHeight, bitStream, pSourceImg, report);
+    }
+
+    template <int LOG_DIM>
+    BlockRef ParentBlock::createQuadBlock(int x, int y, const BlockTreeDesc& btDesc, const StatsPyramid& pyramid)
+    {
+        constexpr int DIM = 1 << LOG_DIM;
+
+        BlockMetrics bm = calcRectMetrics(x, y, DIM, DIM, pyramid);
+
+        if (bm.stats.meetsThreshold(btDesc.variationThreshold) || LOG_DIM == 0)
+            return createColorBlock(x, y, bm.width, bm.height, bm.stats.avgColor(), btDesc);
+
+        // A gradient leaf always takes fewer bits than the four leaves of a quad split.
+        if (btDesc.leafShape == LeafShape::Gradient)
+        {
+            if (BlockRef leaf = createGradientBlock(x, y, DIM, DIM, bm, btDesc, pyramid))
+                return leaf;
+        }
+
+        ParentBlock* pParent = new ParentBlock(x, y, bm.width, bm.height);
+        BlockRef parent(pParent);
+
+        if constexpr (LOG_DIM > 0)
+            forEachQuadrant<DIM / 2>(x, y, bm.width, bm.height, [&](int qx, int qy) { pParent->m_subBlocks.push_back(createQuadBlock<LOG_DIM - 1>(qx, qy, btDesc, pyramid)); });
+
+        pParent->updateCounts();
+        return parent;
+    }
+
+    // Validated bitstreams don't split blocks of a single pixel.
+    template <int LOG_DIM>
+    BlockRef ParentBlock::readQuadBlockNC(int x, int y, const BlockTreeDesc& btDesc, int imgWidth, int imgHeight, BitStream& bitStream)
+    {
+        constexpr int DIM = 1 << LOG_DIM;
+
+        bool isParent = bitStream.readBitNC();
+
+        int blockWidth = std::min(imgWidth - x, DIM);
+        int blockHeight = std::min(imgHeight - y, DIM);
+
+        if (!isParent)
+            return readLeafNC(x, y, blockWidth, blockHeight, btDesc, bitStream);
+
+        ParentBlock* pParent = new ParentBlock(x, y, blockWidth, blockHeight);
+        BlockRef parent(pParent);
+        pParent->m_subBlocks.reserve(4);
+
+        if constexpr (LOG_DIM > 0)
+            forEachQuadrant<DIM / 2>(x, y, blockWidth, blockHeight, [&](int qx, int qy) { pParent->m_subBlocks.push_back(readQuadBlockNC<LOG_DIM - 1>(qx, qy, btDesc, imgWidth, imgHeight, bitStream)); });
+
+        pParent->updateCounts();
+        return parent;
+    }
+
+    template <int LOG_DIM>
+    void ParentBlock::decodeQuadBlockNC(int x, int y, const BlockTreeDesc& btDesc, const BufferDesc& bufDesc, BitStream& bitStream, BlockCounts& counts)
+    {
+        constexpr int DIM = 1 << LOG_DIM;
+
+        bool isParent = bitStream.readBitNC();
+
+        int blockWidth = std::min(bufDesc.width - x, DIM);
+        int blockHeight = std::min(bufDesc.height - y, DIM);
+
+        if (!isParent)
+        {
+            int nLeafBits = decodeLeafNC(x, y, blockWidth, blockHeight, btDesc, bufDesc, bitStream);
+            ++counts.nBlocks;
+            ++counts.nColorBlocks;
+            counts.nBits += 1 + nLeafBits;
+            return;
+        }
+
+        ++counts.nBlocks;
+        ++counts.nBits;
+
+        if constexpr (LOG_DIM > 0)
+            forEachQuadrant<DIM / 2>(x, y, blockWidth, blockHeight, [&](int qx, int qy) { decodeQuadBlockNC<LOG_DIM - 1>(qx, qy, btDesc, bufDesc, bitStream, counts); });
+    }
+
+    template <int LOG_DIM>
+    void ParentBlock::skipQuadBlock(int x, int y, const BlockTreeDesc& btDesc, int imgWidth, int imgHeight, BitStream& bitStream, BlockCounts& counts)
+    {
+        constexpr int DIM = 1 << LOG_DIM;
+
+        if (!bitStream.readBit())
+        {
+            bool isGradient = false;
+            int nLeafBits = skipLeaf(btDesc, bitStream, isGradient);
+            ++counts.nBlocks;
+            ++counts.nColorBlocks;
+            counts.nBits += 1 + nLeafBits;
+            return;
+        }
+
+        if constexpr (LOG_DIM == 0)
+            throw std::runtime_error("Unable to split a block of a single pixel.");
+        else
+        {
+            ++counts.nBlocks;
+            ++counts.nBits;
+
+            int blockWidth = std::min(imgWidth - x, DIM);
+            int blockHeight = std::min(imgHeight - y, DIM);
+            forEachQuadrant<DIM / 2>(x, y, blockWidth, blockHeight, [&](int qx, int qy) { skipQuadBlock<LOG_DIM - 1>(qx, qy, btDesc, imgWidth, imgHeight, bitStream, counts); });
+        }
+    }
+
+    BlockRef ParentBlock::createColorBlock(int x, int y, int w, int h, Color color, const BlockTreeDesc& btDesc)
+    {
+        bool hasShapeBit = btDesc.leafShape == LeafShape::Gradient;
+
+        if (btDesc.colorMode == ColorMode::Gray)
+            return makeBlockRef(new GrayBlock(x, y, w, h, color.r, hasShapeBit));
+        if (btDesc.colorMode == ColorMode::CbCr)
+            return makeBlockRef(new ChromaBlock(x, y, w, h, color.g, color.b, hasShapeBit));
+
+        return makeBlockRef(new ColorBlock(x, y, w, h, color, hasShapeBit));
+    }
+
+    BlockRef ParentBlock::createGradientBlock(int x, int y, int maxWidth, int maxHeight, const BlockMetrics& bm, const BlockTreeDesc& btDesc, const StatsPyramid& pyramid)
+    {
+        ColorMoments cm = pyramid.calcRectMoments(x, y, maxWidth, maxHeight);
+        Gradient gradient = Gradient::fit(bm.stats, cm, x, y, bm.width, bm.height);
+
+        double error = gradient.squaredError(bm.stats, cm, x, y, bm.width, bm.height);
+        if (error > ColorStats::scaledThreshold(btDesc.variationThreshold) * bm.stats.nPixels)
+            return nullptr;
+
+        return makeBlockRef(new GradientBlock(x, y, bm.width, bm.height, gradient, btDesc.colorMode));
+    }
+
+    BlockRef ParentBlock::readLeafNC(int x, int y, int w, int h, const BlockTreeDesc& btDesc, BitStream& bitStream)
+    {
+        if (btDesc.leafShape == LeafShape::Gradient && bitStream.readBitNC())
+            return makeBlockRef(new GradientBlock(x, y, w, h, readGradientNC(btDesc, bitStream), btDesc.colorMode));
+
+        uint8_t pixelData[3];
+        readColorNC(btDesc, bitStream, pixelData);
+        return createColorBlock(x, y, w, h, Color(pixelData[0], pixelData[1], pixelData[2]), btDesc);
+    }
+
+    int ParentBlock::decodeLeafNC(int x, int y, int w, int h, const BlockTreeDesc& btDesc, const BufferDesc& bufDesc, BitStream& bitStream)
+    {
+        int nShapeBits = 0;
+        if (btDesc.leafShape == LeafShape::Gradient)
+        {
+            nShapeBits = 1;
+            if (bitStream.readBitNC())
+            {
+                GradientBlock::writeToBuffer(bufDesc, x, y, w, h, readGradientNC(btDesc, bitStream), btDesc.colorMode);
+                return 1 + Gradient::nBits(btDesc.colorMode);
+            }
+        }
+
+        uint8_t pixelData[4] = { 0, 0, 0, 255 };
+        int nColorBits = readColorNC(btDesc, bitStream, pixelData);
+        writeColorToBuffer(btDesc, bufDesc, x, y, w, h, pixelData);
+        return nShapeBits + nColorBits;
+    }
+
+    int ParentBlock::skipLeaf(const BlockTreeDesc& btDesc, BitStream& bitStream, bool& isGradient)
+    {
+        isGradient = false;
+        if (btDesc.leafShape == LeafShape::Flat)
+            return skipColor(btDesc, bitStream);
+
+        isGradient = bitStream.readBit();
+        if (!isGradient)
+            return 1 + skipColor(btDesc, bitStream);
+
+        bitStream.skip(Gradient::nBits(btDesc.colorMode));
+        return 1 + Gradient::nBits(btDesc.colorMode);
+    }
+
+    int ParentBlock::readColorNC(const BlockTreeDesc& btDesc, BitStream& bitStream, uint8_t* pixelData)
+    {
+        ColorCache* pColorCache = btDesc.pColorCache;
+        if (!pColorCache)
+        {
+            readLiteralNC(btDesc, bitStream, pixelData);
+            return colorBits(btDesc);
+        }
+
+        if (bitStream.readBitNC())
+        {
+            uint8_t index = 0;
+            bitStream.readNC(&index, ColorCache::INDEX_BITS);
+            Color color = pColorCache->getNC(index);
+            pColorCache->moveToFront(index);
+            pixelData[0] = color.r;
+            pixelData[1] = color.g;
+            pixelData[2] = color.b;
+            return 1 + ColorCache::INDEX_BITS;
+        }
+
+        readLiteralNC(btDesc, bitStream, pixelData);
+        pColorCache->insert(Color(pixelData[0], pixelData[1], pixelData[2]));
+        return 1 + colorBits(btDesc);
+    }
+
+    int ParentBlock::skipColor(const BlockTreeDesc& btDesc, BitStream& bitStream)
+    {
+        ColorCache* pColorCache = btDesc.pColorCache;
+        if (!pColorCache)
+        {
+            bitStream.skip(colorBits(btDesc));
+            return colorBits(btDesc);
+        }
+
+        if (bitStream.readBit())
+        {
+            uint8_t index = 0;
+            bitStream.read(&index, ColorCache::INDEX_BITS);
+            if (index >= pColorCache->size())
+                throw std::runtime_error("Unable to read damaged blomp file.");
+            pColorCache->moveToFront(index);
+            return 1 + ColorCache::INDEX_BITS;
+        }
+
+        // Literal colors must be read to keep the cache in sync with the decoder.
+        if (bitStream.size() - bitStream.readOffset() < (uint64_t)colorBits(btDesc))
+            throw std::runtime_error("Unable to read damaged blomp file.");
+
+        uint8_t pixelData[3];
+        readLiteralNC(btDesc, bitStream, pixelData);
+        pColorCache->insert(Color(pixelData[0], pixelData[1], pixelData[2]));
+        return 1 + colorBits(btDesc);
+    }
+
+    Gradient ParentBlock::readGradientNC(const BlockTreeDesc& btDesc, BitStream& bitStream)
+    {
+        Gradient gradient;
+
+        uint8_t pixelData[3];
+        readLiteralNC(btDesc, bitStream, pixelData);
+        gradient.mean = Color(pixelData[0], pixelData[1], pixelData[2]);
+
+        int first = Gradient::firstChannel(btDesc.colorMode);
+        int nChannelBits = Gradient::nChannels(btDesc.colorMode) * 8;
+        bitStream.readNC(&gradient.dx[first], nChannelBits);
+        bitStream.readNC(&gradient.dy[first], nChannelBits);
+
+        return gradient;
+    }
+
+    void ParentBlock::readLiteralNC(const BlockTreeDesc& btDesc, BitStream& bitStream, uint8_t* pixelData)
+    {
+        if (btDesc.colorMode == ColorMode::Gray)
+        {
+            bitStream.readNC(pixelData, 8);
+            pixelData[1] = pixelData[0];
+            pixelData[2] = pixelData[0];
+            return;
+        }
+        if (btDesc.colorMode == ColorMode::CbCr)
+        {
+            pixelData[0] = 0;
+            bitStream.readNC(pixelData + 1, 2 * 8);
+            return;
+        }
+
+        bitStream.readNC(pixelData, 3 * 8);
+    }
+
+    void ParentBlock::writeColorToBuffer(const BlockTreeDesc& btDesc, const BufferDesc& bufDesc, int x, int y, int w, int h, const uint8_t* pixelData)
+    {
+        if (btDesc.colorMode == ColorMode::CbCr)
+            fillBufferChroma(bufDesc, x, y, w, h, pixelData);
+        else
+            fillBufferRect(bufDesc, x, y, w, h, pixelData);
+    }
+
+    int ParentBlock::colorBits(const BlockTreeDesc& btDesc)
+    {
+        switch (btDesc.colorMode)
+        {
+        case ColorMode::Gray: return 8;
+        case ColorMode::CbCr: return 2 * 8;
+        default: return 3 * 8;
+        }
+    }
+
+    BlockMetrics ParentBlock::calcBlockMetrics(int x, int y, int newDepth, const BlockTreeDesc& btDesc, const StatsPyramid& pyramid)
+    {
+        int maxDim = calcDimVal(btDesc.maxDepth, newDepth);
+
+        return calcRectMetrics(x, y, maxDim, maxDim, pyramid);
+    }
+
+    BlockMetrics ParentBlock::calcRectMetrics(int x, int y, int maxWidth, int maxHeight, const StatsPyramid& pyramid)
+    {
+        BlockMetrics bm;
+
+        bm.width = std::min(pyramid.image().width() - x, maxWidth);
+        bm.height = std::min(pyramid.image().height() - y, maxHeight);
+        bm.stats = pyramid.calcRectStats(x, y, maxWidth, maxHeight);
 
         return bm;
     }
+
+    SplitBlock::SplitBlock(const ParentBlockDesc& pbDesc, int logWidth, int logHeight, const BlockTreeDesc& btDesc, const StatsPyramid& pyramid)
+        : ParentBlock(pbDesc.x, pbDesc.y, pbDesc.width, pbDesc.height)
+    {
+        m_splitType = chooseSplitType(m_x, m_y, logWidth, logHeight, btDesc, pyramid);
+
+        int newDepth = pbDesc.depth + 1;
+        calcChildLogDims(m_splitType, logWidth, logHeight);
+
+        for (int y = m_y; y < m_y + m_h; y += 1 << logHeight)
+            for (int x = m_x; x < m_x + m_w; x += 1 << logWidth)
+                m_subBlocks.push_back(createSubBlock(x, y, logWidth, logHeight, newDepth, btDesc, pyramid));
+
+        updateCounts();
+        m_nBits += 2;
+    }
+
+    SplitBlock::SplitBlock(const ParentBlockDesc& pbDesc, int logWidth, int logHeight, SplitType splitType, const BlockTreeDesc& btDesc, int imgWidth, int imgHeight, BitStream& bitStream)
+        : ParentBlock(pbDesc.x, pbDesc.y, pbDesc.width, pbDesc.height), m_splitType(splitType)
+    {
+        int newDepth = pbDesc.depth + 1;
+        calcChildLogDims(m_splitType, logWidth, logHeight);
+
+        m_subBlocks.reserve(m_splitType == SplitType::Quad ? 4 : 2);
+
+        for (int y = m_y; y < m_y + m_h; y += 1 << logHeight)
+            for (int x = m_x; x < m_x + m_w; x += 1 << logWidth)
+                m_subBlocks.push_back(createSubBlock(x, y, logWidth, logHeight, newDepth, btDesc, imgWidth, imgHeight, bitStream));
+
+        updateCounts();
+        m_nBits += 2;
+    }
+
+    void SplitBlock::serialize(BitStream& bitStream, ColorCache* pColorCache) const
+    {
+        bitStream.writeBit(true);
+        uint8_t splitCode = (uint8_t)m_splitType;
+        bitStream.write(&splitCode, 2);
+        for (auto& block : m_subBlocks)
+            block->serialize(bitStream, pColorCache);
+    }
+
+    BlockRef SplitBlock::createSubBlock(int x, int y, int logWidth, int logHeight, int newDepth, const BlockTreeDesc& btDesc, const StatsPyramid& pyramid)
+    {
+        BlockMetrics bm = calcRectMetrics(x, y, 1 << logWidth, 1 << logHeight, pyramid);
+
+        if (bm.stats.meetsThreshold(btDesc.variationThreshold) || (logWidth == 0 && logHeight == 0))
+            return createColorBlock(x, y, bm.width, bm.height, bm.stats.avgColor(), btDesc);
+
+        // Two flat leaves take fewer bits than a gradient leaf.
+        if (btDesc.leafShape == LeafShape::Gradient && !splitsIntoLeaves(x, y, logWidth, logHeight, btDesc, pyramid))
+        {
+            if (BlockRef leaf = createGradientBlock(x, y, 1 << logWidth, 1 << logHeight, bm, btDesc, pyramid))
+                return leaf;
+        }
+
+        ParentBlockDesc pbDesc;
+        pbDesc.x = x;
+        pbDesc.y = y;
+        pbDesc.width = bm.width;
+        pbDesc.height = bm.height;
+        pbDesc.depth = newDepth;
+
+        return makeBlockRef(new SplitBlock(pbDesc, logWidth, logHeight, btDesc, pyramid));
+    }
+
+    BlockRef SplitBlock::createSubBlock(int x, int y, int logWidth, int logHeight, int newDepth, const BlockTreeDesc& btDesc, int imgWidth, int imgHeight, BitStream& bitStream)
+    {
+        bool isParent = bitStream.readBitNC();
+
+        int blockWidth = std::min(imgWidth - x, 1 << logWidth);
+        int blockHeight = std::min(imgHeight - y, 1 << logHeight);
+
+        if (!isParent)
+            return readLeafNC(x, y, blockWidth, blockHeight, btDesc, bitStream);
+
+        SplitType splitType = readSplitTypeNC(bitStream);
+
+        ParentBlockDesc pbDesc;
+        pbDesc.x = x;
+        pbDesc.y = y;
+        pbDesc.width = blockWidth;
+        pbDesc.height = blockHeight;
+        pbDesc.depth = newDepth;
+
+        return makeBlockRef(new SplitBlock(pbDesc, logWidth, logHeight, splitType, btDesc, imgWidth, imgHeight, bitStream));
+    }
+
+    void SplitBlock::decodeSubBlock(int x, int y, int logWidth, int logHeight, int newDepth, const BlockTreeDesc& btDesc, const BufferDesc& bufDesc, BitStream& bitStream, BlockCounts& counts)
+    {
+        bool isParent = bitStream.readBitNC();
+
+        int blockWidth = std::min(bufDesc.width - x, 1 << logWidth);
+        int blockHeight = std::min(bufDesc.height - y, 1 << logHeight);
+
+        if (!isParent)
+        {
+            int nLeafBits = decodeLeafNC(x, y, blockWidth, blockHeight, btDesc, bufDesc, bitStream);
+            ++counts.nBlocks;
+            ++counts.nColorBlocks;
+            counts.nBits += 1 + nLeafBits;
+            return;
+        }
+
+        SplitType splitType = readSplitTypeNC(bitStream);
+        ++counts.nBlocks;
+        counts.nBits += 1 + 2;
+
+        int childLogWidth = logWidth;
+        int childLogHeight = logHeight;
+        calcChildLogDims(splitType, childLogWidth, childLogHeight);
+
+        for (int ry = y; ry < y + blockHeight; ry += 1 << childLogHeight)
+            for (int rx = x; rx < x + blockWidth; rx += 1 << childLogWidth)
+                decodeSubBlock(rx, ry, childLogWidth, childLogHeight, newDepth + 1, btDesc, bufDesc, bitStream, counts);
+    }
+
+    void SplitBlock::skipSubBlock(int x, int y, int logWidth, int logHeight, const BlockTreeDesc& btDesc, int imgWidth, int imgHeight, BitStream& bitStream, BlockCounts& counts)
+    {
+        if (!bitStream.readBit())
+        {
+            bool isGradient = false;
+            int nLeafBits = skipLeaf(btDesc, bitStream, isGradient);
+            ++counts.nBlocks;
+            ++counts.nColorBlocks;
+            counts.nBits += 1 + nLeafBits;
+            return;
+        }
+
+        SplitType splitType = readSplitType(logWidth, logHeight, bitStream);
+        ++counts.nBlocks;
+        counts.nBits += 1 + 2;
+
+        int maxX = std::min(x + (1 << logWidth), imgWidth);
+        int maxY = std::min(y + (1 << logHeight), imgHeight);
+        calcChildLogDims(splitType, logWidth, logHeight);
+
+        for (int ry = y; ry < maxY; ry += 1 << logHeight)
+            for (int rx = x; rx < maxX; rx += 1 << logWidth)
+                skipSubBlock(rx, ry, logWidth, logHeight, btDesc, imgWidth, imgHeight, bitStream, counts);
+    }
+
+    void SplitBlock::reportSubBlock(int x, int y, int logWidth, int logHeight, int depth, const BlockTreeDesc& btDesc, int imgWidth, int imgHeight, BitStream& bitStream, const Image* pSourceImg, PlaneReport& report)
+    {
+        int maxX = std::min(x + (1 << logWidth), imgWidth);
+        int maxY = std::min(y + (1 << logHeight), imgHeight);
+
+        if (!bitStream.readBit())
+        {
+            bool isGradient = false;
+            int nLeafBits = skipLeaf(btDesc, bitStream, isGradient);
+            report.addLeaf(depth, x, y, maxX - x, maxY - y, nLeafBits, isGradient, btDesc.colorMode, pSourceImg);
+            return;
+        }
+
+        SplitType splitType = readSplitType(logWidth, logHeight, bitStream);
+        report.addParent(depth, 1 + 2);
+
+        calcChildLogDims(splitType, logWidth, logHeight);
+
+        for (int ry = y; ry < maxY; ry += 1 << logHeight)
+            for (int rx = x; rx < maxX; rx += 1 << logWidth)
+                reportSubBlock(rx, ry, logWidth, logHeight, depth + 1, btDesc, imgWidth, imgHeight, bitStream, pSourceImg, report);
+    }
+
+    SplitType SplitBlock::chooseSplitType(int x, int y, int logWidth, int logHeight, const BlockTreeDesc& btDesc, const StatsPyramid& pyramid)
+    {
+        if (logWidth == 0)
+            return SplitType::Horizontal;
+        if (logHeight == 0)
+            return SplitType::Vertical;
+
+        // A binary parent takes 3 bits and its halves often need to be split
+        // again, so each split type is rated by the bits of the subtree it
+        // leads to within the lookahead.
+        int logCols = std::min(logWidth, SPLIT_LOOKAHEAD);
+        int logRows = std::min(logHeight, SPLIT_LOOKAHEAD);
+        int cellWidth = 1 << (logWidth - logCols);
+        int cellHeight = 1 << (logHeight - logRows);
+
+        SplitGrid grid;
+        for (int r = 0; r < 1 << logRows; ++r)
+            for (int c = 0; c < 1 << logCols; ++c)
+                grid.cells[r][c] = pyramid.calcRectStats(x + c * cellWidth, y + r * cellHeight, cellWidth, cellHeight);
+
+        int leafBits = 1 + (btDesc.leafShape == LeafShape::Gradient ? 1 : 0) + colorBits(btDesc);
+        auto estimateBits = [&](SplitType splitType) {
+            return estimateChildBits(grid, splitType, 0, 0, logCols, logRows, logWidth, logHeight, SPLIT_LOOKAHEAD - 1, leafBits, btDesc.variationThreshold);
+        };
+
+        int bitsQ = estimateBits(SplitType::Quad);
+        int bitsH = estimateBits(SplitType::Horizontal);
+        int bitsV = estimateBits(SplitType::Vertical);
+
+        // Quad splits win ties, they leave fewer parents to the next level.
+        if (bitsQ <= std::min(bitsH, bitsV))
+            return SplitType::Quad;
+        if (bitsH != bitsV)
+            return bitsH < bitsV ? SplitType::Horizontal : SplitType::Vertical;
+
+        ColorStats top = grid.sum(0, 0, logCols, logRows - 1);
+        ColorStats bottom = grid.sum(0, 1 << (logRows - 1), logCols, logRows - 1);
+        ColorStats left = grid.sum(0, 0, logCols - 1, logRows);
+        ColorStats right = grid.sum(1 << (logCols - 1), 0, logCols - 1, logRows);
+
+        double errH = top.squaredError() + bottom.squaredError();
+        double errV = left.squaredError() + right.squaredError();
+
+        return errH <= errV ? SplitType::Horizontal : SplitType::Vertical;
+    }
+
+    bool SplitBlock::splitsIntoLeaves(int x, int y, int logWidth, int logHeight, const BlockTreeDesc& btDesc, const StatsPyramid& pyramid)
+    {
+        auto isLeaf = [&](int rx, int ry, int logW, int logH) {
+            return pyramid.calcRectStats(rx, ry, 1 << logW, 1 << logH).meetsThreshold(btDesc.variationThreshold);
+        };
+
+        if (logHeight > 0 && isLeaf(x, y, logWidth, logHeight - 1) && isLeaf(x, y + (1 << (logHeight - 1)), logWidth, logHeight - 1))
+            return true;
+        if (logWidth > 0 && isLeaf(x, y, logWidth - 1, logHeight) && isLeaf(x + (1 << (logWidth - 1)), y, logWidth - 1, logHeight))
+            return true;
+
+        return false;
+    }
+
+    SplitType SplitBlock::readSplitType(int logWidth, int logHeight, BitStream& bitStream)
+    {
+        uint8_t splitCode = 0;
+        bitStream.read(&splitCode, 2);
+
+        SplitType splitType = (SplitType)splitCode;
+        bool isValid =
+            (splitType == SplitType::Quad && logWidth > 0 && logHeight > 0) ||
+            (splitType == SplitType::Horizontal && logHeight > 0) ||
+            (splitType == SplitType::Vertical && logWidth > 0);
+
+        if (!isValid)
+            throw std::runtime_error("Unable to read damaged blomp file.");
+
+        return splitType;
+    }
+
+    SplitType SplitBlock::readSplitTypeNC(BitStream& bitStream)
+    {
+        uint8_t splitCode = 0;
+        bitStream.readNC(&splitCode, 2);
+
+        return (SplitType)splitCode;
+    }
+
+    void SplitBlock::calcChildLogDims(SplitType splitType, int& logWidth, int& logHeight)
+    {
+        if (splitType != SplitType::Horizontal)
+            --logWidth;
+        if (splitType != SplitType::Vertical)
+            --logHeight;
+    }
+
+    FrameBlock::FrameBlock(const BlockTreeDesc& btDesc, const Image& img, const ParentBlock* pPrevFrame)
+        : ParentBlock(0, 0, img.width(), img.height())
+    {
+        int blockDim = calcDimVal(btDesc.maxDepth, 0);
+
+        if (pPrevFrame && (pPrevFrame->getWidth() != m_w || pPrevFrame->getHeight() != m_h))
+            throw std::runtime_error("Frame dimensions differ from the previous frame.");
+
+        // Tiles are built once at most, so their pixels are scanned directly.
+        StatsPyramid pyramid(img, btDesc.colorMode, btDesc.maxDepth, btDesc.maxDepth + 1);
+
+        for (int y = 0; y < m_h; y += blockDim)
+        {
+            for (int x = 0; x < m_w; x += blockDim)
+            {
+                int tileID = (int)m_subBlocks.size();
+                BlockRef tile;
+
+                if (pPrevFrame)
+                {
+                    auto& prevTile = pPrevFrame->subBlocks()[tileID];
+                    uint64_t nPixels = (uint64_t)prevTile->getWidth() * prevTile->getHeight();
+
+                    // The error of the previous tile includes the rounding of its
+                    // colors, which the build doesn't see. So a tile that is rebuilt
+                    // with the same bits is shared as well, even above the threshold.
+                    bool isCopied = prevTile->calcError(img) <= ColorStats::scaledThreshold(btDesc.variationThreshold) * nPixels;
+                    if (!isCopied)
+                    {
+                        tile = createTile(x, y, btDesc, pyramid);
+                        isCopied = hasSameBits(*prevTile, *tile);
+                    }
+
+                    if (isCopied)
+                    {
+                        m_subBlocks.push_back(prevTile);
+                        m_copied.push_back(true);
+                        ++m_nCopiedTiles;
+                        continue;
+                    }
+                }
+
+                m_subBlocks.push_back(tile ? tile : createTile(x, y, btDesc, pyramid));
+                m_copied.push_back(false);
+            }
+        }
+
+        updateCounts();
+
+        m_nBits = 1;
+        for (int i = 0; i < (int)m_subBlocks.size(); ++i)
+            m_nBits += m_copied[i] ? 1 : 1 + m_subBlocks[i]->nBits();
+    }
+
+    void FrameBlock::serialize(BitStream& bitStream, ColorCache* pColorCache) const
+    {
+        bitStream.writeBit(true);
+        for (int i = 0; i < (int)m_subBlocks.size(); ++i)
+        {
+            bitStream.writeBit(m_copied[i]);
+            if (!m_copied[i])
+                m_subBlocks[i]->serialize(bitStream, pColorCache);
+        }
+    }
+
+    void FrameBlock::decodeToBuffer(const BlockTreeDesc& btDesc, const BufferDesc& bufDesc, BitStream& bitStream, BlockCounts& counts)
+    {
+        ++counts.nBlocks;
+        ++counts.nBits;
+
+        int blockDim = calcDimVal(btDesc.maxDepth, 0);
+
+        for (int y = 0; y < bufDesc.height; y += blockDim)
+        {
+            for (int x = 0; x < bufDesc.width; x += blockDim)
+            {
+                ++counts.nBits;
+
+                // Copied tiles are already in the buffer.
+                if (bitStream.readBitNC())
+                    continue;
+
+                decodeSubBlock(x, y, 0, btDesc, bufDesc, bitStream, counts);
+            }
+        }
+    }
+
+    YCbCrBlock::YCbCrBlock(const BlockTreeDesc& lumaDesc, const BlockTreeDesc& chromaDesc, const Image& img)
+        : ParentBlock(0, 0, img.width(), img.height()), m_chromaMaxDepth(chromaDesc.maxDepth)
+    {
+        if (m_chromaMaxDepth < 0 || 30 < m_chromaMaxDepth)
+            throw std::runtime_error("Invalid chroma depth.");
+
+        Image yccImg = img;
+        yccImg.toYCbCr();
+
+        ParentBlockDesc pbDesc = createRootDesc(m_w, m_h);
+        // Each plane is built once, so its blocks are scanned directly.
+        {
+            StatsPyramid pyramid(yccImg, ColorMode::Gray, lumaDesc.maxDepth, lumaDesc.maxDepth + 1);
+            m_luma = makeBlockRef(new ParentBlock(pbDesc, createPlaneDesc(lumaDesc, lumaDesc.maxDepth, ColorMode::Gray), pyramid));
+        }
+        {
+            StatsPyramid pyramid(yccImg, ColorMode::CbCr, m_chromaMaxDepth, m_chromaMaxDepth + 1);
+            m_chroma = makeBlockRef(new ParentBlock(pbDesc, createPlaneDesc(chromaDesc, m_chromaMaxDepth, ColorMode::CbCr), pyramid));
+        }
+
+        m_subBlocks = { m_luma, m_chroma };
+        updateCounts();
+        m_nBits += DEPTH_BITS;
+    }
+
+    YCbCrBlock::YCbCrBlock(const BlockTreeDesc& lumaDesc, int imgWidth, int imgHeight, BitStream& bitStream)
+        : ParentBlock(0, 0, imgWidth, imgHeight)
+    {
+        ParentBlockDesc pbDesc = createRootDesc(m_w, m_h);
+
+        bitStream.readBitNC();
+        m_luma = makeBlockRef(new ParentBlock(pbDesc, createPlaneDesc(lumaDesc, lumaDesc.maxDepth, ColorMode::Gray), m_w, m_h, bitStream));
+
+        uint8_t depth = 0;
+        bitStream.readNC(&depth, DEPTH_BITS);
+        m_chromaMaxDepth = depth;
+        if (lumaDesc.pColorCache)
+            lumaDesc.pColorCache->reset();
+
+        bitStream.readBitNC();
+        m_chroma = makeBlockRef(new ParentBlock(pbDesc, createPlaneDesc(lumaDesc, m_chromaMaxDepth, ColorMode::CbCr), m_w, m_h, bitStream));
+
+        m_subBlocks = { m_luma, m_chroma };
+        updateCounts();
+        m_nBits += DEPTH_BITS;
+    }
+
+    void YCbCrBlock::writeToImg(Image& img) const
+    {
+        m_luma->writeToImg(img);
+        m_chroma->writeToImg(img);
+        img.fromYCbCr();
+    }
+
+    void YCbCrBlock::writeToBuffer(const BufferDesc& bufDesc) const
+    {
+        m_luma->writeToBuffer(bufDesc);
+        m_chroma->writeToBuffer(bufDesc);
+        convertYCbCrToRGB(bufDesc);
+    }
+
+    void YCbCrBlock::writeHeatmap(Image& img, int maxDepth, int depth) const
+    {
+        // The luma tree carries the detail, so it is the one shown.
+        m_luma->writeHeatmap(img, maxDepth, depth);
+    }
+
+    void YCbCrBlock::serialize(BitStream& bitStream, ColorCache* pColorCache) const
+    {
+        bitStream.writeBit(true);
+        m_luma->serialize(bitStream, pColorCache);
+        uint8_t depth = (uint8_t)m_chromaMaxDepth;
+        bitStream.write(&depth, DEPTH_BITS);
+        // Luma and chroma colors have different meanings, so every tree starts with an empty cache.
+        if (pColorCache)
+            pColorCache->reset();
+        m_chroma->serialize(bitStream, pColorCache);
+    }
+
+    uint64_t YCbCrBlock::calcError(const Image& img) const
+    {
+        // Luma and chroma blocks don't line up, so the error is taken from the merged RGB reconstruction.
+        Image recImg(img.width(), img.height(), img.layout());
+        writeToImg(recImg);
+
+        uint64_t error = 0;
+        for (int y = m_y; y < m_y + m_h; ++y)
+        {
+            for (int x = m_x; x < m_x + m_w; ++x)
+            {
+                const Color& a = img.getNC(x, y);
+                const Color& b = recImg.getNC(x, y);
+                int dr = a.r - b.r;
+                int dg = a.g - b.g;
+                int db = a.b - b.b;
+                error += uint32_t(dr * dr + dg * dg + db * db);
+            }
+        }
+
+        return error;
+    }
+
+    void YCbCrBlock::decodeToBuffer(const BlockTreeDesc& lumaDesc, const BufferDesc& bufDesc, BitStream& bitStream, BlockCounts& counts)
+    {
+        ++counts.nBlocks;
+        counts.nBits += 1 + DEPTH_BITS;
+
+        ParentBlockDesc pbDesc = createRootDesc(bufDesc.width, bufDesc.height);
+
+        bitStream.readBitNC();
+        ParentBlock::decodeToBuffer(pbDesc, createPlaneDesc(lumaDesc, lumaDesc.maxDepth, ColorMode::Gray), bufDesc, bitStream, counts);
+
+        uint8_t depth = 0;
+        bitStream.readNC(&depth, DEPTH_BITS);
+        if (lumaDesc.pColorCache)
+            lumaDesc.pColorCache->reset();
+
+        bitStream.readBitNC();
+        ParentBlock::decodeToBuffer(pbDesc, createPlaneDesc(lumaDesc, depth, ColorMode::CbCr), bufDesc, bitStream, counts);
+
+        convertYCbCrToRGB(bufDesc);
+    }
+
+    void YCbCrBlock::skip(const BlockTreeDesc& lumaDesc, int imgWidth, int imgHeight, BitStream& bitStream, BlockCounts& counts)
+    {
+        ++counts.nBlocks;
+        counts.nBits += 1 + DEPTH_BITS;
+
+        skipPlane(createPlaneDesc(lumaDesc, lumaDesc.maxDepth, ColorMode::Gray), imgWidth, imgHeight, bitStream, counts);
+
+        uint8_t depth = 0;
+        bitStream.read(&depth, DEPTH_BITS);
+        if (depth > 30)
+            throw std::runtime_error("Unable to read damaged blomp file.");
+        if (lumaDesc.pColorCache)
+            lumaDesc.pColorCache->reset();
+
+        skipPlane(createPlaneDesc(lumaDesc, depth, ColorMode::CbCr), imgWidth, imgHeight, bitStream, counts);
+    }
+
+    void YCbCrBlock::report(const BlockTreeDesc& lumaDesc, int imgWidth, int imgHeight, BitStream& bitStream, const Image* pSourceImg, TreeReport& report)
+    {
+        report.nRootBlocks += 1;
+        report.rootBits += 1 + DEPTH_BITS;
+
+        report.planes.emplace_back();
+        report.planes.back().name = "luma";
+        report.planes.back().maxDepth = lumaDesc.maxDepth;
+        reportPlane(createPlaneDesc(lumaDesc, lumaDesc.maxDepth, ColorMode::Gray), imgWidth, imgHeight, bitStream, pSourceImg, report.planes.back());
+
+        uint8_t depth = 0;
+        bitStream.read(&depth, DEPTH_BITS);
+        if (depth > 30)
+            throw std::runtime_error("Unable to read damaged blomp file.");
+        if (lumaDesc.pColorCache)
+            lumaDesc.pColorCache->reset();
+
+        report.planes.emplace_back();
+        report.planes.back().name = "chroma";
+        report.planes.back().maxDepth = depth;
+        reportPlane(createPlaneDesc(lumaDesc, depth, ColorMode::CbCr), imgWidth, imgHeight, bitStream, pSourceImg, report.planes.back());
+
+        // The plane roots aren't part of the per depth counts.
+        report.nRootBlocks += 2;
+        report.rootBits += 2;
+    }
+
+    BlockTreeDesc YCbCrBlock::createPlaneDesc(const BlockTreeDesc& btDesc, int maxDepth, ColorMode colorMode)
+    {
+        BlockTreeDesc planeDesc = btDesc;
+        planeDesc.maxDepth = maxDepth;
+        planeDesc.colorMode = colorMode;
+        return planeDesc;
+    }
+
+    ParentBlockDesc YCbCrBlock::createRootDesc(int imgWidth, int imgHeight)
+    {
+        ParentBlockDesc pbDesc;
+        pbDesc.x = 0;
+        pbDesc.y = 0;
+        pbDesc.width = imgWidth;
+        pbDesc.height = imgHeight;
+        pbDesc.depth = -1;
+        return pbDesc;
+    }
+
+    void YCbCrBlock::skipPlane(const BlockTreeDesc& btDesc, int imgWidth, int imgHeight, BitStream& bitStream, BlockCounts& counts)
+    {
+        if (!bitStream.readBit())
+            throw std::runtime_error("Unable to read damaged blomp file.");
+
+        ++counts.nBlocks;
+        ++counts.nBits;
+
+        int blockDim = tileDim(btDesc);
+        for (int y = 0; y < imgHeight; y += blockDim)
+            for (int x = 0; x < imgWidth; x += blockDim)
+                skipTile(x, y, btDesc, imgWidth, imgHeight, bitStream, counts);
+    }
+
+    void YCbCrBlock::reportPlane(const BlockTreeDesc& btDesc, int imgWidth, int imgHeight, BitStream& bitStream, const Image* pSourceImg, PlaneReport& report)
+    {
+        if (!bitStream.readBit())
+            throw std::runtime_error("Unable to read damaged blomp file.");
+
+        int blockDim = tileDim(btDesc);
+        for (int y = 0; y < imgHeight; y += blockDim)
+            for (int x = 0; x < imgWidth; x += blockDim)
+                reportTile(x, y, btDesc, imgWidth, imgHeight, bitStream, pSourceImg, report);
+    }
 }
\ No newline at end of file
@@ -6,50 +6,133 @@
 
 #include "Image.h"
 #include "BitStream.h"
+#include "ColorCache.h"
+#include "ColorStats.h"
 #include "Descriptors.h"
+#include "Gradient.h"
+#include "MemoryTracker.h"
+#include "RDOptimizer.h"
+#include "StatsPyramid.h"
+#include "TreeReport.h"
 
 namespace Blomp
 {
     struct BlockMetrics
     {
         int width, height;
-        float variation = 0.0f;
-        Pixel avgColor;
+        ColorStats stats;
     };
-    
+
     class Block
     {
     public:
         Block() = delete;
         Block(int x, int y, int w, int h);
+        virtual ~Block() = default;
+    public:
+        // Block nodes are booked as tree memory. Neither is inlined, as GCC
+        // would then pair the global new or delete inside with the class one.
+        [[gnu::noinline]] static void* operator new(size_t size);
+        [[gnu::noinline]] static void operator delete(void* ptr, size_t size);
     public:
         int getWidth() const;
         int getHeight() const;
     public:
         virtual void writeToImg(Image& img) const = 0;
+        virtual void writeToBuffer(const BufferDesc& bufDesc) const = 0;
         virtual void writeHeatmap(Image& img, int maxDepth, int depth = -1) const = 0;
-        virtual void serialize(BitStream& bitStream) const = 0;
+        // Leaf colors are coded through the cache when one is given.
+        virtual void serialize(BitStream& bitStream, ColorCache* pColorCache = nullptr) const = 0;
+        // Sum of squared channel differences in 8-bit units.
+        virtual uint64_t calcError(const Image& img) const = 0;
         virtual int nBlocks() const = 0;
         virtual int nColorBlocks() const = 0;
+        // Serialized size with literal leaf colors.
+        virtual uint64_t nBits() const = 0;
     protected:
         int m_x, m_y;
         int m_w, m_h;
     };
     typedef std::shared_ptr<Block> BlockRef;
+    typedef std::vector<BlockRef, TrackedAllocator<BlockRef, MemoryCategory::Tree>> BlockList;
+
+    // Takes a block from new and books the control block of its shared pointer as tree memory too.
+    template <typename T>
+    std::shared_ptr<T> makeBlockRef(T* pBlock)
+    {
+        return std::shared_ptr<T>(pBlock, std::default_delete<T>(), TrackedAllocator<T, MemoryCategory::Tree>());
+    }
 
     class ColorBlock : public Block
     {
     public:
         ColorBlock() = delete;
-        ColorBlock(int x, int y, int w, int h, Pixel color);
+        // In gradient trees every leaf stores whether it is a gradient, flat leaves included.
+        ColorBlock(int x, int y, int w, int h, Color color, bool hasShapeBit = false);
     public:
         virtual void writeToImg(Image& img) const override;
+        virtual void writeToBuffer(const BufferDesc& bufDesc) const override;
         virtual void writeHeatmap(Image& img, int maxDepth, int depth = -1) const override;
-        virtual void serialize(BitStream& bitStream) const override;
+        virtual void serialize(BitStream& bitStream, ColorCache* pColorCache = nullptr) const override;
+        virtual uint64_t calcError(const Image& img) const override;
         virtual int nBlocks() const override;
         virtual int nColorBlocks() const override;
+        virtual uint64_t nBits() const override;
+    protected:
+        void writeLeafFlags(BitStream& bitStream, bool isGradient) const;
+        void writeColor(BitStream& bitStream, ColorCache* pColorCache, const uint8_t* colorData, int nColorBits) const;
+    protected:
+        Color m_color;
+        bool m_hasShapeBit;
+    };
+
+    // ColorBlock of the grayscale mode. The color is stored as a single
+    // 8-bit value and expanded to all three channels.
+    class GrayBlock : public ColorBlock
+    {
+    public:
+        GrayBlock() = delete;
+        GrayBlock(int x, int y, int w, int h, uint8_t value, bool hasShapeBit = false);
+    public:
+        virtual void serialize(BitStream& bitStream, ColorCache* pColorCache = nullptr) const override;
+        virtual uint64_t nBits() const override;
+    };
+
+    // ColorBlock of the chroma tree in the YCbCr mode. Only the Cb and Cr
+    // channels (g and b) are stored and written, the luma channel is left
+    // to the luma tree.
+    class ChromaBlock : public ColorBlock
+    {
+    public:
+        ChromaBlock() = delete;
+        ChromaBlock(int x, int y, int w, int h, uint8_t cb, uint8_t cr, bool hasShapeBit = false);
+    public:
+        virtual void writeToImg(Image& img) const override;
+        virtual void writeToBuffer(const BufferDesc& bufDesc) const override;
+        virtual void serialize(BitStream& bitStream, ColorCache* pColorCache = nullptr) const override;
+        virtual uint64_t calcError(const Image& img) const override;
+        virtual uint64_t nBits() const override;
+    };
+
+    // Leaf of a gradient tree whose color changes linearly across the block.
+    // It stores its shape bit, the mean color as a literal and the slopes of
+    // the channels of its color mode. The inherited color is the mean.
+    class GradientBlock : public ColorBlock
+    {
+    public:
+        GradientBlock() = delete;
+        GradientBlock(int x, int y, int w, int h, const Gradient& gradient, ColorMode colorMode);
+    public:
+        virtual void writeToImg(Image& img) const override;
+        virtual void writeToBuffer(const BufferDesc& bufDesc) const override;
+        virtual void serialize(BitStream& bitStream, ColorCache* pColorCache = nullptr) const override;
+        virtual uint64_t calcError(const Image& img) const override;
+        virtual uint64_t nBits() const override;
+    public:
+        static void writeToBuffer(const BufferDesc& bufDesc, int x, int y, int w, int h, const Gradient& gradient, ColorMode colorMode);
     protected:
-        Pixel m_color;
+        Gradient m_gradient;
+        ColorMode m_colorMode;
     };
 
     class ParentBlock;
@@ -59,21 +142,153 @@ namespace Blomp
     {
     public:
         ParentBlock() = delete;
-        ParentBlock(const ParentBlockDesc& pbDesc, const BlockTreeDesc& btDesc, const Image& img);
+        ParentBlock(const ParentBlockDesc& pbDesc, const BlockTreeDesc& btDesc, const StatsPyramid& pyramid);
         ParentBlock(const ParentBlockDesc& pbDesc, const BlockTreeDesc& btDesc, int imgWidth, int imgHeight, BitStream& bitStream);
+        ParentBlock(const ParentBlockDesc& pbDesc, const BlockTreeDesc& btDesc, const RDOptimizer& rdo);
     public:
         virtual void writeToImg(Image& img) const override;
+        virtual void writeToBuffer(const BufferDesc& bufDesc) const override;
         virtual void writeHeatmap(Image& img, int maxDepth, int depth = -1) const override;
-        virtual void serialize(BitStream& bitStream) const override;
+        virtual void serialize(BitStream& bitStream, ColorCache* pColorCache = nullptr) const override;
+        virtual uint64_t calcError(const Image& img) const override;
         virtual int nBlocks() const override;
         virtual int nColorBlocks() const override;
+        virtual uint64_t nBits() const override;
+    public:
+        const BlockList& subBlocks() const;
+    public:
+        // The bitstream based functions expect a bitstream validated by BlockTree::isValid.
+        static void decodeToBuffer(const ParentBlockDesc& pbDesc, const BlockTreeDesc& btDesc, const BufferDesc& bufDesc, BitStream& bitStream, BlockCounts& counts);
+        static BlockRef createTile(int x, int y, const BlockTreeDesc& btDesc, const StatsPyramid& pyramid);
+        static void skipTile(int x, int y, const BlockTreeDesc& btDesc, int imgWidth, int imgHeight, BitStream& bitStream, BlockCounts& counts);
+        // Reads a tile like skipTile, pSourceImg may be null when the leaf variations aren't needed.
+        static void reportTile(int x, int y, const BlockTreeDesc& btDesc, int imgWidth, int imgHeight, BitStream& bitStream, const Image* pSourceImg, PlaneReport& report);
+        static int tileDim(const BlockTreeDesc& btDesc);
+        static bool intersects(int x, int y, int w, int h, const std::vector<Rect>& rects);
+    protected:
+        ParentBlock(int x, int y, int w, int h);
     protected:
-        std::vector<BlockRef> m_subBlocks;
+        void updateCounts();
     protected:
-        static BlockRef createSubBlock(int x, int y, int newDepth, const BlockTreeDesc& btDesc, const Image& img);
+        BlockList m_subBlocks;
+        int m_nBlocks = 1;
+        int m_nColorBlocks = 0;
+        uint64_t m_nBits = 1;
+    protected:
+        static BlockRef createSubBlock(int x, int y, int newDepth, const BlockTreeDesc& btDesc, const StatsPyramid& pyramid);
         static BlockRef createSubBlock(int x, int y, int newDepth, const BlockTreeDesc& btDesc, int imgWidth, int imgHeight, BitStream& bitStream);
+        static BlockRef createSubBlock(int x, int y, int newDepth, const BlockTreeDesc& btDesc, const RDOptimizer& rdo);
+        static void decodeSubBlock(int x, int y, int newDepth, const BlockTreeDesc& btDesc, const BufferDesc& bufDesc, BitStream& bitStream, BlockCounts& counts);
+        static void skipSubBlock(int x, int y, int newDepth, const BlockTreeDesc& btDesc, int imgWidth, int imgHeight, BitStream& bitStream, BlockCounts& counts);
+        static void reportSubBlock(int x, int y, int newDepth, const BlockTreeDesc& btDesc, int imgWidth, int imgHeight, BitStream& bitStream, const Image* pSourceImg, PlaneReport& report);
+        // The sub block functions above dispatch to these once per tile. They are specialized
+        // on the log2 of the block dimension, so the recursion below uses constant block sizes.
+        template <int LOG_DIM> static BlockRef createQuadBlock(int x, int y, const BlockTreeDesc& btDesc, const StatsPyramid& pyramid);
+        template <int LOG_DIM> static BlockRef readQuadBlockNC(int x, int y, const BlockTreeDesc& btDesc, int imgWidth, int imgHeight, BitStream& bitStream);
+        template <int LOG_DIM> static void decodeQuadBlockNC(int x, int y, const BlockTreeDesc& btDesc, const BufferDesc& bufDesc, BitStream& bitStream, BlockCounts& counts);
+        template <int LOG_DIM> static void skipQuadBlock(int x, int y, const BlockTreeDesc& btDesc, int imgWidth, int imgHeight, BitStream& bitStream, BlockCounts& counts);
+        static BlockRef createColorBlock(int x, int y, int w, int h, Color color, const BlockTreeDesc& btDesc);
+        // Returns null when the gradient doesn't meet the variation threshold.
+        static BlockRef createGradientBlock(int x, int y, int maxWidth, int maxHeight, const BlockMetrics& bm, const BlockTreeDesc& btDesc, const StatsPyramid& pyramid);
+        static BlockRef readLeafNC(int x, int y, int w, int h, const BlockTreeDesc& btDesc, BitStream& bitStream);
+        // All of them return the number of bits read after the leaf flag.
+        static int decodeLeafNC(int x, int y, int w, int h, const BlockTreeDesc& btDesc, const BufferDesc& bufDesc, BitStream& bitStream);
+        static int skipLeaf(const BlockTreeDesc& btDesc, BitStream& bitStream, bool& isGradient);
+        static int readColorNC(const BlockTreeDesc& btDesc, BitStream& bitStream, uint8_t* pixelData);
+        static int skipColor(const BlockTreeDesc& btDesc, BitStream& bitStream);
+        static Gradient readGradientNC(const BlockTreeDesc& btDesc, BitStream& bitStream);
+        static void readLiteralNC(const BlockTreeDesc& btDesc, BitStream& bitStream, uint8_t* pixelData);
+        static void writeColorToBuffer(const BlockTreeDesc& btDesc, const BufferDesc& bufDesc, int x, int y, int w, int h, const uint8_t* pixelData);
+        static int colorBits(const BlockTreeDesc& btDesc);
         static int calcDimVal(int base, int depth);
-        static BlockMetrics calcBlockMetrics(int x, int y, int maxDepth, int newDepth, const Image& img);
+        static BlockMetrics calcBlockMetrics(int x, int y, int newDepth, const BlockTreeDesc& btDesc, const StatsPyramid& pyramid);
+        static BlockMetrics calcRectMetrics(int x, int y, int maxWidth, int maxHeight, const StatsPyramid& pyramid);
+    };
+
+    // ParentBlock of the binary split mode. Instead of always splitting into
+    // four quadrants it stores the chosen SplitType (2 bits) and may split
+    // into a top and bottom (Horizontal) or a left and right (Vertical) half.
+    class SplitBlock : public ParentBlock
+    {
+    public:
+        SplitBlock() = delete;
+        SplitBlock(const ParentBlockDesc& pbDesc, int logWidth, int logHeight, const BlockTreeDesc& btDesc, const StatsPyramid& pyramid);
+        SplitBlock(const ParentBlockDesc& pbDesc, int logWidth, int logHeight, SplitType splitType, const BlockTreeDesc& btDesc, int imgWidth, int imgHeight, BitStream& bitStream);
+    public:
+        virtual void serialize(BitStream& bitStream, ColorCache* pColorCache = nullptr) const override;
+    public:
+        static BlockRef createSubBlock(int x, int y, int logWidth, int logHeight, int newDepth, const BlockTreeDesc& btDesc, const StatsPyramid& pyramid);
+        static BlockRef createSubBlock(int x, int y, int logWidth, int logHeight, int newDepth, const BlockTreeDesc& btDesc, int imgWidth, int imgHeight, BitStream& bitStream);
+        static void decodeSubBlock(int x, int y, int logWidth, int logHeight, int newDepth, const BlockTreeDesc& btDesc, const BufferDesc& bufDesc, BitStream& bitStream, BlockCounts& counts);
+        static void skipSubBlock(int x, int y, int logWidth, int logHeight, const BlockTreeDesc& btDesc, int imgWidth, int imgHeight, BitStream& bitStream, BlockCounts& counts);
+        static void reportSubBlock(int x, int y, int logWidth, int logHeight, int depth, const BlockTreeDesc& btDesc, int imgWidth, int imgHeight, BitStream& bitStream, const Image* pSourceImg, PlaneReport& report);
+    protected:
+        SplitType m_splitType;
+    protected:
+        static SplitType chooseSplitType(int x, int y, int logWidth, int logHeight, const BlockTreeDesc& btDesc, const StatsPyramid& pyramid);
+        // Whether a horizontal or vertical split leads to two flat leaves.
+        static bool splitsIntoLeaves(int x, int y, int logWidth, int logHeight, const BlockTreeDesc& btDesc, const StatsPyramid& pyramid);
+        static SplitType readSplitType(int logWidth, int logHeight, BitStream& bitStream);
+        static SplitType readSplitTypeNC(BitStream& bitStream);
+        static void calcChildLogDims(SplitType splitType, int& logWidth, int& logHeight);
+    };
+
+    // Root block of a frame in a sequence. Every top-level tile is either
+    // rebuilt from the frame or shared with the previous frame, when the
+    // previous reconstruction of the tile still meets the variation threshold.
+    // Shared tiles are serialized as a single 'copy' bit.
+    class FrameBlock : public ParentBlock
+    {
+    public:
+        FrameBlock() = delete;
+        FrameBlock(const BlockTreeDesc& btDesc, const Image& img, const ParentBlock* pPrevFrame);
+    public:
+        virtual void serialize(BitStream& bitStream, ColorCache* pColorCache = nullptr) const override;
+    public:
+        int nCopiedTiles() const;
+    public:
+        static void decodeToBuffer(const BlockTreeDesc& btDesc, const BufferDesc& bufDesc, BitStream& bitStream, BlockCounts& counts);
+    protected:
+        std::vector<uint8_t> m_copied;
+        int m_nCopiedTiles = 0;
+    };
+
+    // Root block of the YCbCr mode. Luma and chroma are stored as two
+    // separate trees, each with its own BlockTreeDesc, so the chroma tree
+    // can use a smaller depth and a larger variation threshold.
+    // The chroma depth is stored between both trees. When rendering, the
+    // luma tree is written first, the chroma tree fills in Cb and Cr and
+    // the result is converted back to RGB.
+    class YCbCrBlock : public ParentBlock
+    {
+    public:
+        YCbCrBlock() = delete;
+        YCbCrBlock(const BlockTreeDesc& lumaDesc, const BlockTreeDesc& chromaDesc, const Image& img);
+        YCbCrBlock(const BlockTreeDesc& lumaDesc, int imgWidth, int imgHeight, BitStream& bitStream);
+    public:
+        virtual void writeToImg(Image& img) const override;
+        virtual void writeToBuffer(const BufferDesc& bufDesc) const override;
+        virtual void writeHeatmap(Image& img, int maxDepth, int depth = -1) const override;
+        virtual void serialize(BitStream& bitStream, ColorCache* pColorCache = nullptr) const override;
+        virtual uint64_t calcError(const Image& img) const override;
+    public:
+        int chromaMaxDepth() const;
+    public:
+        // Both functions expect the root bit to be already read.
+        static void decodeToBuffer(const BlockTreeDesc& lumaDesc, const BufferDesc& bufDesc, BitStream& bitStream, BlockCounts& counts);
+        static void skip(const BlockTreeDesc& lumaDesc, int imgWidth, int imgHeight, BitStream& bitStream, BlockCounts& counts);
+        // pSourceImg has to be converted to YCbCr already.
+        static void report(const BlockTreeDesc& lumaDesc, int imgWidth, int imgHeight, BitStream& bitStream, const Image* pSourceImg, TreeReport& report);
+    protected:
+        static constexpr int DEPTH_BITS = 5;
+        ParentBlockRef m_luma;
+        ParentBlockRef m_chroma;
+        int m_chromaMaxDepth;
+    protected:
+        static BlockTreeDesc createPlaneDesc(const BlockTreeDesc& btDesc, int maxDepth, ColorMode colorMode);
+        static ParentBlockDesc createRootDesc(int imgWidth, int imgHeight);
+        static void skipPlane(const BlockTreeDesc& btDesc, int imgWidth, int imgHeight, BitStream& bitStream, BlockCounts& counts);
+        static void reportPlane(const BlockTreeDesc& btDesc, int imgWidth, int imgHeight, BitStream& bitStream, const Image* pSourceImg, PlaneReport& report);
     };
 
     inline int Block::getWidth() const
@@ -86,11 +301,84 @@ namespace Blomp
         return m_h;
     }
 
+    inline int ColorBlock::nBlocks() const
+    {
+        return 1;
+    }
+
+    inline int ColorBlock::nColorBlocks() const
+    {
+        return 1;
+    }
+
+    inline uint64_t ColorBlock::nBits() const
+    {
+        return 1 + m_hasShapeBit + 3 * 8;
+    }
+
+    inline uint64_t GrayBlock::nBits() const
+    {
+        return 1 + m_hasShapeBit + 8;
+    }
+
+    inline uint64_t ChromaBlock::nBits() const
+    {
+        return 1 + m_hasShapeBit + 2 * 8;
+    }
+
+    inline uint64_t GradientBlock::nBits() const
+    {
+        return 1 + 1 + Gradient::nBits(m_colorMode);
+    }
+
+    inline int ParentBlock::nBlocks() const
+    {
+        return m_nBlocks;
+    }
+
+    inline int ParentBlock::nColorBlocks() const
+    {
+        return m_nColorBlocks;
+    }
+
+    inline uint64_t ParentBlock::nBits() const
+    {
+        return m_nBits;
+    }
+
+    inline const BlockList& ParentBlock::subBlocks() const
+    {
+        return m_subBlocks;
+    }
+
+    inline int ParentBlock::tileDim(const BlockTreeDesc& btDesc)
+    {
+        return calcDimVal(btDesc.maxDepth, 0);
+    }
+
+    inline bool ParentBlock::intersects(int x, int y, int w, int h, const std::vector<Rect>& rects)
+    {
+        for (auto& rect : rects)
+            if (x < rect.x + rect.width && rect.x < x + w && y < rect.y + rect.height && rect.y < y + h)
+                return true;
+        return false;
+    }
+
+    inline int FrameBlock::nCopiedTiles() const
+    {
+        return m_nCopiedTiles;
+    }
+
+    inline int YCbCrBlock::chromaMaxDepth() const
+    {
+        return m_chromaMaxDepth;
+    }
+
     inline int ParentBlock::calcDimVal(int base, int depth)
     {
         if (depth > base)
             throw std::runtime_error("FATAL: depth > maxDepth!!!");
 
-        return std::pow(2, base - depth);
+        return 1 << (base - depth);
     }
 }
\ No newline at end of file
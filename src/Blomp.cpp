@@ -1,12 +1,23 @@
 #include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
 #include <exception>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
 #include <stdexcept>
 #include <string>
+#include <thread>
+#include <vector>
 #include <filesystem>
 
+#include "Archive.h"
 #include "Blocks.h"
 #include "Tools.h"
 #include "BitStream.h"
@@ -14,23 +25,207 @@
 #include "Descriptors.h"
 #include "Image.h"
 #include "FileHeader.h"
+#include "MemoryTracker.h"
 #include "ImgCompare.h"
+#include "RDOptimizer.h"
+#include "StatsPyramid.h"
+#include "Pipeline.h"
+#include "ResultCache.h"
+#include "Trace.h"
 #include "BlompHelp.h"
 
+// Decoded pixels are booked like image memory.
+typedef std::vector<uint8_t, Blomp::TrackedAllocator<uint8_t, Blomp::MemoryCategory::Image>> PixelData;
+
 #define RETURN_MISSING_VALUE(option) { std::cout << "Missing value for option '" << (option) << "'."; return 1; }
 
+Blomp::BlockCounts getBlockCounts(const Blomp::ParentBlockRef bt)
+{
+    Blomp::BlockCounts counts;
+    counts.nBlocks = bt->nBlocks();
+    counts.nColorBlocks = bt->nColorBlocks();
+    counts.nBits = bt->nBits();
+    return counts;
+}
+
+Blomp::BlockCounts getBlockCounts(const Blomp::ParentBlockRef bt, const Blomp::BlockTreeDesc& btDesc)
+{
+    Blomp::BlockCounts counts = getBlockCounts(bt);
+    if (btDesc.leafCoding == Blomp::LeafCoding::Literal)
+        return counts;
+
+    // The tree only knows the literal size, cached leaves need to be serialized to be counted.
+    // The bits themselves aren't needed, so they are passed on to a stream without a buffer.
+    std::ostream nullStream(nullptr);
+    Blomp::BitStream bitStream;
+    bitStream.setSink(&nullStream);
+    Blomp::BlockTree::serialize(bt, btDesc, bitStream);
+    counts.nBits = bitStream.flushSink();
+    return counts;
+}
+
+uint64_t calcEstFileSize(const Blomp::BlockCounts& counts)
+{
+    return sizeof(Blomp::FileHeader) + sizeof(uint64_t) + Blomp::BitStream::minBytes(counts.nBits);
+}
+
 uint64_t calcEstFileSize(const Blomp::ParentBlockRef bt)
 {
-    return (sizeof(Blomp::FileHeader) * 8 + sizeof(uint64_t) * 8 + bt->nBlocks() + bt->nColorBlocks() * 3 * 8 + 7) / 8;
+    return calcEstFileSize(getBlockCounts(bt));
 }
 
-void viewBlockTreeInfo(const Blomp::ParentBlockRef bt, const std::string& filename = "")
+void viewBlockTreeInfo(const Blomp::BlockCounts& counts, const std::string& filename = "")
 {
     if (!filename.empty())
         std::cout << "BlockTree Info for '" << filename << "':" << std::endl;
-    std::cout << "  Blocks:      " << bt->nBlocks() << std::endl;
-    std::cout << "  ColorBlocks: " << bt->nColorBlocks() << std::endl;
-    std::cout << "  EstFileSize: " << calcEstFileSize(bt) << " bytes" << std::endl;
+    std::cout << "  Blocks:      " << counts.nBlocks << std::endl;
+    std::cout << "  ColorBlocks: " << counts.nColorBlocks << std::endl;
+    std::cout << "  TreeBits:    " << counts.nBits << std::endl;
+    std::cout << "  EstFileSize: " << calcEstFileSize(counts) << " bytes" << std::endl;
+}
+
+void viewBlockTreeInfo(const Blomp::ParentBlockRef bt, const std::string& filename = "")
+{
+    viewBlockTreeInfo(getBlockCounts(bt), filename);
+}
+
+std::string formatPercent(uint64_t part, uint64_t total)
+{
+    std::ostringstream oss;
+    oss << std::fixed << std::setprecision(1) << (total ? 100.0 * part / total : 0.0) << "%";
+    return oss.str();
+}
+
+void viewBlockTreeReport(const Blomp::TreeReport& report, const std::string& filename)
+{
+    auto counts = report.counts();
+
+    std::cout << "BlockTree Report for '" << filename << "':" << std::endl;
+    std::cout << "  Blocks:        " << counts.nBlocks << std::endl;
+    std::cout << "  ColorBlocks:   " << counts.nColorBlocks << std::endl;
+    std::cout << "  TreeBits:      " << counts.nBits << std::endl;
+    std::cout << "  StructureBits: " << report.structureBits() << " (" << formatPercent(report.structureBits(), counts.nBits) << ")" << std::endl;
+    std::cout << "  ColorBits:     " << report.colorBits() << " (" << formatPercent(report.colorBits(), counts.nBits) << ")" << std::endl;
+    std::cout << "  EstFileSize:   " << calcEstFileSize(counts) << " bytes" << std::endl;
+
+    for (auto& plane : report.planes)
+    {
+        uint64_t nPixels = 0;
+        for (auto& dr : plane.depths)
+            nPixels += dr.leafArea;
+
+        std::cout << "  Plane '" << plane.name << "' (depth " << plane.maxDepth << "):" << std::endl;
+        std::cout << "    StructureBits: " << plane.structureBits << std::endl;
+        std::cout << "    ColorBits:     " << plane.colorBits << std::endl;
+        if (plane.nGradientLeaves > 0)
+            std::cout << "    Gradients:     " << plane.nGradientLeaves << " (" << formatPercent(plane.nGradientLeaves, plane.nLeaves()) << " of the leaves)" << std::endl;
+        std::cout << "    Depth      Leaves     Parents  LeafArea" << std::endl;
+        for (int depth = 0; depth < (int)plane.depths.size(); ++depth)
+        {
+            auto& dr = plane.depths[depth];
+            std::cout << "    " << std::left << std::setw(5) << depth << std::right
+                << std::setw(12) << dr.nLeaves << std::setw(12) << dr.nParents
+                << std::setw(10) << formatPercent(dr.leafArea, nPixels) << std::endl;
+        }
+
+        if (!report.hasVariations)
+            continue;
+
+        uint64_t nLeaves = plane.nLeaves();
+        std::cout << "    Leaf variations:" << std::endl;
+        for (int bin = 0; bin < Blomp::PlaneReport::N_VARIATION_BINS; ++bin)
+        {
+            bool isLast = bin == Blomp::PlaneReport::N_VARIATION_BINS - 1;
+            double limit = Blomp::PlaneReport::VARIATION_LIMITS[isLast ? bin - 1 : bin];
+            std::cout << "      " << (isLast ? ">  " : "<= ") << std::left << std::setw(8) << limit << std::right
+                << std::setw(12) << plane.variationBins[bin]
+                << std::setw(10) << formatPercent(plane.variationBins[bin], nLeaves) << std::endl;
+        }
+        std::cout << "      Mean: " << (nLeaves ? plane.variationSum / nLeaves : 0.0) << "  Max: " << plane.maxVariation << std::endl;
+    }
+}
+
+void writeBlockTreeReportJson(const Blomp::TreeReport& report, const std::string& filename)
+{
+    auto counts = report.counts();
+
+    std::cout << "{\"file\":\"" << Blomp::escapeJson(filename) << "\""
+        << ",\"blocks\":" << counts.nBlocks
+        << ",\"colorBlocks\":" << counts.nColorBlocks
+        << ",\"treeBits\":" << counts.nBits
+        << ",\"structureBits\":" << report.structureBits()
+        << ",\"colorBits\":" << report.colorBits()
+        << ",\"estFileSize\":" << calcEstFileSize(counts)
+        << ",\"planes\":[";
+
+    for (int i = 0; i < (int)report.planes.size(); ++i)
+    {
+        auto& plane = report.planes[i];
+        std::cout << (i ? "," : "")
+            << "{\"name\":\"" << plane.name << "\""
+            << ",\"maxDepth\":" << plane.maxDepth
+            << ",\"structureBits\":" << plane.structureBits
+            << ",\"colorBits\":" << plane.colorBits
+            << ",\"gradientLeaves\":" << plane.nGradientLeaves
+            << ",\"depths\":[";
+
+        for (int depth = 0; depth < (int)plane.depths.size(); ++depth)
+        {
+            auto& dr = plane.depths[depth];
+            std::cout << (depth ? "," : "")
+                << "{\"depth\":" << depth
+                << ",\"leaves\":" << dr.nLeaves
+                << ",\"parents\":" << dr.nParents
+                << ",\"leafArea\":" << dr.leafArea << "}";
+        }
+        std::cout << "]";
+
+        if (report.hasVariations)
+        {
+            uint64_t nLeaves = plane.nLeaves();
+            std::cout << ",\"variations\":{\"limits\":[";
+            for (int bin = 0; bin < Blomp::PlaneReport::N_VARIATION_BINS - 1; ++bin)
+                std::cout << (bin ? "," : "") << Blomp::PlaneReport::VARIATION_LIMITS[bin];
+            std::cout << "],\"counts\":[";
+            for (int bin = 0; bin < Blomp::PlaneReport::N_VARIATION_BINS; ++bin)
+                std::cout << (bin ? "," : "") << plane.variationBins[bin];
+            std::cout << "],\"mean\":" << (nLeaves ? plane.variationSum / nLeaves : 0.0)
+                << ",\"max\":" << plane.maxVariation << "}";
+        }
+
+        std::cout << "}";
+    }
+
+    std::cout << "]}" << std::endl;
+}
+
+void viewMemoryInfo()
+{
+    std::cout << "Peak memory: " << Blomp::MemoryTracker::format(Blomp::MemoryTracker::peak()) << " (";
+    for (int i = 0; i < (int)Blomp::MemoryCategory::Count; ++i)
+    {
+        auto category = (Blomp::MemoryCategory)i;
+        std::cout << (i ? ", " : "") << Blomp::MemoryTracker::categoryName(category) << " " << Blomp::MemoryTracker::format(Blomp::MemoryTracker::peak(category));
+    }
+    std::cout << ")" << std::endl;
+}
+
+bool saveTrace(const std::string& traceFile)
+{
+    if (traceFile.empty())
+        return true;
+
+    try
+    {
+        Blomp::Trace::save(traceFile);
+    }
+    catch (std::exception& e)
+    {
+        std::cout << "ERROR: " << e.what() << std::endl;
+        return false;
+    }
+
+    return true;
 }
 
 void autoGenSaveHeatmap(const Blomp::ParentBlockRef bt, Blomp::Image& img, const std::string& heatmapFile)
@@ -43,58 +238,557 @@ void autoGenSaveHeatmap(const Blomp::ParentBlockRef bt, Blomp::Image& img, const
     img.save(heatmapFile);
 }
 
-Blomp::ParentBlockRef loadBlockTree(const std::string& filename)
+void readBlockFile(std::istream& iStream, Blomp::FileHeader& fileHeader, Blomp::BitStream& bitStream)
 {
-    Blomp::FileHeader fileHeader;
+    iStream >> fileHeader;
+    if (!iStream || !fileHeader.isValid())
+        throw std::runtime_error("Invalid blomp file header.");
+
+    if (fileHeader.hasCounts())
+        bitStream.reserve(fileHeader.counts.nBits);
+
+    iStream >> bitStream;
+    if (!iStream)
+        throw std::runtime_error("Unable to read damaged blomp file.");
+    if (fileHeader.hasCounts() && bitStream.size() != fileHeader.counts.nBits)
+        throw std::runtime_error("Unable to read damaged blomp file.");
+}
+
+// The bitstream reads its bits in place, so the data must outlive it.
+void readBlockFile(const uint8_t* data, uint64_t size, Blomp::FileHeader& fileHeader, Blomp::BitStream& bitStream)
+{
+    uint64_t offset = Blomp::readFileHeader(data, size, fileHeader);
+    if (!offset || !fileHeader.isValid())
+        throw std::runtime_error("Invalid blomp file header.");
+
+    uint64_t nBits;
+    if (size - offset < sizeof(nBits))
+        throw std::runtime_error("Unable to read damaged blomp file.");
+    std::memcpy(&nBits, data + offset, sizeof(nBits));
+    offset += sizeof(nBits);
+
+    if (nBits / 8 + (nBits % 8 != 0) > size - offset)
+        throw std::runtime_error("Unable to read damaged blomp file.");
+    if (fileHeader.hasCounts() && nBits != fileHeader.counts.nBits)
+        throw std::runtime_error("Unable to read damaged blomp file.");
+
+    bitStream = Blomp::BitStream::view(data + offset, nBits);
+}
+
+// Files inside of an archive are addressed as 'archive.bla:name'.
+bool splitArchivePath(const std::string& path, std::string& archiveFile, std::string& name)
+{
+    auto pos = path.find(".bla:");
+    if (pos == std::string::npos)
+        return false;
+
+    archiveFile = path.substr(0, pos + 4);
+    name = path.substr(pos + 5);
+    return true;
+}
+
+bool isArchivePath(const std::string& path)
+{
+    std::string archiveFile;
+    std::string name;
+    return splitArchivePath(path, archiveFile, name);
+}
+
+// Archives stay mapped until the program exits, so their files can be used in place.
+const Blomp::Archive& openArchive(const std::string& filename)
+{
+    static std::mutex mutex;
+    static std::map<std::string, std::unique_ptr<Blomp::Archive>> archives;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& pArchive = archives[filename];
+    if (!pArchive)
+        pArchive.reset(new Blomp::Archive(filename));
+    return *pArchive;
+}
+
+Blomp::ArchiveFile findArchiveFile(const std::string& path)
+{
+    std::string archiveFile;
+    std::string name;
+    if (!splitArchivePath(path, archiveFile, name))
+        throw std::runtime_error("Missing archive entry name.");
+
+    auto& archive = openArchive(archiveFile);
+    uint64_t index = archive.find(name);
+    if (index == archive.nEntries())
+        throw std::runtime_error("Unable to find '" + name + "' in archive.");
+
+    return archive.file(index);
+}
+
+// Outputs of archive entries are placed in the current directory.
+std::string removeExtension(const std::string& path)
+{
+    std::string archiveFile;
+    std::string name;
+    if (splitArchivePath(path, archiveFile, name))
+        return name.substr(0, name.find_last_of("."));
+
+    return path.substr(0, path.find_last_of("."));
+}
+
+uint64_t fileSize(const std::string& path)
+{
+    if (isArchivePath(path))
+        return findArchiveFile(path).size;
+
+    return std::filesystem::file_size(path);
+}
+
+void loadBlockFile(const std::string& filename, Blomp::FileHeader& fileHeader, Blomp::BitStream& bitStream)
+{
+    Blomp::TraceScope trace("load", "io");
+    trace.arg("file", filename);
+
+    if (isArchivePath(filename))
+    {
+        auto file = findArchiveFile(filename);
+        readBlockFile(file.data, file.size, fileHeader, bitStream);
+        trace.arg("bits", bitStream.size());
+        return;
+    }
 
     std::ifstream ifStream(filename, std::ios::binary | std::ios::in);
     if (!ifStream.is_open())
         throw std::runtime_error("Unable to open blomp file.");
 
-    ifStream.read((char*)&fileHeader, sizeof(fileHeader));
-    if (!fileHeader.isValid())
-        throw std::runtime_error("Invalid blomp file header.");
-
-    Blomp::BitStream bitStream(ifStream);
+    readBlockFile(ifStream, fileHeader, bitStream);
     ifStream.close();
 
-    return Blomp::BlockTree::deserialize(fileHeader.bd, bitStream);
+    trace.arg("bits", bitStream.size());
 }
 
-void saveBlockTree(const Blomp::ParentBlockRef bt, int maxDepth, const std::string& filename)
+Blomp::ParentBlockRef loadBlockTree(const std::string& filename)
 {
     Blomp::FileHeader fileHeader;
-
     Blomp::BitStream bitStream;
-    bitStream.reserve(calcEstFileSize(bt));
-    Blomp::BlockTree::serialize(bt, bitStream);
+    loadBlockFile(filename, fileHeader, bitStream);
+
+    return Blomp::BlockTree::deserialize(fileHeader.bd, fileHeader.splitMode(), fileHeader.colorMode(), fileHeader.leafCoding(), fileHeader.leafShape(), bitStream);
+}
+
+Blomp::BlockCounts scanBlockFile(const Blomp::FileHeader& fileHeader, Blomp::BitStream& bitStream)
+{
+    Blomp::BlockCounts counts;
+    if (!Blomp::BlockTree::scan(fileHeader.bd, fileHeader.splitMode(), fileHeader.colorMode(), fileHeader.leafCoding(), fileHeader.leafShape(), bitStream, counts))
+        throw std::runtime_error("Unable to read damaged blomp file.");
+
+    return counts;
+}
+
+// Every file is scanned in place, so taking the inventory of an archive is bound by reading it.
+void viewArchiveInfo(const std::string& filename)
+{
+    Blomp::TraceScope trace("scan", "io");
+    trace.arg("file", filename);
+
+    auto& archive = openArchive(filename);
+
+    uint64_t nFailed = 0;
+    for (uint64_t i = 0; i < archive.nEntries(); ++i)
+    {
+        std::string path = filename + ":" + std::string(archive.name(i));
+
+        try
+        {
+            auto file = archive.file(i);
+
+            Blomp::FileHeader fileHeader;
+            Blomp::BitStream bitStream;
+            readBlockFile(file.data, file.size, fileHeader, bitStream);
+            viewBlockTreeInfo(scanBlockFile(fileHeader, bitStream), path);
+        }
+        catch (std::exception& e)
+        {
+            std::cout << "ERROR: '" << path << "': " << e.what() << std::endl;
+            ++nFailed;
+        }
+    }
+
+    trace.arg("entries", archive.nEntries());
+
+    if (nFailed)
+        throw std::runtime_error("Unable to read " + std::to_string(nFailed) + " damaged files of the archive.");
+}
+
+void saveBlockFile(const Blomp::FileHeader& fileHeader, const Blomp::BitStream& bitStream, const std::string& filename)
+{
+    Blomp::TraceScope trace("save", "io");
+    trace.arg("file", filename);
+    trace.arg("bits", bitStream.size());
+
+    std::ofstream ofStream(filename, std::ios::binary | std::ios::out | std::ios::trunc);
+    if (!ofStream.is_open())
+        throw std::runtime_error("Unable to open blomp file.");
+
+    ofStream << fileHeader;
+    ofStream << bitStream;
+    ofStream.close();
+}
+
+Blomp::FileHeader createFileHeader(const Blomp::ParentBlockRef bt, const Blomp::BlockTreeDesc& btDesc)
+{
+    Blomp::FileHeader fileHeader;
     fileHeader.bd.imgWidth = bt->getWidth();
     fileHeader.bd.imgHeight = bt->getHeight();
-    fileHeader.bd.maxDepth = maxDepth;
+    fileHeader.bd.maxDepth = btDesc.maxDepth;
+    fileHeader.setSplitMode(btDesc.splitMode);
+    fileHeader.setColorMode(btDesc.colorMode);
+    fileHeader.setLeafCoding(btDesc.leafCoding);
+    fileHeader.setLeafShape(btDesc.leafShape);
+    fileHeader.counts = getBlockCounts(bt);
+    return fileHeader;
+}
+
+void serializeBlockTree(const Blomp::ParentBlockRef bt, const Blomp::BlockTreeDesc& btDesc, Blomp::FileHeader& fileHeader, Blomp::BitStream& bitStream)
+{
+    bitStream.reserve(bt->nBits());
+    Blomp::BlockTree::serialize(bt, btDesc, bitStream);
+    fileHeader = createFileHeader(bt, btDesc);
+    fileHeader.counts.nBits = bitStream.size();
+}
+
+void streamBlockTree(const Blomp::ParentBlockRef bt, const Blomp::BlockTreeDesc& btDesc, const std::string& filename)
+{
+    Blomp::TraceScope trace("save", "io");
+    trace.arg("file", filename);
+    trace.arg("streamed", 1);
 
     std::ofstream ofStream(filename, std::ios::binary | std::ios::out | std::ios::trunc);
     if (!ofStream.is_open())
         throw std::runtime_error("Unable to open blomp file.");
 
-    ofStream.write((const char*)&fileHeader, sizeof(fileHeader));
-    ofStream << bitStream;
+    Blomp::FileHeader fileHeader = createFileHeader(bt, btDesc);
+
+    // The header and the bit count are written again once the size is known.
+    uint64_t nBits = 0;
+    ofStream << fileHeader;
+    ofStream.write((const char*)&nBits, sizeof(nBits));
+
+    Blomp::BitStream bitStream;
+    bitStream.setSink(&ofStream);
+    Blomp::BlockTree::serialize(bt, btDesc, bitStream);
+    nBits = bitStream.flushSink();
+    trace.arg("bits", nBits);
+
+    fileHeader.counts.nBits = nBits;
+    ofStream.seekp(0);
+    ofStream << fileHeader;
+    ofStream.write((const char*)&nBits, sizeof(nBits));
+
+    if (!ofStream)
+        throw std::runtime_error("Unable to write blomp file.");
+}
+
+void saveBlockTree(const Blomp::ParentBlockRef bt, const Blomp::BlockTreeDesc& btDesc, const std::string& filename)
+{
+    // Without enough memory for the whole bitstream, the tree is written in chunks.
+    if (!Blomp::MemoryTracker::fits(Blomp::BitStream::minBytes(bt->nBits())))
+        return streamBlockTree(bt, btDesc, filename);
+
+    Blomp::FileHeader fileHeader;
+    Blomp::BitStream bitStream;
+    serializeBlockTree(bt, btDesc, fileHeader, bitStream);
+
+    saveBlockFile(fileHeader, bitStream, filename);
+}
+
+bool parseRect(const std::string& str, Blomp::Rect& rect)
+{
+    char end;
+    if (std::sscanf(str.c_str(), "%d,%d,%d,%d%c", &rect.x, &rect.y, &rect.width, &rect.height, &end) != 4)
+        return false;
+
+    return rect.width > 0 && rect.height > 0;
+}
+
+std::string getFrameFilename(const std::string& filename, int frameID)
+{
+    std::string frameNum = std::to_string(frameID);
+    frameNum.insert(0, frameNum.size() < 4 ? 4 - frameNum.size() : 0, '0');
+
+    auto extPos = filename.find_last_of(".");
+    if (extPos == std::string::npos)
+        return filename + "_" + frameNum;
+
+    return filename.substr(0, extPos) + "_" + frameNum + filename.substr(extPos);
+}
+
+void encodeSequence(const std::vector<std::string>& frameFiles, const Blomp::BlockTreeDesc& btDesc, const std::string& filename, bool verbose)
+{
+    std::ofstream ofStream(filename, std::ios::binary | std::ios::out | std::ios::trunc);
+    if (!ofStream.is_open())
+        throw std::runtime_error("Unable to open blomp sequence file.");
+
+    Blomp::ParentBlockRef prevFrame;
+    for (int frameID = 0; frameID < (int)frameFiles.size(); ++frameID)
+    {
+        Blomp::Image img(frameFiles[frameID]);
+
+        if (frameID == 0)
+        {
+            Blomp::SequenceHeader seqHeader;
+            seqHeader.bd.imgWidth = img.width();
+            seqHeader.bd.imgHeight = img.height();
+            seqHeader.bd.maxDepth = btDesc.maxDepth;
+            seqHeader.splitMode = (int32_t)btDesc.splitMode;
+            ofStream.write((const char*)&seqHeader, sizeof(seqHeader));
+        }
+
+        auto frame = Blomp::BlockTree::fromFrame(img, btDesc, prevFrame);
+
+        Blomp::BitStream bitStream;
+        bitStream.reserve(frame->nBits());
+        Blomp::BlockTree::serialize(frame, bitStream);
+        ofStream << bitStream;
+
+        if (verbose)
+        {
+            std::cout << "Frame " << frameID << " ('" << frameFiles[frameID] << "'): ";
+            std::cout << frame->nCopiedTiles() << "/" << frame->subBlocks().size() << " tiles copied, ";
+            std::cout << (sizeof(uint64_t) + Blomp::BitStream::minBytes(frame->nBits())) << " bytes" << std::endl;
+        }
+
+        prevFrame = frame;
+    }
+
     ofStream.close();
 }
 
+void decodeSequence(const std::string& filename, const std::string& outFile, bool verbose)
+{
+    std::ifstream ifStream(filename, std::ios::binary | std::ios::in);
+    if (!ifStream.is_open())
+        throw std::runtime_error("Unable to open blomp sequence file.");
+
+    Blomp::SequenceHeader seqHeader;
+    ifStream.read((char*)&seqHeader, sizeof(seqHeader));
+    if (!ifStream || !seqHeader.isValid() || !Blomp::BlockTree::isValid(seqHeader.bd))
+        throw std::runtime_error("Invalid blomp sequence header.");
+
+    Blomp::BufferDesc bufDesc;
+    bufDesc.width = seqHeader.bd.imgWidth;
+    bufDesc.height = seqHeader.bd.imgHeight;
+    bufDesc.nChannels = 3;
+    bufDesc.stride = bufDesc.width * bufDesc.nChannels;
+
+    PixelData data((uint64_t)bufDesc.stride * bufDesc.height);
+    bufDesc.data = data.data();
+
+    Blomp::BitStream bitStream;
+    for (int frameID = 0; ifStream.peek() != EOF; ++frameID)
+    {
+        ifStream >> bitStream;
+        if (!ifStream)
+            throw std::runtime_error("Unable to read damaged blomp sequence file.");
+
+        auto counts = Blomp::BlockTree::decodeFrameToBuffer(seqHeader.bd, (Blomp::SplitMode)seqHeader.splitMode, bitStream, bufDesc, frameID > 0);
+
+        std::string frameFile = getFrameFilename(outFile, frameID);
+        Blomp::saveImageData(frameFile, bufDesc);
+
+        if (verbose)
+            std::cout << "Frame " << frameID << " -> '" << frameFile << "': " << counts.nColorBlocks << " ColorBlocks decoded" << std::endl;
+    }
+}
+
+void applyColorMode(Blomp::Image& img, Blomp::BlockTreeDesc& btDesc, bool autoColorMode)
+{
+    if (autoColorMode)
+        btDesc.colorMode = img.isGray() ? Blomp::ColorMode::Gray : Blomp::ColorMode::RGB;
+    else if (btDesc.colorMode == Blomp::ColorMode::Gray)
+        img.toGray();
+}
+
+void requireColorMode(const std::string& mode, const Blomp::BlockTreeDesc& btDesc)
+{
+    if (btDesc.colorMode == Blomp::ColorMode::YCbCr)
+        throw std::runtime_error("Mode '" + mode + "' doesn't support the 'ycbcr' color mode.");
+}
+
+Blomp::ParentBlockRef encodeImage(const Blomp::Image& img, const Blomp::BlockTreeDesc& btDesc, const Blomp::BlockTreeDesc& chromaDesc)
+{
+    if (btDesc.colorMode == Blomp::ColorMode::YCbCr)
+        return Blomp::BlockTree::fromImage(img, btDesc, chromaDesc);
+
+    return Blomp::BlockTree::fromImage(img, btDesc);
+}
+
+void writeBlockTreeToImg(const Blomp::ParentBlockRef bt, Blomp::Image& img)
+{
+    Blomp::TraceScope trace("write", "io");
+    trace.arg("blocks", bt->nBlocks());
+
+    bt->writeToImg(img);
+}
+
 Blomp::Image loadImage(const std::string& filename)
 {
-    if (!Blomp::endswith(filename, ".blp"))
+    // Archives only hold blomp files.
+    if (!Blomp::endswith(filename, ".blp") && !isArchivePath(filename))
         return Blomp::Image(filename);
 
     auto bt = loadBlockTree(filename);
 
     Blomp::Image img = Blomp::Image(bt->getWidth(), bt->getHeight());
-    bt->writeToImg(img);
+    writeBlockTreeToImg(bt, img);
 
     return img;
 }
 
-Blomp::ParentBlockRef calcMaxV(const Blomp::Image& img, Blomp::BlockTreeDesc& btDesc, bool (targetFunc)(const Blomp::Image&, const Blomp::ParentBlockRef, uint64_t target), uint64_t targetValue, int nIterations, int& nIterationsUsed, bool verbose)
+struct BatchJob
+{
+    std::string inFile;
+    std::string outFile;
+    // Holds the input file until it is encoded or decoded, the output file afterwards.
+    Blomp::FileData data;
+    // Archive entries are decoded in place instead of being read.
+    Blomp::ArchiveFile archived;
+    Blomp::BlockCounts counts;
+    std::string error;
+};
+
+Blomp::FileData readFileData(const std::string& filename)
+{
+    Blomp::TraceScope trace("load", "io");
+    trace.arg("file", filename);
+
+    std::ifstream ifStream(filename, std::ios::binary | std::ios::in | std::ios::ate);
+    if (!ifStream.is_open())
+        throw std::runtime_error("Unable to open input file.");
+
+    Blomp::FileData data((uint64_t)ifStream.tellg());
+    ifStream.seekg(0);
+    if (!ifStream.read((char*)data.data(), data.size()))
+        throw std::runtime_error("Unable to read input file.");
+
+    return data;
+}
+
+void writeFileData(const std::string& filename, const uint8_t* data, uint64_t size)
+{
+    Blomp::TraceScope trace("save", "io");
+    trace.arg("file", filename);
+    trace.arg("bytes", size);
+
+    std::ofstream ofStream(filename, std::ios::binary | std::ios::out | std::ios::trunc);
+    if (!ofStream.is_open())
+        throw std::runtime_error("Unable to open output file.");
+
+    if (!ofStream.write((const char*)data, size))
+        throw std::runtime_error("Unable to write output file.");
+}
+
+void writeFileData(const std::string& filename, const Blomp::FileData& data)
+{
+    writeFileData(filename, data.data(), data.size());
+}
+
+int runBatch(const std::string& mode, const std::vector<std::string>& inFiles, const Blomp::BlockTreeDesc& btDesc, const Blomp::BlockTreeDesc& chromaDesc, bool autoColorMode, int nJobs, bool verbose)
+{
+    std::vector<BatchJob> jobs(inFiles.size());
+    for (size_t i = 0; i < inFiles.size(); ++i)
+    {
+        jobs[i].inFile = inFiles[i];
+        jobs[i].outFile = removeExtension(inFiles[i]) + (mode == "enc" ? ".blp" : ".png");
+    }
+
+    Blomp::PipelineStage<BatchJob> read = [](BatchJob& job)
+    {
+        if (isArchivePath(job.inFile))
+            job.archived = findArchiveFile(job.inFile);
+        else
+            job.data = readFileData(job.inFile);
+    };
+
+    Blomp::PipelineStage<BatchJob> encode = [&](BatchJob& job)
+    {
+        Blomp::BlockTreeDesc jobDesc = btDesc;
+        Blomp::ParentBlockRef bt;
+        {
+            Blomp::Image img(job.data.data(), job.data.size());
+            job.data = Blomp::FileData();
+
+            applyColorMode(img, jobDesc, autoColorMode);
+            bt = encodeImage(img, jobDesc, chromaDesc);
+        }
+
+        Blomp::FileHeader fileHeader;
+        Blomp::BitStream bitStream;
+        serializeBlockTree(bt, jobDesc, fileHeader, bitStream);
+        job.counts = fileHeader.counts;
+
+        std::ostringstream oStream(std::ios::binary | std::ios::out);
+        oStream << fileHeader << bitStream;
+        std::string fileData = oStream.str();
+        job.data.assign(fileData.begin(), fileData.end());
+    };
+
+    Blomp::PipelineStage<BatchJob> decode = [](BatchJob& job)
+    {
+        if (Blomp::endswith(job.inFile, ".bls"))
+            throw std::runtime_error("Blomp sequence files can't be decoded in a batch.");
+
+        Blomp::ArchiveFile file = job.archived;
+        if (!file.data)
+        {
+            file.data = job.data.data();
+            file.size = job.data.size();
+        }
+
+        Blomp::FileHeader fileHeader;
+        Blomp::BitStream bitStream;
+        readBlockFile(file.data, file.size, fileHeader, bitStream);
+
+        Blomp::BufferDesc bufDesc;
+        bufDesc.width = fileHeader.bd.imgWidth;
+        bufDesc.height = fileHeader.bd.imgHeight;
+        bufDesc.nChannels = 3;
+        bufDesc.stride = bufDesc.width * bufDesc.nChannels;
+
+        PixelData pixels((uint64_t)bufDesc.stride * bufDesc.height);
+        bufDesc.data = pixels.data();
+
+        job.counts = Blomp::BlockTree::decodeToBuffer(fileHeader.bd, fileHeader.splitMode(), fileHeader.colorMode(), fileHeader.leafCoding(), fileHeader.leafShape(), bitStream, bufDesc);
+        bitStream = Blomp::BitStream();
+        job.data = Blomp::encodeImageData(job.outFile, bufDesc);
+    };
+
+    Blomp::PipelineStage<BatchJob> write = [](BatchJob& job)
+    {
+        writeFileData(job.outFile, job.data);
+        job.data = Blomp::FileData();
+    };
+
+    int nFailed = 0;
+    Blomp::PipelineStage<BatchJob> report = [&](BatchJob& job)
+    {
+        if (!job.error.empty())
+        {
+            std::cout << "ERROR: '" << job.inFile << "': " << job.error << std::endl;
+            ++nFailed;
+        }
+        else if (verbose)
+            viewBlockTreeInfo(job.counts, mode == "enc" ? job.outFile : job.inFile);
+    };
+
+    // Two jobs per worker keep every worker busy while the reader and the writer catch up.
+    Blomp::PipelineDesc pipelineDesc;
+    pipelineDesc.nWorkers = nJobs;
+    pipelineDesc.queueCapacity = nJobs * 2;
+
+    Blomp::runPipeline<BatchJob>(jobs, pipelineDesc, read, mode == "enc" ? encode : decode, write, report);
+
+    return nFailed == 0 ? 0 : 1;
+}
+
+Blomp::ParentBlockRef calcMaxV(const Blomp::StatsPyramid& pyramid, Blomp::BlockTreeDesc& btDesc, bool (targetFunc)(const Blomp::Image&, const Blomp::ParentBlockRef, const Blomp::BlockTreeDesc&, uint64_t target), uint64_t targetValue, int nIterations, int& nIterationsUsed, bool verbose)
 {
     Blomp::ParentBlockRef bt;
     btDesc.variationThreshold = 2.0f;
@@ -111,6 +805,9 @@ Blomp::ParentBlockRef calcMaxV(const Blomp::Image& img, Blomp::BlockTreeDesc& bt
     {
         ++nIterationsUsed;
 
+        Blomp::TraceScope trace("maxv iteration", "build");
+        trace.arg("iteration", i + 1);
+
         if (verbose)
             std::cout << "Iteration " << (i + 1) << "/" << nIterations << "  ->  ";
 
@@ -121,9 +818,14 @@ Blomp::ParentBlockRef calcMaxV(const Blomp::Image& img, Blomp::BlockTreeDesc& bt
         else
             btDesc.variationThreshold += thresChange;
 
-        bt = Blomp::BlockTree::fromImage(img, btDesc);
+        bt = Blomp::BlockTree::fromImage(pyramid, btDesc);
+
+        bool comparison = targetFunc(pyramid.image(), bt, btDesc, targetValue); //sizeComp = calcEstFileSize(bt);
 
-        bool comparison = targetFunc(img, bt, targetValue); //sizeComp = calcEstFileSize(bt);
+        trace.arg("threshold", (double)btDesc.variationThreshold);
+        trace.arg("depth", btDesc.maxDepth);
+        trace.arg("blocks", bt->nBlocks());
+        trace.arg("bits", bt->nBits());
 
         if (verbose)
             std::cout << "v:" << btDesc.variationThreshold << "  LastComp: " << (lastComparison ? "true" : "false") << std::endl;
@@ -145,6 +847,105 @@ Blomp::ParentBlockRef calcMaxV(const Blomp::Image& img, Blomp::BlockTreeDesc& bt
     return bt;
 }
 
+std::string formatChannels(const double* values)
+{
+    std::ostringstream oss;
+    oss << "R " << values[0] << ", G " << values[1] << ", B " << values[2];
+    return oss.str();
+}
+
+void viewCompResults(const Blomp::ImageMetrics& metrics, float dataRatio, const std::string& compFile, const std::string& inFile)
+{
+    std::cout << "Comp Results ('" << compFile << "' vs. '" << inFile << "'):" << std::endl;
+    std::cout << "  Similarity: " << metrics.similarity << std::endl;
+    std::cout << "  Data ratio: " << dataRatio << std::endl;
+    std::cout << "  Score:      " << (metrics.similarity / dataRatio) << std::endl;
+    std::cout << "  MSE:        " << metrics.mse << " (" << formatChannels(metrics.channelMse) << ")" << std::endl;
+    std::cout << "  PSNR:       " << metrics.psnr << " dB (" << formatChannels(metrics.channelPsnr) << ")" << std::endl;
+    std::cout << "  SSIM:       " << metrics.ssim << " (" << formatChannels(metrics.channelSsim) << ")" << std::endl;
+}
+
+// JSON has no infinity, the PSNR of identical images is written as null.
+std::string formatJsonNumber(double value)
+{
+    if (!std::isfinite(value))
+        return "null";
+
+    std::ostringstream oss;
+    oss << std::setprecision(10) << value;
+    return oss.str();
+}
+
+void writeCompResultsJson(const Blomp::ImageMetrics& metrics, float dataRatio, const std::string& compFile, const std::string& inFile)
+{
+    std::cout << "{\"reference\":\"" << Blomp::escapeJson(compFile) << "\""
+        << ",\"file\":\"" << Blomp::escapeJson(inFile) << "\""
+        << ",\"similarity\":" << formatJsonNumber(metrics.similarity)
+        << ",\"dataRatio\":" << formatJsonNumber(dataRatio)
+        << ",\"score\":" << formatJsonNumber(metrics.similarity / dataRatio)
+        << ",\"mse\":" << formatJsonNumber(metrics.mse)
+        << ",\"psnr\":" << formatJsonNumber(metrics.psnr)
+        << ",\"ssim\":" << formatJsonNumber(metrics.ssim)
+        << ",\"channels\":[";
+
+    for (int c = 0; c < 3; ++c)
+    {
+        std::cout << (c ? "," : "")
+            << "{\"mse\":" << formatJsonNumber(metrics.channelMse[c])
+            << ",\"psnr\":" << formatJsonNumber(metrics.channelPsnr[c])
+            << ",\"ssim\":" << formatJsonNumber(metrics.channelSsim[c]) << "}";
+    }
+
+    std::cout << "],\"tileSize\":" << metrics.tileSize
+        << ",\"tilesX\":" << metrics.nTilesX
+        << ",\"tilesY\":" << metrics.nTilesY
+        << ",\"tileMse\":[";
+    for (size_t i = 0; i < metrics.tileMse.size(); ++i)
+        std::cout << (i ? "," : "") << formatJsonNumber(metrics.tileMse[i]);
+    std::cout << "],\"tileSsim\":[";
+    for (size_t i = 0; i < metrics.tileSsim.size(); ++i)
+        std::cout << (i ? "," : "") << formatJsonNumber(metrics.tileSsim[i]);
+    std::cout << "]}" << std::endl;
+}
+
+void saveErrorMap(const Blomp::ImageMetrics& metrics, int width, int height, const std::string& filename)
+{
+    // Brightness follows the RMSE of a tile relative to the worst tile.
+    double maxMse = 0.0;
+    for (double mse : metrics.tileMse)
+        maxMse = std::max(maxMse, mse);
+
+    Blomp::Image map(width, height);
+    for (int y = 0; y < height; ++y)
+    {
+        for (int x = 0; x < width; ++x)
+        {
+            double mse = metrics.tileMse[(y / metrics.tileSize) * metrics.nTilesX + x / metrics.tileSize];
+            map.getNC(x, y) = Blomp::Color::fromPixel(maxMse > 0.0 ? (float)std::sqrt(mse / maxMse) : 0.0f);
+        }
+    }
+
+    map.save(filename);
+}
+
+// Everything but the mode specific target parameters, which are added by the modes.
+Blomp::CacheKey createCacheKey(const std::string& mode, const Blomp::Image& img, const Blomp::BlockTreeDesc& btDesc, const Blomp::BlockTreeDesc& chromaDesc)
+{
+    Blomp::CacheKey key;
+    key.add((int64_t)Blomp::FileHeader::CURRENT_VERSION);
+    key.add(mode);
+    key.add(img);
+    key.add(btDesc);
+    if (btDesc.colorMode == Blomp::ColorMode::YCbCr)
+        key.add(chromaDesc);
+    return key;
+}
+
+void viewCacheHit(const std::string& inFile)
+{
+    std::cout << "Using cached result for '" << inFile << "'." << std::endl;
+}
+
 float calcImgCompScore(const Blomp::Image& img1, const Blomp::Image& img2, uint64_t img1Size, uint64_t img2Size, float* pSimilarity = nullptr, float* pDataRatio = nullptr)
 {
     float temp1, temp2;
@@ -156,15 +957,15 @@ float calcImgCompScore(const Blomp::Image& img1, const Blomp::Image& img2, uint6
     return *pSimilarity / *pDataRatio;
 }
 
-bool targetSizeFunc(const Blomp::Image& img, const Blomp::ParentBlockRef bt, uint64_t value)
+bool targetSizeFunc(const Blomp::Image& img, const Blomp::ParentBlockRef bt, const Blomp::BlockTreeDesc& btDesc, uint64_t value)
 {
-    return calcEstFileSize(bt) < value;
+    return calcEstFileSize(getBlockCounts(bt, btDesc)) < value;
 }
 
-bool targetSimilarityFunc(const Blomp::Image& img, const Blomp::ParentBlockRef bt, uint64_t value)
+bool targetSimilarityFunc(const Blomp::Image& img, const Blomp::ParentBlockRef bt, const Blomp::BlockTreeDesc& /*btDesc*/, uint64_t value)
 {
     Blomp::Image btImg(img.width(), img.height());
-    bt->writeToImg(btImg);
+    writeBlockTreeToImg(bt, btImg);
     float similarity = Blomp::compareImages(img, btImg);
     return similarity < (float)value / 1000;
 }
@@ -174,15 +975,29 @@ int main(int argc, const char** argv, const char** env)
     Blomp::BlockTreeDesc btDesc;
     btDesc.maxDepth = 4;
     btDesc.variationThreshold = 0.02f;
+    Blomp::BlockTreeDesc chromaDesc;
+    chromaDesc.maxDepth = -1;
+    chromaDesc.variationThreshold = -1.0f;
     std::string inFile = "";
+    std::vector<std::string> inFiles;
+    std::string baseFile = "";
+    std::vector<Blomp::Rect> dirtyRects;
     std::string outFile = "";
     std::string heatmapFile = "";
     std::string compFile = "";
     std::string genFile = "";
     int maxvIterations = 10;
     bool beQuiet = false;
+    bool autoColorMode = true;
     std::string targetName = "size";
     uint64_t targetValue = 0;
+    float rdLambda = -1.0f;
+    int nJobs = 0;
+    std::string traceFile = "";
+    std::string cacheDir = "";
+    uint64_t cacheMiB = 1024;
+    bool detailedInfo = false;
+    std::string reportFormat = "text";
 
     if (argc < 2)
     {
@@ -204,112 +1019,346 @@ int main(int argc, const char** argv, const char** env)
         std::string arg = argv[i];
         bool invalidValue = false;
 
-        if (arg == "-d" || arg == "--depth")
+        if (arg == "-d" || arg == "--depth")
+        {
+            ++i;
+            if (i >= argc)
+                RETURN_MISSING_VALUE(arg);
+
+            try 
+            {
+                btDesc.maxDepth = std::stoi(argv[i]);
+
+                if (btDesc.maxDepth < 0 || 10 < btDesc.maxDepth)
+                    invalidValue = true;
+            }
+            catch (std::exception e)
+            {
+                invalidValue = true;
+            }
+        }
+        else if (arg == "-v" || arg == "--variation")
+        {
+            ++i;
+            if (i >= argc)
+                RETURN_MISSING_VALUE(arg);
+            try 
+            {
+                btDesc.variationThreshold = std::stof(argv[i]);
+
+                if (btDesc.variationThreshold < 0.0f || 1.0f < btDesc.variationThreshold)
+                    invalidValue = true;
+            }
+            catch (std::exception e)
+            {
+                invalidValue = true;
+            }
+        }
+        else if (arg == "-D" || arg == "--chroma-depth")
+        {
+            ++i;
+            if (i >= argc)
+                RETURN_MISSING_VALUE(arg);
+
+            try
+            {
+                chromaDesc.maxDepth = std::stoi(argv[i]);
+
+                if (chromaDesc.maxDepth < 0 || 10 < chromaDesc.maxDepth)
+                    invalidValue = true;
+            }
+            catch (const std::exception&)
+            {
+                invalidValue = true;
+            }
+        }
+        else if (arg == "-V" || arg == "--chroma-variation")
+        {
+            ++i;
+            if (i >= argc)
+                RETURN_MISSING_VALUE(arg);
+
+            try
+            {
+                chromaDesc.variationThreshold = std::stof(argv[i]);
+
+                if (chromaDesc.variationThreshold < 0.0f || 1.0f < chromaDesc.variationThreshold)
+                    invalidValue = true;
+            }
+            catch (const std::exception&)
+            {
+                invalidValue = true;
+            }
+        }
+        else if (arg == "-o" || arg == "--output")
+        {
+            ++i;
+            if (i >= argc)
+                RETURN_MISSING_VALUE(arg);
+
+            outFile = argv[i];
+        }
+        else if (arg == "-m" || arg == "--heatmap")
+        {
+            ++i;
+            if (i >= argc)
+                RETURN_MISSING_VALUE(arg);
+            
+            heatmapFile = argv[i];
+        }
+        else if (arg == "-i" || arg == "--iterations")
+        {
+            ++i;
+            if (i >= argc)
+                RETURN_MISSING_VALUE(arg);
+
+            try 
+            {
+                maxvIterations = std::stoi(argv[i]);
+
+                if (maxvIterations < 0)
+                    invalidValue = true;
+            }
+            catch (std::exception e)
+            {
+                invalidValue = true;
+            }
+        }
+        else if (arg == "-c" || arg == "--compfile")
+        {
+            ++i;
+            if (i >= argc)
+                RETURN_MISSING_VALUE(arg);
+
+            compFile = argv[i];
+        }
+        else if (arg == "-x" || arg == "--target")
+        {
+            if (i + 2 >= argc)
+                RETURN_MISSING_VALUE(arg);
+
+            targetName = argv[++i];
+
+            try
+            {
+                targetValue = std::stoi(argv[++i]);
+
+                if (targetName == "size" && targetValue < 1)
+                    invalidValue = true;
+                else if (targetName == "similarity" && targetValue > 1000)
+                    invalidValue = true;
+            }
+            catch (std::exception e)
+            {
+                invalidValue = true;
+            }
+        }
+        else if (arg == "-g" || arg == "--genoutput")
+        {
+            ++i;
+            if (i >= argc)
+                RETURN_MISSING_VALUE(arg);
+           
+            genFile = argv[i];
+        }
+        else if (arg == "-s" || arg == "--split")
+        {
+            ++i;
+            if (i >= argc)
+                RETURN_MISSING_VALUE(arg);
+
+            std::string splitName = argv[i];
+            if (splitName == "quad")
+                btDesc.splitMode = Blomp::SplitMode::Quad;
+            else if (splitName == "binary")
+                btDesc.splitMode = Blomp::SplitMode::Binary;
+            else
+                invalidValue = true;
+        }
+        else if (arg == "-y" || arg == "--color")
+        {
+            ++i;
+            if (i >= argc)
+                RETURN_MISSING_VALUE(arg);
+
+            std::string colorName = argv[i];
+            autoColorMode = colorName == "auto";
+            if (colorName == "rgb")
+                btDesc.colorMode = Blomp::ColorMode::RGB;
+            else if (colorName == "gray")
+                btDesc.colorMode = Blomp::ColorMode::Gray;
+            else if (colorName == "ycbcr")
+                btDesc.colorMode = Blomp::ColorMode::YCbCr;
+            else if (!autoColorMode)
+                invalidValue = true;
+        }
+        else if (arg == "-p" || arg == "--palette")
+        {
+            ++i;
+            if (i >= argc)
+                RETURN_MISSING_VALUE(arg);
+
+            std::string paletteName = argv[i];
+            if (paletteName == "none")
+                btDesc.leafCoding = Blomp::LeafCoding::Literal;
+            else if (paletteName == "mtf")
+                btDesc.leafCoding = Blomp::LeafCoding::Cache;
+            else
+                invalidValue = true;
+        }
+        else if (arg == "-a" || arg == "--leaf-shape")
+        {
+            ++i;
+            if (i >= argc)
+                RETURN_MISSING_VALUE(arg);
+
+            std::string shapeName = argv[i];
+            if (shapeName == "flat")
+                btDesc.leafShape = Blomp::LeafShape::Flat;
+            else if (shapeName == "gradient")
+                btDesc.leafShape = Blomp::LeafShape::Gradient;
+            else
+                invalidValue = true;
+        }
+        else if (arg == "-b" || arg == "--base")
+        {
+            ++i;
+            if (i >= argc)
+                RETURN_MISSING_VALUE(arg);
+
+            baseFile = argv[i];
+        }
+        else if (arg == "-r" || arg == "--rect")
+        {
+            ++i;
+            if (i >= argc)
+                RETURN_MISSING_VALUE(arg);
+
+            Blomp::Rect rect;
+            if (parseRect(argv[i], rect))
+                dirtyRects.push_back(rect);
+            else
+                invalidValue = true;
+        }
+        else if (arg == "-l" || arg == "--lambda")
+        {
+            ++i;
+            if (i >= argc)
+                RETURN_MISSING_VALUE(arg);
+
+            try
+            {
+                rdLambda = std::stof(argv[i]);
+
+                if (rdLambda < 0.0f)
+                    invalidValue = true;
+            }
+            catch (const std::exception&)
+            {
+                invalidValue = true;
+            }
+        }
+        else if (arg == "-j" || arg == "--jobs")
         {
             ++i;
             if (i >= argc)
                 RETURN_MISSING_VALUE(arg);
 
-            try 
+            try
             {
-                btDesc.maxDepth = std::stoi(argv[i]);
+                nJobs = std::stoi(argv[i]);
 
-                if (btDesc.maxDepth < 0 || 10 < btDesc.maxDepth)
+                if (nJobs < 1)
                     invalidValue = true;
             }
-            catch (std::exception e)
+            catch (const std::exception&)
             {
                 invalidValue = true;
             }
         }
-        else if (arg == "-v" || arg == "--variation")
+        else if (arg == "-M" || arg == "--max-memory")
         {
             ++i;
             if (i >= argc)
                 RETURN_MISSING_VALUE(arg);
-            try 
+
+            try
             {
-                btDesc.variationThreshold = std::stof(argv[i]);
+                uint64_t maxMiB = std::stoull(argv[i]);
 
-                if (btDesc.variationThreshold < 0.0f || 1.0f < btDesc.variationThreshold)
+                if (maxMiB < 1 || maxMiB > (Blomp::MemoryTracker::UNLIMITED >> 20))
                     invalidValue = true;
+                else
+                    Blomp::MemoryTracker::setBudget(maxMiB << 20);
             }
-            catch (std::exception e)
+            catch (const std::exception&)
             {
                 invalidValue = true;
             }
         }
-        else if (arg == "-o" || arg == "--output")
+        else if (arg == "-L" || arg == "--layout")
         {
             ++i;
             if (i >= argc)
                 RETURN_MISSING_VALUE(arg);
 
-            outFile = argv[i];
+            std::string layoutName = argv[i];
+            if (layoutName == "rows")
+                Blomp::Image::setDefaultLayout(Blomp::ImageLayout::Rows);
+            else if (layoutName == "tiles")
+                Blomp::Image::setDefaultLayout(Blomp::ImageLayout::Tiles);
+            else
+                invalidValue = true;
         }
-        else if (arg == "-m" || arg == "--heatmap")
+        else if (arg == "-e" || arg == "--detailed")
+        {
+            detailedInfo = true;
+        }
+        else if (arg == "-f" || arg == "--format")
         {
             ++i;
             if (i >= argc)
                 RETURN_MISSING_VALUE(arg);
-            
-            heatmapFile = argv[i];
+
+            reportFormat = argv[i];
+            if (reportFormat != "text" && reportFormat != "json")
+                invalidValue = true;
         }
-        else if (arg == "-i" || arg == "--iterations")
+        else if (arg == "-t" || arg == "--trace")
         {
             ++i;
             if (i >= argc)
                 RETURN_MISSING_VALUE(arg);
 
-            try 
-            {
-                maxvIterations = std::stoi(argv[i]);
-
-                if (maxvIterations < 0)
-                    invalidValue = true;
-            }
-            catch (std::exception e)
-            {
-                invalidValue = true;
-            }
+            traceFile = argv[i];
+            Blomp::Trace::enable();
         }
-        else if (arg == "-c" || arg == "--compfile")
+        else if (arg == "-C" || arg == "--cache")
         {
             ++i;
             if (i >= argc)
                 RETURN_MISSING_VALUE(arg);
 
-            compFile = argv[i];
+            cacheDir = argv[i];
         }
-        else if (arg == "-x" || arg == "--target")
+        else if (arg == "-S" || arg == "--cache-size")
         {
-            if (i + 2 >= argc)
+            ++i;
+            if (i >= argc)
                 RETURN_MISSING_VALUE(arg);
 
-            targetName = argv[++i];
-
             try
             {
-                targetValue = std::stoi(argv[++i]);
+                cacheMiB = std::stoull(argv[i]);
 
-                if (targetName == "size" && targetValue < 1)
-                    invalidValue = true;
-                else if (targetName == "similarity" && targetValue > 1000)
+                if (cacheMiB < 1 || cacheMiB > (UINT64_MAX >> 20))
                     invalidValue = true;
             }
-            catch (std::exception e)
+            catch (const std::exception&)
             {
                 invalidValue = true;
             }
         }
-        else if (arg == "-g" || arg == "--genoutput")
-        {
-            ++i;
-            if (i >= argc)
-                RETURN_MISSING_VALUE(arg);
-           
-            genFile = argv[i];
-        }
         else if (arg == "-q" || arg == "--quiet")
         {
             beQuiet = true;
@@ -317,6 +1366,7 @@ int main(int argc, const char** argv, const char** env)
         else
         {
             inFile = arg;
+            inFiles.push_back(arg);
         }
 
         if (invalidValue)
@@ -332,6 +1382,40 @@ int main(int argc, const char** argv, const char** env)
         return 1;
     }
 
+    if (chromaDesc.maxDepth < 0)
+        chromaDesc.maxDepth = btDesc.maxDepth;
+    if (chromaDesc.variationThreshold < 0.0f)
+        chromaDesc.variationThreshold = btDesc.variationThreshold;
+    chromaDesc.splitMode = btDesc.splitMode;
+    chromaDesc.leafCoding = btDesc.leafCoding;
+    chromaDesc.leafShape = btDesc.leafShape;
+
+    if ((mode == "enc" || mode == "dec") && inFiles.size() > 1)
+    {
+        if (!outFile.empty() || !heatmapFile.empty() || !genFile.empty() || !cacheDir.empty())
+        {
+            std::cout << "Options '-o', '-m', '-g' and '-C' can't be used with multiple input files." << std::endl;
+            return 1;
+        }
+
+        if (nJobs == 0)
+            nJobs = std::max(1, (int)std::thread::hardware_concurrency());
+
+        try
+        {
+            int result = runBatch(mode, inFiles, btDesc, chromaDesc, autoColorMode, nJobs, !beQuiet);
+            if (!beQuiet)
+                viewMemoryInfo();
+            return saveTrace(traceFile) ? result : 1;
+        }
+        catch (std::exception& e)
+        {
+            std::cout << "ERROR: " << e.what() << std::endl;
+            saveTrace(traceFile);
+            return 1;
+        }
+    }
+
 
     while (true)
     {
@@ -361,22 +1445,56 @@ int main(int argc, const char** argv, const char** env)
             if (genFile == "+")
                 genExt = "_OPTI.png";
         }
+        else if (mode == "rdo")
+        {
+            outExt = ".blp";
+            if (genFile == "+")
+                genExt = "_RDO.png";
+        }
+        else if (mode == "upd")
+            outExt = ".blp";
+        else if (mode == "seq")
+        {
+            if (outFile.empty())
+                outFile = removeExtension(inFiles.front()) + ".bls";
+        }
+        else if (mode == "pack")
+        {
+            if (outFile.empty())
+                outFile = removeExtension(inFiles.front()) + ".bla";
+        }
+        else if (mode == "unpack")
+        {
+            if (outFile.empty())
+                outFile = removeExtension(inFile);
+        }
+        else if (mode == "get")
+        {
+            std::string archiveFile;
+            std::string name;
+            if (outFile.empty() && splitArchivePath(inFile, archiveFile, name))
+                outFile = name;
+        }
         else if (mode == "info")
             break;
         else
             break;
 
         if (!outExt.empty() && outFile.empty())
-            outFile = inFile.substr(0, inFile.find_last_of(".")) + outExt;
+            outFile = removeExtension(inFile) + outExt;
         
         if (!genExt.empty() && genFile == "+")
-            genFile = inFile.substr(0, inFile.find_last_of(".")) + genExt;
+            genFile = removeExtension(inFile) + genExt;
 
         break;
     }
 
+    // Nothing else may be written next to a JSON report.
+    if (reportFormat == "json" && (mode == "comp" || (mode == "info" && detailedInfo)))
+        beQuiet = true;
+
     if (heatmapFile == "+")
-        heatmapFile = inFile.substr(0, inFile.find_last_of(".")) + "_HEAT.png";
+        heatmapFile = removeExtension(inFile) + "_HEAT.png";
     
     // std::cout << "Mode:      " << mode << std::endl;
     // std::cout << "MaxDepth:  " << btDesc.maxDepth << std::endl;
@@ -395,37 +1513,104 @@ int main(int argc, const char** argv, const char** env)
         if (inFile.empty())
             throw std::runtime_error("Missing input file.");
 
+        std::unique_ptr<Blomp::ResultCache> pCache;
+        if (!cacheDir.empty() && (mode == "enc" || mode == "maxv" || mode == "opti"))
+            pCache.reset(new Blomp::ResultCache(cacheDir, cacheMiB << 20));
+        Blomp::CacheEntry cacheEntry;
+
         if (mode == "enc")
         {
             if (outFile.empty())
                 throw std::runtime_error("Missing output file.");
 
-            Blomp::Image img(inFile);
-            auto bt = Blomp::BlockTree::fromImage(img, btDesc);
+            // The source pixels are released before the tree gets serialized.
+            Blomp::ParentBlockRef bt;
+            Blomp::CacheKey cacheKey;
+            bool isCached = false;
+            {
+                Blomp::Image img(inFile);
+                applyColorMode(img, btDesc, autoColorMode);
+                if (pCache)
+                {
+                    cacheKey = createCacheKey(mode, img, btDesc, chromaDesc);
+                    isCached = pCache->load(cacheKey, outFile, cacheEntry);
+                }
+                if (!isCached)
+                    bt = encodeImage(img, btDesc, chromaDesc);
+            }
 
-            if (!beQuiet)
-                viewBlockTreeInfo(bt, outFile);
+            if (isCached)
+            {
+                if (!beQuiet)
+                {
+                    viewCacheHit(inFile);
+                    viewBlockTreeInfo(cacheEntry.counts, outFile);
+                }
+            }
+            else
+            {
+                if (!beQuiet || pCache)
+                    cacheEntry.counts = getBlockCounts(bt, btDesc);
+                if (!beQuiet)
+                    viewBlockTreeInfo(cacheEntry.counts, outFile);
 
-            saveBlockTree(bt, btDesc.maxDepth, outFile);
+                saveBlockTree(bt, btDesc, outFile);
 
-            autoGenSaveHeatmap(bt, img, heatmapFile);
+                if (pCache)
+                {
+                    cacheEntry.maxDepth = btDesc.maxDepth;
+                    cacheEntry.variationThreshold = btDesc.variationThreshold;
+                    pCache->store(cacheKey, outFile, cacheEntry);
+                }
+            }
+
+            if (!heatmapFile.empty())
+            {
+                if (isCached)
+                    bt = loadBlockTree(outFile);
+                Blomp::Image img(bt->getWidth(), bt->getHeight());
+                autoGenSaveHeatmap(bt, img, heatmapFile);
+            }
         }
         else if (mode == "dec")
         {
             if (outFile.empty())
                 throw std::runtime_error("Missing output file.");
 
-            auto bt = loadBlockTree(inFile);
+            if (Blomp::endswith(inFile, ".bls"))
+            {
+                decodeSequence(inFile, outFile, !beQuiet);
+            }
+            else
+            {
+                Blomp::FileHeader fileHeader;
+                Blomp::BitStream bitStream;
+                loadBlockFile(inFile, fileHeader, bitStream);
+
+                Blomp::BufferDesc bufDesc;
+                bufDesc.width = fileHeader.bd.imgWidth;
+                bufDesc.height = fileHeader.bd.imgHeight;
+                bufDesc.nChannels = 3;
+                bufDesc.stride = bufDesc.width * bufDesc.nChannels;
 
-            if (!beQuiet)
-                viewBlockTreeInfo(bt, inFile);
+                PixelData data((uint64_t)bufDesc.stride * bufDesc.height);
+                bufDesc.data = data.data();
 
-            Blomp::Image img(bt->getWidth(), bt->getHeight());
+                auto counts = Blomp::BlockTree::decodeToBuffer(fileHeader.bd, fileHeader.splitMode(), fileHeader.colorMode(), fileHeader.leafCoding(), fileHeader.leafShape(), bitStream, bufDesc);
+                bitStream = Blomp::BitStream();
 
-            bt->writeToImg(img);
-            img.save(outFile);
+                if (!beQuiet)
+                    viewBlockTreeInfo(counts, inFile);
 
-            autoGenSaveHeatmap(bt, img, heatmapFile);
+                Blomp::saveImageData(outFile, bufDesc);
+
+                if (!heatmapFile.empty())
+                {
+                    auto bt = loadBlockTree(inFile);
+                    Blomp::Image img(bt->getWidth(), bt->getHeight());
+                    autoGenSaveHeatmap(bt, img, heatmapFile);
+                }
+            }
         }
         else if (mode == "denc")
         {
@@ -433,15 +1618,16 @@ int main(int argc, const char** argv, const char** env)
                 throw std::runtime_error("Missing output file.");
 
             Blomp::Image img(inFile);
-            auto bt = Blomp::BlockTree::fromImage(img, btDesc);
+            applyColorMode(img, btDesc, autoColorMode);
+            auto bt = encodeImage(img, btDesc, chromaDesc);
 
             if (!beQuiet)
-                viewBlockTreeInfo(bt, genFile.empty() ? "%TEMP%" : genFile);
+                viewBlockTreeInfo(getBlockCounts(bt, btDesc), genFile.empty() ? "%TEMP%" : genFile);
 
             if (!genFile.empty())
-                saveBlockTree(bt, btDesc.maxDepth, genFile);
+                saveBlockTree(bt, btDesc, genFile);
 
-            bt->writeToImg(img);
+            writeBlockTreeToImg(bt, img);
             img.save(outFile);
 
             autoGenSaveHeatmap(bt, img, heatmapFile);
@@ -454,18 +1640,26 @@ int main(int argc, const char** argv, const char** env)
             Blomp::Image compImg = loadImage(compFile);
             Blomp::Image inImg = loadImage(inFile);
 
-            float similarity, dataRatio;
-            float score = calcImgCompScore(
-                compImg, inImg,
-                std::filesystem::file_size(compFile),
-                std::filesystem::file_size(inFile),
-                &similarity, &dataRatio
-            );
+            Blomp::CompareDesc compareDesc;
+            compareDesc.nThreads = nJobs > 0 ? nJobs : std::max(1, (int)std::thread::hardware_concurrency());
+            compareDesc.keepTiles = !heatmapFile.empty() || reportFormat == "json";
+
+            Blomp::ImageMetrics metrics;
+            {
+                Blomp::TraceScope trace("compare", "compare");
+                trace.arg("threads", compareDesc.nThreads);
+                metrics = Blomp::compareImages(compImg, inImg, compareDesc);
+            }
+
+            float dataRatio = float(fileSize(inFile)) / fileSize(compFile);
 
-            std::cout << "Comp Results ('" << compFile << "' vs. '" << inFile << "'):" << std::endl;
-            std::cout << "  Similarity: " << similarity << std::endl;
-            std::cout << "  Data ratio: " << dataRatio << std::endl;
-            std::cout << "  Score:      " << (similarity / dataRatio) << std::endl;
+            if (reportFormat == "json")
+                writeCompResultsJson(metrics, dataRatio, compFile, inFile);
+            else
+                viewCompResults(metrics, dataRatio, compFile, inFile);
+
+            if (!heatmapFile.empty())
+                saveErrorMap(metrics, inImg.width(), inImg.height(), heatmapFile);
         }
         else if (mode == "maxv")
         {
@@ -473,27 +1667,65 @@ int main(int argc, const char** argv, const char** env)
                 throw std::runtime_error("Missing output file.");
 
             auto img = loadImage(inFile);
+            applyColorMode(img, btDesc, autoColorMode);
+            requireColorMode(mode, btDesc);
             if (targetName == "size" && targetValue == 0)
-                targetValue = std::filesystem::file_size(inFile);
+                targetValue = fileSize(inFile);
 
             int nItersUsed = 0;
 
-            auto bt = calcMaxV(
-                img, btDesc,
-                targetName == "size" ? targetSizeFunc : targetSimilarityFunc,
-                targetValue,
-                maxvIterations, nItersUsed,
-                !beQuiet
-            );
+            Blomp::ParentBlockRef bt;
+            Blomp::CacheKey cacheKey;
+            bool isCached = false;
+            if (pCache)
+            {
+                cacheKey = createCacheKey(mode, img, btDesc, chromaDesc);
+                cacheKey.add(targetName).add((int64_t)targetValue).add((int64_t)maxvIterations);
+                isCached = pCache->load(cacheKey, outFile, cacheEntry);
+            }
+
+            if (isCached)
+            {
+                btDesc.variationThreshold = cacheEntry.variationThreshold;
+                nItersUsed = cacheEntry.nIterations;
+                if (!beQuiet)
+                    viewCacheHit(inFile);
+            }
+            else
+            {
+                bool withMoments = btDesc.leafShape == Blomp::LeafShape::Gradient;
+                Blomp::StatsPyramid pyramid(img, btDesc.colorMode, btDesc.maxDepth, Blomp::StatsPyramid::minLevelWithinBudget(img, btDesc.maxDepth, withMoments), withMoments);
+                bt = calcMaxV(
+                    pyramid, btDesc,
+                    targetName == "size" ? targetSizeFunc : targetSimilarityFunc,
+                    targetValue,
+                    maxvIterations, nItersUsed,
+                    !beQuiet
+                );
+                cacheEntry.counts = getBlockCounts(bt, btDesc);
+            }
 
             std::cout << "MaxV result for '" << inFile << "' after " << nItersUsed << " iterations:" << std::endl;
-            std::cout << "  v:" << btDesc.variationThreshold << " -> fs: " << calcEstFileSize(bt) << " bytes" << std::endl;
+            std::cout << "  v:" << btDesc.variationThreshold << " -> fs: " << calcEstFileSize(cacheEntry.counts) << " bytes" << std::endl;
 
-            saveBlockTree(bt, btDesc.maxDepth, outFile);
+            if (!isCached)
+            {
+                saveBlockTree(bt, btDesc, outFile);
+
+                if (pCache)
+                {
+                    cacheEntry.maxDepth = btDesc.maxDepth;
+                    cacheEntry.variationThreshold = btDesc.variationThreshold;
+                    cacheEntry.nIterations = nItersUsed;
+                    pCache->store(cacheKey, outFile, cacheEntry);
+                }
+            }
+            else if (!genFile.empty() || !heatmapFile.empty())
+                bt = loadBlockTree(outFile);
 
             if (!genFile.empty())
             {
-                bt->writeToImg(img);
+                writeBlockTreeToImg(bt, img);
                 img.save(genFile);
             }
 
@@ -505,11 +1737,13 @@ int main(int argc, const char** argv, const char** env)
                 throw std::runtime_error("Missing output file.");
 
             auto img = loadImage(inFile);
-            uint64_t img1Size = std::filesystem::file_size(inFile);
+            applyColorMode(img, btDesc, autoColorMode);
+            requireColorMode(mode, btDesc);
+            uint64_t img1Size = fileSize(inFile);
             auto img2 = Blomp::Image(img.width(), img.height());
 
             if (targetName == "size" && targetValue == 0)
-                targetValue = std::filesystem::file_size(inFile);
+                targetValue = fileSize(inFile);
 
             struct BestResult
             {
@@ -519,53 +1753,300 @@ int main(int argc, const char** argv, const char** env)
             } best;
 
             int nItersUsed = 0;
-            for (btDesc.maxDepth = 0; btDesc.maxDepth <= 10; ++btDesc.maxDepth)
-            {
-                if (!beQuiet)
-                    std::cout << "Running MaxV test " << (btDesc.maxDepth + 1) << "/11 ..." << std::endl;
-
-                auto bt = calcMaxV(
-                    img, btDesc,
-                    targetName == "size" ? targetSizeFunc : targetSimilarityFunc,
-                    targetValue,
-                    maxvIterations, nItersUsed,
-                    !beQuiet
-                );
-                bt->writeToImg(img2);
 
-                float score = 0.0f;
-                if (targetName == "size")
-                    score = calcImgCompScore(img, img2, img1Size, calcEstFileSize(bt));
-                else
-                    score = 1.0f / calcEstFileSize(bt);
+            Blomp::CacheKey cacheKey;
+            bool isCached = false;
+            if (pCache)
+            {
+                cacheKey = createCacheKey(mode, img, btDesc, chromaDesc);
+                cacheKey.add(targetName).add((int64_t)targetValue).add((int64_t)maxvIterations).add((int64_t)img1Size);
+                isCached = pCache->load(cacheKey, outFile, cacheEntry);
+            }
 
-                if (score > best.score)
+            if (isCached)
+            {
+                best.btDesc = btDesc;
+                best.btDesc.maxDepth = cacheEntry.maxDepth;
+                best.btDesc.variationThreshold = cacheEntry.variationThreshold;
+                nItersUsed = cacheEntry.nIterations;
+                if (!beQuiet)
+                    viewCacheHit(inFile);
+            }
+            else
+            {
+                // The statistics are shared by every depth and threshold tested.
+                bool withMoments = btDesc.leafShape == Blomp::LeafShape::Gradient;
+                Blomp::StatsPyramid pyramid(img, btDesc.colorMode, 10, Blomp::StatsPyramid::minLevelWithinBudget(img, 10, withMoments), withMoments);
+                for (btDesc.maxDepth = 0; btDesc.maxDepth <= 10; ++btDesc.maxDepth)
                 {
-                    best.bt = bt;
-                    best.btDesc = btDesc;
-                    best.score = score;
+                    if (!beQuiet)
+                        std::cout << "Running MaxV test " << (btDesc.maxDepth + 1) << "/11 ..." << std::endl;
+
+                    auto bt = calcMaxV(
+                        pyramid, btDesc,
+                        targetName == "size" ? targetSizeFunc : targetSimilarityFunc,
+                        targetValue,
+                        maxvIterations, nItersUsed,
+                        !beQuiet
+                    );
+                    writeBlockTreeToImg(bt, img2);
+
+                    uint64_t estFileSize = calcEstFileSize(getBlockCounts(bt, btDesc));
+                    float score = 0.0f;
+                    if (targetName == "size")
+                        score = calcImgCompScore(img, img2, img1Size, estFileSize);
+                    else
+                        score = 1.0f / estFileSize;
+
+                    if (score > best.score)
+                    {
+                        best.bt = bt;
+                        best.btDesc = btDesc;
+                        best.score = score;
+                    }
                 }
+
+                cacheEntry.counts = getBlockCounts(best.bt, best.btDesc);
             }
 
             std::cout << "Opti result for '" << inFile << "' after " << nItersUsed << " iterations:" << std::endl;
             std::cout << "  d:" << best.btDesc.maxDepth << " v:" << best.btDesc.variationThreshold << std::endl;
-            std::cout << "  -> fs: " << calcEstFileSize(best.bt) << " bytes" << std::endl;
+            std::cout << "  -> fs: " << calcEstFileSize(cacheEntry.counts) << " bytes" << std::endl;
+
+            if (!isCached)
+            {
+                saveBlockTree(best.bt, best.btDesc, outFile);
 
-            saveBlockTree(best.bt, best.btDesc.maxDepth, outFile);
+                if (pCache)
+                {
+                    cacheEntry.maxDepth = best.btDesc.maxDepth;
+                    cacheEntry.variationThreshold = best.btDesc.variationThreshold;
+                    cacheEntry.nIterations = nItersUsed;
+                    pCache->store(cacheKey, outFile, cacheEntry);
+                }
+            }
+            else if (!genFile.empty() || !heatmapFile.empty())
+                best.bt = loadBlockTree(outFile);
 
             if (!genFile.empty())
             {
-                best.bt->writeToImg(img2);
+                writeBlockTreeToImg(best.bt, img2);
                 img2.save(genFile);
             }
 
             autoGenSaveHeatmap(best.bt, img2, heatmapFile);
         }
+        else if (mode == "rdo")
+        {
+            if (outFile.empty())
+                throw std::runtime_error("Missing output file.");
+
+            if (btDesc.splitMode != Blomp::SplitMode::Quad)
+                throw std::runtime_error("Mode 'rdo' only supports the quad split mode.");
+            if (btDesc.leafShape != Blomp::LeafShape::Flat)
+                throw std::runtime_error("Mode 'rdo' doesn't support gradient leaves.");
+
+            auto img = loadImage(inFile);
+            applyColorMode(img, btDesc, autoColorMode);
+            requireColorMode(mode, btDesc);
+            if (targetName == "size" && targetValue == 0)
+                targetValue = fileSize(inFile);
+
+            Blomp::RDOptimizer rdo(img, btDesc.maxDepth, btDesc.colorMode, btDesc.leafCoding);
+
+            double lambda = rdLambda;
+            if (lambda >= 0.0)
+                rdo.optimize(lambda);
+            else if (targetName == "size")
+            {
+                uint64_t headerBits = (sizeof(Blomp::FileHeader) + sizeof(uint64_t)) * 8;
+                uint64_t targetBits = targetValue * 8 > headerBits ? targetValue * 8 - headerBits : 0;
+                lambda = rdo.optimizeForSize(targetBits);
+
+                // The optimizer counts every leaf as a cache miss. The bits saved by cache
+                // hits are handed back to it, searching the largest budget that still fits.
+                if (btDesc.leafCoding == Blomp::LeafCoding::Cache)
+                {
+                    auto countBits = [&]() { return getBlockCounts(Blomp::BlockTree::fromRDOptimizer(rdo), btDesc).nBits; };
+
+                    uint64_t fitBudget = targetBits;
+                    uint64_t overBudget = 0;
+                    uint64_t nBits = countBits();
+                    for (int i = 0; i < 6 && 0 < nBits && nBits < targetBits; ++i)
+                    {
+                        uint64_t budget = overBudget > 0 ? fitBudget + (overBudget - fitBudget) / 2 : (uint64_t)((double)fitBudget * targetBits / nBits);
+                        double budgetLambda = rdo.optimizeForSize(budget);
+                        uint64_t budgetBits = countBits();
+                        if (budgetBits > targetBits)
+                        {
+                            overBudget = budget;
+                            continue;
+                        }
+
+                        fitBudget = budget;
+                        lambda = budgetLambda;
+                        nBits = budgetBits;
+                    }
+
+                    rdo.optimize(lambda);
+                }
+            }
+            else
+            {
+                double maxMSE = 1.0 - std::pow((double)targetValue / 1000, 1.0 / 128);
+                lambda = rdo.optimizeForDistortion(maxMSE * 3 * img.width() * img.height());
+            }
+
+            auto bt = Blomp::BlockTree::fromRDOptimizer(rdo);
+
+            std::cout << "RDO result for '" << inFile << "':" << std::endl;
+            std::cout << "  l:" << lambda << " -> fs: " << calcEstFileSize(getBlockCounts(bt, btDesc)) << " bytes" << std::endl;
+
+            saveBlockTree(bt, btDesc, outFile);
+
+            if (!genFile.empty())
+            {
+                writeBlockTreeToImg(bt, img);
+                img.save(genFile);
+            }
+
+            autoGenSaveHeatmap(bt, img, heatmapFile);
+        }
+        else if (mode == "upd")
+        {
+            if (outFile.empty())
+                throw std::runtime_error("Missing output file.");
+            if (baseFile.empty())
+                throw std::runtime_error("Missing base blomp file.");
+
+            Blomp::FileHeader fileHeader;
+            Blomp::BitStream srcStream;
+            loadBlockFile(baseFile, fileHeader, srcStream);
+
+            btDesc.maxDepth = fileHeader.bd.maxDepth;
+            btDesc.splitMode = fileHeader.splitMode();
+            btDesc.colorMode = fileHeader.colorMode();
+            btDesc.leafCoding = fileHeader.leafCoding();
+            btDesc.leafShape = fileHeader.leafShape();
+            requireColorMode(mode, btDesc);
+
+            Blomp::Image img(inFile);
+            applyColorMode(img, btDesc, false);
+
+            Blomp::FileHeader dstHeader;
+            dstHeader.bd = fileHeader.bd;
+            dstHeader.setSplitMode(btDesc.splitMode);
+            dstHeader.setColorMode(btDesc.colorMode);
+            dstHeader.setLeafShape(btDesc.leafShape);
+
+            Blomp::BitStream dstStream;
+            int nRebuiltTiles = Blomp::BlockTree::updateRegions(fileHeader.bd, btDesc, srcStream, img, dirtyRects, dstStream, dstHeader.counts);
+
+            saveBlockFile(dstHeader, dstStream, outFile);
+
+            if (!beQuiet)
+            {
+                std::cout << "Update result for '" << outFile << "':" << std::endl;
+                std::cout << "  Rebuilt tiles: " << nRebuiltTiles << std::endl;
+                std::cout << "  TreeBits:      " << dstStream.size() << std::endl;
+            }
+        }
+        else if (mode == "seq")
+        {
+            if (outFile.empty())
+                throw std::runtime_error("Missing output file.");
+
+            if (!autoColorMode && btDesc.colorMode != Blomp::ColorMode::RGB)
+                throw std::runtime_error("Sequences only support the 'rgb' color mode.");
+            btDesc.colorMode = Blomp::ColorMode::RGB;
+
+            if (btDesc.leafCoding != Blomp::LeafCoding::Literal)
+                throw std::runtime_error("Sequences don't support the 'mtf' palette.");
+            if (btDesc.leafShape != Blomp::LeafShape::Flat)
+                throw std::runtime_error("Sequences don't support gradient leaves.");
+
+            encodeSequence(inFiles, btDesc, outFile, !beQuiet);
+        }
+        else if (mode == "info" && Blomp::endswith(inFile, ".bla"))
+        {
+            if (detailedInfo)
+                throw std::runtime_error("Detailed reports are only available for single blomp files.");
+
+            viewArchiveInfo(inFile);
+        }
         else if (mode == "info")
         {
-            auto bt = loadBlockTree(inFile);
+            Blomp::FileHeader fileHeader;
+            Blomp::BitStream bitStream;
+            loadBlockFile(inFile, fileHeader, bitStream);
+
+            if (detailedInfo)
+            {
+                std::unique_ptr<Blomp::Image> pSourceImg;
+                if (!compFile.empty())
+                    pSourceImg.reset(new Blomp::Image(loadImage(compFile)));
+
+                auto report = Blomp::BlockTree::report(fileHeader.bd, fileHeader.splitMode(), fileHeader.colorMode(), fileHeader.leafCoding(), fileHeader.leafShape(), bitStream, pSourceImg.get());
+                if (reportFormat == "json")
+                    writeBlockTreeReportJson(report, inFile);
+                else
+                    viewBlockTreeReport(report, inFile);
+            }
+            // The counts of legacy files, which aren't stored in their header, are gathered
+            // while validating the file, so no blocks are built in either case.
+            else
+                viewBlockTreeInfo(scanBlockFile(fileHeader, bitStream), inFile);
+        }
+        else if (mode == "pack")
+        {
+            Blomp::ArchiveWriter writer(outFile);
+            for (auto& file : inFiles)
+            {
+                auto data = readFileData(file);
+
+                // Only valid blomp files are packed, so reading from an archive can't fail later on.
+                try
+                {
+                    Blomp::FileHeader fileHeader;
+                    Blomp::BitStream bitStream;
+                    readBlockFile(data.data(), data.size(), fileHeader, bitStream);
+                    if (!Blomp::BlockTree::isValid(fileHeader.bd, fileHeader.splitMode(), fileHeader.colorMode(), fileHeader.leafCoding(), fileHeader.leafShape(), bitStream))
+                        throw std::runtime_error("Unable to read damaged blomp file.");
+                }
+                catch (std::exception& e)
+                {
+                    throw std::runtime_error("'" + file + "': " + e.what());
+                }
+
+                writer.add(std::filesystem::path(file).filename().string(), data.data(), data.size());
+            }
+            writer.finish();
+
+            if (!beQuiet)
+                std::cout << "Packed " << inFiles.size() << " files into '" << outFile << "'." << std::endl;
+        }
+        else if (mode == "unpack")
+        {
+            auto& archive = openArchive(inFile);
+            std::filesystem::create_directories(outFile);
+
+            for (uint64_t i = 0; i < archive.nEntries(); ++i)
+            {
+                std::string name(archive.name(i));
+                if (!Blomp::isValidArchiveName(name))
+                    throw std::runtime_error("Invalid archive entry name '" + name + "'.");
 
-            viewBlockTreeInfo(bt, inFile);
+                auto file = archive.file(i);
+                writeFileData((std::filesystem::path(outFile) / name).string(), file.data, file.size);
+            }
+
+            if (!beQuiet)
+                std::cout << "Unpacked " << archive.nEntries() << " files into '" << outFile << "'." << std::endl;
+        }
+        else if (mode == "get")
+        {
+            auto file = findArchiveFile(inFile);
+            writeFileData(outFile, file.data, file.size);
         }
         else
         {
@@ -576,8 +2057,12 @@ int main(int argc, const char** argv, const char** env)
     catch (std::exception& e)
     {
         std::cout << "ERROR: " << e.what() << std::endl;
+        saveTrace(traceFile);
         return 1;
     }
-    
-    return 0;
+
+    if (!beQuiet)
+        viewMemoryInfo();
+
+    return saveTrace(traceFile) ? 0 : 1;
 }
\ No newline at end of file
@@ -19,23 +19,50 @@ Modes:
   comp         Compare two images with the same dimensions.
   maxv         Optimize the '-v' option.
   opti         Optimize the '-d' and '-v' options.
+  rdo          Rate-distortion optimize the block tree for a target.
+  seq          Convert a sequence of frames to a blomp sequence file.
+  upd          Re-encode changed regions of an existing blomp file.
   info         View information for a blomp file.
+  pack         Store multiple blomp files in a blomp archive.
+  unpack       Extract all files of a blomp archive.
+  get          Extract a single file of a blomp archive.
 
 Options:
   -d [int]           (--depth) Block depth.
   -v [float]     (--variation) Variation threshold.
+  -D [int]    (--chroma-depth) Block depth of the chroma tree.
+  -V [float] (--chroma-variation) Variation threshold of the chroma tree.
   -o [string]       (--output) Output filename.
   -m [string]+     (--heatmap) Heatmap filename.
   -i [int]      (--iterations) Number of iterations.
   -c [string]     (--compfile) Comparison file.
   -x [target] [int] (--target) Target to reach.
   -g [string]+   (--genoutput) Regenerated image filename.
+  -s [string]        (--split) Split mode.
+  -y [string]        (--color) Color mode.
+  -p [string]      (--palette) Leaf color palette.
+  -a [string]   (--leaf-shape) Leaf shape.
+  -b [string]         (--base) Base blomp file.
+  -r [rect]           (--rect) Dirty rectangle.
+  -l [float]        (--lambda) Rate-distortion lagrange multiplier.
+  -j [int]            (--jobs) Number of parallel jobs.
+  -e              (--detailed) Detailed block tree report.
+  -f [string]       (--format) Report format.
+  -M [int]      (--max-memory) Memory budget in MiB.
+  -L [string]       (--layout) Image memory layout.
+  -t [string]        (--trace) Trace event filename.
+  -C [string]        (--cache) Result cache directory.
+  -S [int]      (--cache-size) Result cache size in MiB.
   -q                 (--quiet) Quiet. View less information.
 
 Options with '+' have a default value when they are set to '+'.
 For more details to their default values see their corresponding
 help pages.
 
+Blomp files inside of a blomp archive (*.bla) can be used wherever a
+blomp file is read by passing 'archive.bla:name' as the filename.
+They are read from the mapped archive without copying them.
+
 Supported image formats:
   Mode  | JPG PNG TGA BMP PSD GIF HDR PIC PNM
   ------+------------------------------------
@@ -49,11 +76,13 @@ Supported image formats:
 static const char* encode =
 R"(Help - Mode: 'enc'
 Convert an image to a blomp file.
+When multiple images are given, all of them are converted in parallel
+and '-o', '-m' and '-C' are not available.
 Available Options:
-    -d, -v, -o, -m, -q
+    -d, -v, -D, -V, -s, -y, -p, -a, -o, -m, -j, -M, -L, -t, -C, -S, -q
 
-Input: Supported image file
-Output: Blomp file
+Input: Supported image file(s)
+Output: Blomp file(s)
 
 Defaults:
     -o      '${inFile%.*}.blp'
@@ -62,21 +91,26 @@ Defaults:
 static const char* decode =
 R"(Help - Mode: 'dec'
 Convert a blomp file to an image.
+Blomp sequence files (*.bls) are converted to one image per frame,
+named '${outFile%.*}_[frame].${outFile##*.}'.
+When multiple blomp files are given, all of them are converted in
+parallel and '-o' and '-m' are not available. Sequence files can't be
+converted this way.
 Available Options:
-    -o, -m, -q
+    -o, -m, -j, -M, -L, -t, -q
 
-Input: Blomp file
-Output: Supported image file
+Input: Blomp file(s) or blomp sequence file
+Output: Supported image file(s)
 
 Defaults:
-    -o      '${inFile%.*}.png'
+    -o      '${inFile%.*}.png', '${name%.*}.png' for 'archive.bla:name'
 )";
 
 static const char* deencode =
 R"(Help - Mode: 'denc'
 Convert an image to blomp data and reconvert it back to an image.
 Available Options:
-    -d, -v, -o, -m, -g, -q
+    -d, -v, -D, -V, -s, -y, -p, -a, -o, -m, -g, -M, -L, -t, -q
 
 Input: Supported image file
 Output: Supported image file
@@ -89,8 +123,14 @@ Defaults:
 static const char* compare =
 R"(Help - Mode: 'comp'
 Compare two images of any supported type and with the same dimensions.
+Besides the similarity score, the MSE, PSNR and SSIM are viewed, in
+total and per channel. Both images are compared in tiles of 64x64
+pixels on several threads. SSIM uses windows of 8x8 pixels in steps of
+4 pixels.
+With '-m', an error map with the RMSE of every tile is saved, where the
+tile with the largest error is white.
 Available Options:
-    -c, -q
+    -c, -m, -f, -j, -M, -L, -t, -q
 
 Input: Supported image file or blomp file
 )";
@@ -99,7 +139,7 @@ static const char* maxvariation =
 R"(Help - Mode: 'maxv'
 Optimize the '-v' option to reach the given target.
 Available Options:
-    -d, -o, -m, -i, -x, -g, -q
+    -d, -s, -y, -p, -a, -o, -m, -i, -x, -g, -M, -L, -t, -C, -S, -q
 
 Input: Supported image file or blomp file
 Output: Blomp file
@@ -114,7 +154,7 @@ static const char* optimize =
 R"(Help - Mode: 'opti'
 Optimize the '-d' and '-v' options to reach the given target.
 Available Options:
-    -o, -m, -i, -x, -g, -q
+    -s, -y, -p, -a, -o, -m, -i, -x, -g, -M, -L, -t, -C, -S, -q
 
 Input: Supported image file or blomp file
 Output: Blomp file
@@ -125,13 +165,119 @@ Defaults:
     -g      '${inFile%.*}_OPTI.png'
 )";
 
+static const char* ratedistortion =
+R"(Help - Mode: 'rdo'
+Build the block tree with rate-distortion optimized split decisions.
+The statistics of every candidate block are computed once and the
+optimal pruning for the given target is chosen without rebuilding
+the tree. The '-v' option is ignored.
+Available Options:
+    -d, -y, -p, -o, -m, -x, -l, -g, -M, -L, -t, -q
+
+Input: Supported image file or blomp file
+Output: Blomp file
+Side-data: Supported image file
+
+Defaults:
+    -o      '${inFile%.*}.blp'
+    -g      '${inFile%.*}_RDO.png'
+)";
+
+static const char* sequence =
+R"(Help - Mode: 'seq'
+Convert a sequence of frames with the same dimensions to a blomp sequence file.
+Every top-level tile whose previous reconstruction still meets the
+variation threshold, or that would be rebuilt unchanged, is stored as a
+copy of the previous frame, only changed tiles are rebuilt and stored.
+Usage:
+    blomp seq [options] [frame0] [frame1] ...
+Available Options:
+    -d, -v, -s, -o, -M, -L, -t, -q
+
+Input: Supported image files
+Output: Blomp sequence file
+
+Defaults:
+    -o      '${frame0%.*}.bls'
+)";
+
+static const char* update =
+R"(Help - Mode: 'upd'
+Re-encode the regions of an existing blomp file that changed in the given image.
+Only top-level tiles intersecting a dirty rectangle are rebuilt, all other
+tiles are copied from the base file without decoding them.
+The '-d', '-s' and '-a' options are taken from the base file.
+Available Options:
+    -b, -r, -v, -o, -M, -L, -t, -q
+
+Input: Supported image file with the dimensions of the base file
+Output: Blomp file
+
+Defaults:
+    -o      '${inFile%.*}.blp'
+)";
+
 static const char* info =
 R"(Help - Mode: 'info'
 View information for a blomp file.
+The counts are gathered by walking the structure of the file, which
+also validates it, without building the block tree. For a blomp
+archive (*.bla) the information of every file in it is viewed.
+With '-e' a detailed report of the block tree structure is viewed,
+which is gathered in a single pass over the file. When the source
+image is passed with '-c', it includes the distribution of the leaf
+variations.
 Available Options:
-    -q
+    -e, -f, -c, -M, -L, -t, -q
 
-Input: Supported image file or blomp file
+Input: Blomp file or blomp archive
+)";
+
+static const char* pack =
+R"(Help - Mode: 'pack'
+Store multiple blomp files in a blomp archive.
+The files are stored as they are under their filename without the
+directory, followed by an index sorted by name. Single files can be
+looked up in the index without reading the whole archive.
+Blomp sequence files can't be stored.
+Usage:
+    blomp pack [options] [file0] [file1] ...
+Available Options:
+    -o, -t, -q
+
+Input: Blomp files
+Output: Blomp archive
+
+Defaults:
+    -o      '${file0%.*}.bla'
+)";
+
+static const char* unpack =
+R"(Help - Mode: 'unpack'
+Extract all files of a blomp archive into a directory.
+Available Options:
+    -o, -t, -q
+
+Input: Blomp archive
+Output: Directory of blomp files
+
+Defaults:
+    -o      '${inFile%.*}'
+)";
+
+static const char* get =
+R"(Help - Mode: 'get'
+Extract a single file of a blomp archive.
+Usage:
+    blomp get [options] archive.bla:name
+Available Options:
+    -o, -t, -q
+
+Input: File inside of a blomp archive
+Output: Blomp file
+
+Defaults:
+    -o      '${name}'
 )";
 
 // ---------- OPTIONS ----------
@@ -158,6 +304,29 @@ Default: 0.02
 Range: 0.0 - 1.0
 )";
 
+static const char* chromadepth =
+R"(Help - Option: '-D/--chroma-depth'
+Description:
+    Block depth of the chroma tree in the 'ycbcr' color mode.
+    The chroma tree is stored independently of the luma tree,
+    which uses the '-d' option.
+
+Default: Value of '-d'
+Range: 0 - 10
+)";
+
+static const char* chromavariation =
+R"(Help - Option: '-V/--chroma-variation'
+Description:
+    Variation threshold of the chroma tree in the 'ycbcr' color mode.
+    The threshold applies to the two chroma channels only, so with the
+    same value as '-v' the chroma tree is already coarser than the luma
+    tree. Higher values save more space at the cost of color detail.
+
+Default: Value of '-v'
+Range: 0.0 - 1.0
+)";
+
 static const char* output =
 R"(Help - Option: '-o/--output'
 Description:
@@ -192,6 +361,8 @@ static const char* compfile =
 R"(Help - Option: '-c/--compfile'
 Description:
     Name of the comparision file.
+    In the 'info' mode with '-e' it is the source image, whose pixels
+    are used to calculate the variation of every leaf.
 )";
 
 static const char* size =
@@ -217,6 +388,229 @@ Description:
     When not set, no file containing side-generated data will be created.
 )";
 
+static const char* split =
+R"(Help - Option: '-s/--split'
+Description:
+    Determines how parent blocks are split when generating a blomp block tree.
+    'quad' always splits a block into four quadrants.
+    'binary' lets every parent choose between a horizontal, a vertical
+    and a quad split (2 extra bits per parent). Each parent picks the
+    split that takes the fewest estimated bits two splits ahead. This
+    needs less blocks for images with horizontal or vertical structures.
+
+Values:
+    quad
+    binary
+
+Default: quad
+)";
+
+static const char* color =
+R"(Help - Option: '-y/--color'
+Description:
+    Determines which color channels are stored in the leaves.
+    'rgb' stores a 24 bit color per leaf.
+    'gray' converts the image to luma and stores 8 bits per leaf.
+    'ycbcr' stores a luma tree with 8 bits per leaf and a separate,
+    usually coarser chroma tree with 16 bits per leaf. See the
+    '-D' and '-V' options.
+    'auto' selects 'gray' when all pixels of the image are gray,
+    otherwise 'rgb'.
+    The 'upd' mode always uses the color mode of the base file and
+    the 'seq' mode only supports 'rgb'. 'ycbcr' is only supported by
+    the 'enc' and 'denc' modes.
+
+Values:
+    auto
+    rgb
+    gray
+    ycbcr
+
+Default: auto
+)";
+
+static const char* palette =
+R"(Help - Option: '-p/--palette'
+Description:
+    Determines how the leaf colors are stored.
+    'none' stores every leaf color as it is.
+    'mtf' keeps a move-to-front cache of the 16 most recently stored
+    leaf colors. A leaf whose color is in the cache only stores its
+    4 bit index, all other leaves store the color plus one extra bit.
+    This saves a lot of space for images with few distinct colors,
+    like screenshots, charts or maps.
+    As leaves with colors outside of the cache take one more bit, files
+    with many distinct colors may also get larger.
+    The size targets of the 'maxv', 'opti' and 'rdo' modes count the
+    cached leaves of the resulting file.
+    The 'seq' mode only supports 'none' and files using 'mtf' can't
+    be updated by the 'upd' mode.
+
+Values:
+    none
+    mtf
+
+Default: none
+)";
+
+static const char* leafshape =
+R"(Help - Option: '-a/--leaf-shape'
+Description:
+    Determines the shape of the leaf colors.
+    'flat' fills every leaf with a single color.
+    'gradient' additionally allows leaves with a linear gradient,
+    which are used when a flat leaf doesn't meet the variation
+    threshold but a gradient fitted to its pixels does. Smooth
+    regions like skies or shading then need far fewer blocks.
+    Every leaf stores one extra bit for its shape, gradient leaves
+    store their mean color plus an 8 bit slope in x and y per channel.
+    Gradient leaves don't use the '-p' cache. The 'seq' and 'rdo'
+    modes only support 'flat'.
+
+Values:
+    flat
+    gradient
+
+Default: flat
+)";
+
+static const char* base =
+R"(Help - Option: '-b/--base'
+Description:
+    Name of the blomp file that gets updated by the 'upd' mode.
+)";
+
+static const char* rect =
+R"(Help - Option: '-r/--rect'
+Description:
+    Dirty rectangle for the 'upd' mode in the format 'x,y,width,height'.
+    Can be set multiple times.
+)";
+
+static const char* lambda =
+R"(Help - Option: '-l/--lambda'
+Description:
+    Lagrange multiplier used by the 'rdo' mode.
+    Higher values trade more distortion for fewer bits.
+    When set, the '-x' option is ignored.
+
+Range: 0.0 - inf
+)";
+
+static const char* jobs =
+R"(Help - Option: '-j/--jobs'
+Description:
+    Number of files converted at the same time when the 'enc' or 'dec'
+    mode gets multiple input files. Reading and writing the files runs
+    on separate threads alongside the jobs.
+    In the 'comp' mode it is the number of threads comparing the tiles.
+
+Range: 1 - inf
+Default: Number of hardware threads
+)";
+
+static const char* detailed =
+R"(Help - Option: '-e/--detailed'
+Description:
+    Views a detailed report in the 'info' mode:
+      - Leaf and parent counts and the leaf area per depth
+      - Bits spent on the tree structure (split flags and split types)
+        and on the leaf colors
+      - Distribution of the leaf variations, when the source image is
+        passed with '-c'. The variations use the unit of '-v'.
+    In the binary split mode every split counts as one depth.
+    The YCbCr mode reports the luma and the chroma tree separately.
+)";
+
+static const char* format =
+R"(Help - Option: '-f/--format'
+Description:
+    Format of the detailed report viewed with '-e' and of the results of
+    the 'comp' mode. In JSON, the 'comp' results include the MSE and SSIM
+    of every tile, row by row.
+
+Formats:
+    text   Tables for reading.
+    json   A single JSON object. Other output is suppressed.
+
+Default: text
+)";
+
+static const char* maxmemory =
+R"(Help - Option: '-M/--max-memory'
+Description:
+    Budget in MiB for the memory held by images, block trees, bitstreams
+    and block statistics. Input and output files held in memory count as
+    bitstreams. Archives are mapped instead of read, so their pages
+    aren't counted. Close to the budget, lower-memory strategies
+    are used: block statistics are summed up from the pixels instead of
+    being precomputed and blomp files are written in chunks.
+    When the budget still can't be kept, the run stops with an error
+    before the memory gets allocated.
+    Unless '-q' is set, the peak memory is viewed after every run.
+
+Range: 1 - inf
+Default: Unlimited
+)";
+
+static const char* layout =
+R"(Help - Option: '-L/--layout'
+Description:
+    Determines how the pixels of images are stored in memory.
+    'rows' stores one row after the other.
+    'tiles' stores tiles of 64x64 pixels, so every block of up to that
+    size covers a single contiguous piece of memory. Loaded images are
+    converted when loading and saving them.
+    This may speed up images that are many thousand pixels wide,
+    especially with a small '-M' budget, where block statistics are
+    summed up from the pixels. The resulting files are the same.
+
+Values:
+    rows
+    tiles
+
+Default: rows
+)";
+
+static const char* trace =
+R"(Help - Option: '-t/--trace'
+Description:
+    Writes the duration of every phase of the run as trace events in the
+    JSON format of Chrome. The file can be viewed in 'chrome://tracing'
+    or Perfetto (https://ui.perfetto.dev).
+    Events are recorded for loading and saving files, building the block
+    statistics, building every top-level tile, every 'maxv' iteration,
+    serializing block trees and writing them to pixels. Each event holds
+    the thread it ran on and arguments like the variation threshold and
+    the number of blocks.
+
+Default: Disabled
+)";
+
+static const char* cache =
+R"(Help - Option: '-C/--cache'
+Description:
+    Directory of previous results of the 'enc', 'maxv' and 'opti' modes.
+    Results are looked up by a hash of the input pixels, the mode and
+    all options that change the result. On a hit, the cached blomp file
+    is copied to the output file and the chosen depth and variation
+    threshold are viewed without encoding the image again.
+    Entries are written to temporary files and renamed, so several runs
+    can share the directory. The directory is created when missing.
+
+Default: Disabled
+)";
+
+static const char* cachesize =
+R"(Help - Option: '-S/--cache-size'
+Description:
+    Size limit in MiB of the '-C' directory. When a new result exceeds
+    the limit, the least recently used results are removed.
+
+Range: 1 - inf
+Default: 1024
+)";
+
 static const char* quiet =
 R"(Help - Option: '-q/--quiet'
 Description:
@@ -243,13 +637,29 @@ namespace Blomp
             return HelpText::maxvariation;
         if (name == "opti")
             return HelpText::optimize;
+        if (name == "rdo")
+            return HelpText::ratedistortion;
+        if (name == "seq")
+            return HelpText::sequence;
+        if (name == "upd")
+            return HelpText::update;
         if (name == "info")
             return HelpText::info;
+        if (name == "pack")
+            return HelpText::pack;
+        if (name == "unpack")
+            return HelpText::unpack;
+        if (name == "get")
+            return HelpText::get;
 
         if (name == "-d" || name == "--depth")
             return HelpText::depth;
         if (name == "-v" || name == "--variation")
             return HelpText::variation;
+        if (name == "-D" || name == "--chroma-depth")
+            return HelpText::chromadepth;
+        if (name == "-V" || name == "--chroma-variation")
+            return HelpText::chromavariation;
         if (name == "-o" || name == "--output")
             return HelpText::output;
         if (name == "-m" || name == "--heatmap")
@@ -262,6 +672,36 @@ namespace Blomp
             return HelpText::size;
         if (name == "-g" || name == "--genoutput")
             return HelpText::genoutput;
+        if (name == "-s" || name == "--split")
+            return HelpText::split;
+        if (name == "-y" || name == "--color")
+            return HelpText::color;
+        if (name == "-p" || name == "--palette")
+            return HelpText::palette;
+        if (name == "-a" || name == "--leaf-shape")
+            return HelpText::leafshape;
+        if (name == "-b" || name == "--base")
+            return HelpText::base;
+        if (name == "-r" || name == "--rect")
+            return HelpText::rect;
+        if (name == "-l" || name == "--lambda")
+            return HelpText::lambda;
+        if (name == "-j" || name == "--jobs")
+            return HelpText::jobs;
+        if (name == "-e" || name == "--detailed")
+            return HelpText::detailed;
+        if (name == "-f" || name == "--format")
+            return HelpText::format;
+        if (name == "-M" || name == "--max-memory")
+            return HelpText::maxmemory;
+        if (name == "-L" || name == "--layout")
+            return HelpText::layout;
+        if (name == "-t" || name == "--trace")
+            return HelpText::trace;
+        if (name == "-C" || name == "--cache")
+            return HelpText::cache;
+        if (name == "-S" || name == "--cache-size")
+            return HelpText::cachesize;
         if (name == "-q" || name == "--quiet")
             return HelpText::quiet;
 
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "Image.h"
+
+namespace Blomp
+{
+    // Move-to-front cache of the most recently coded leaf colors.
+    // Encoder and decoder update it in the same order, so a leaf color
+    // that is still in the cache can be coded by its index.
+    class ColorCache
+    {
+    public:
+        static constexpr int INDEX_BITS = 4;
+        static constexpr int CAPACITY = 1 << INDEX_BITS;
+    public:
+        int find(const Color& color) const;
+        Color getNC(int index) const;
+        int size() const;
+        void moveToFront(int index);
+        void insert(const Color& color);
+        void reset();
+    private:
+        Color m_colors[CAPACITY];
+        int m_size = 0;
+    };
+
+    inline int ColorCache::find(const Color& color) const
+    {
+        for (int i = 0; i < m_size; ++i)
+            if (m_colors[i].r == color.r && m_colors[i].g == color.g && m_colors[i].b == color.b)
+                return i;
+        return -1;
+    }
+
+    inline Color ColorCache::getNC(int index) const
+    {
+        return m_colors[index];
+    }
+
+    inline int ColorCache::size() const
+    {
+        return m_size;
+    }
+
+    inline void ColorCache::moveToFront(int index)
+    {
+        Color color = m_colors[index];
+        for (int i = index; i > 0; --i)
+            m_colors[i] = m_colors[i - 1];
+        m_colors[0] = color;
+    }
+
+    inline void ColorCache::insert(const Color& color)
+    {
+        // The least recently used color drops out of a full cache.
+        if (m_size < CAPACITY)
+            ++m_size;
+        for (int i = m_size - 1; i > 0; --i)
+            m_colors[i] = m_colors[i - 1];
+        m_colors[0] = color;
+    }
+
+    inline void ColorCache::reset()
+    {
+        m_size = 0;
+    }
+}
\ No newline at end of file
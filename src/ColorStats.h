@@ -0,0 +1,126 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "Image.h"
+
+namespace Blomp
+{
+    // Largest squared difference of a single 8-bit channel.
+    static constexpr double MAX_CHANNEL_ERROR = 255.0 * 255.0;
+
+    // Integer sums and squared sums of a set of 8-bit pixels.
+    // All accumulation is exact; only the final squared error is converted.
+    struct ColorStats
+    {
+        uint64_t sum[3] = { 0, 0, 0 };
+        uint64_t sum2[3] = { 0, 0, 0 };
+        uint64_t nPixels = 0;
+    public:
+        void add(const Color& color);
+        Color avgColor() const;
+        double squaredError() const;
+        bool meetsThreshold(float variationThreshold) const;
+    public:
+        static double scaledThreshold(float variationThreshold);
+    };
+
+    ColorStats& operator+=(ColorStats& left, const ColorStats& right);
+    ColorStats operator+(ColorStats left, const ColorStats& right);
+
+    // First order moments of a set of 8-bit pixels, the sums of the channel
+    // values weighted by their image coordinates. Together with ColorStats
+    // they are enough to fit a linear gradient.
+    struct ColorMoments
+    {
+        uint64_t sumX[3] = { 0, 0, 0 };
+        uint64_t sumY[3] = { 0, 0, 0 };
+    };
+
+    ColorMoments& operator+=(ColorMoments& left, const ColorMoments& right);
+
+    inline void ColorStats::add(const Color& color)
+    {
+        sum[0] += color.r;
+        sum[1] += color.g;
+        sum[2] += color.b;
+        sum2[0] += color.r * color.r;
+        sum2[1] += color.g * color.g;
+        sum2[2] += color.b * color.b;
+        ++nPixels;
+    }
+
+    inline Color ColorStats::avgColor() const
+    {
+        if (nPixels == 0)
+            return Color();
+
+        // Round half up.
+        uint64_t half = nPixels / 2;
+        return Color(
+            uint8_t((sum[0] + half) / nPixels),
+            uint8_t((sum[1] + half) / nPixels),
+            uint8_t((sum[2] + half) / nPixels)
+        );
+    }
+
+    inline double ColorStats::squaredError() const
+    {
+        if (nPixels == 0)
+            return 0.0;
+
+        // err = sum2 - sum^2 / n
+        // With sum = q * n + r this becomes
+        // err = (sum2 - q * (sum + r)) - r^2 / n
+        // where every intermediate value fits into 64 bits.
+        uint64_t intPart = 0;
+        uint64_t fracPart = 0;
+        for (int c = 0; c < 3; ++c)
+        {
+            uint64_t q = sum[c] / nPixels;
+            uint64_t r = sum[c] % nPixels;
+            uint64_t r2 = r * r;
+            intPart += sum2[c] - q * (sum[c] + r) - r2 / nPixels;
+            fracPart += r2 % nPixels;
+        }
+
+        return double(intPart) - double(fracPart) / double(nPixels);
+    }
+
+    inline bool ColorStats::meetsThreshold(float variationThreshold) const
+    {
+        return squaredError() <= scaledThreshold(variationThreshold) * nPixels;
+    }
+
+    inline double ColorStats::scaledThreshold(float variationThreshold)
+    {
+        // The variation threshold is given per pixel for channels in [0, 1].
+        return double(variationThreshold) * MAX_CHANNEL_ERROR;
+    }
+
+    inline ColorStats& operator+=(ColorStats& left, const ColorStats& right)
+    {
+        for (int c = 0; c < 3; ++c)
+        {
+            left.sum[c] += right.sum[c];
+            left.sum2[c] += right.sum2[c];
+        }
+        left.nPixels += right.nPixels;
+        return left;
+    }
+
+    inline ColorStats operator+(ColorStats left, const ColorStats& right)
+    {
+        return left += right;
+    }
+
+    inline ColorMoments& operator+=(ColorMoments& left, const ColorMoments& right)
+    {
+        for (int c = 0; c < 3; ++c)
+        {
+            left.sumX[c] += right.sumX[c];
+            left.sumY[c] += right.sumY[c];
+        }
+        return left;
+    }
+}
\ No newline at end of file
@@ -1,11 +1,48 @@
 #pragma once
 
+#include <stdint.h>
+
 namespace Blomp
 {
+    class ColorCache;
+
+    enum class SplitMode
+    {
+        Quad, Binary
+    };
+
+    enum class SplitType
+    {
+        Quad = 0, Horizontal = 1, Vertical = 2
+    };
+
+    // CbCr is only used by the chroma tree of the YCbCr mode.
+    enum class ColorMode
+    {
+        RGB, Gray, YCbCr, CbCr
+    };
+
+    enum class LeafCoding
+    {
+        Literal, Cache
+    };
+
+    // Gradient trees may store leaves whose color changes linearly across the block.
+    enum class LeafShape
+    {
+        Flat, Gradient
+    };
+
     struct BlockTreeDesc
     {
         int maxDepth;
         float variationThreshold;
+        SplitMode splitMode = SplitMode::Quad;
+        ColorMode colorMode = ColorMode::RGB;
+        LeafCoding leafCoding = LeafCoding::Literal;
+        LeafShape leafShape = LeafShape::Flat;
+        // Cache state while the leaves of a LeafCoding::Cache tree are read.
+        ColorCache* pColorCache = nullptr;
     };
 
     struct ParentBlockDesc
@@ -20,4 +57,25 @@ namespace Blomp
         int imgWidth, imgHeight;
         int maxDepth;
     };
+
+    struct BlockCounts
+    {
+        int nBlocks = 0;
+        int nColorBlocks = 0;
+        uint64_t nBits = 0;
+    };
+
+    struct Rect
+    {
+        int x, y;
+        int width, height;
+    };
+
+    struct BufferDesc
+    {
+        uint8_t* data;
+        int width, height;
+        int nChannels;
+        int stride;
+    };
 }
\ No newline at end of file
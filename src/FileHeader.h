@@ -1,22 +1,185 @@
 #pragma once
 
 #include "Descriptors.h"
+#include <cstddef>
+#include <cstring>
+#include <iostream>
 #include <stdint.h>
 
 namespace Blomp
 {
     struct FileHeader
     {
-        static constexpr char DEFAULT_IDENTIFIER[4] = { 'B', 'L', 'M', 'P' };
-        char identifier[4] = { 'B', 'L', 'M', 'P' };
+        static constexpr char LEGACY_IDENTIFIER[4] = { 'B', 'L', 'M', 'P' };
+        static constexpr char LEGACY_BINARY_SPLIT_IDENTIFIER[4] = { 'B', 'L', 'M', 'B' };
+        static constexpr char DEFAULT_IDENTIFIER[4] = { 'B', 'L', 'M', 'V' };
+        static constexpr uint32_t CURRENT_VERSION = 1;
+        static constexpr uint32_t FLAG_BINARY_SPLIT = 1 << 0;
+        static constexpr uint32_t FLAG_GRAYSCALE = 1 << 1;
+        static constexpr uint32_t FLAG_YCBCR = 1 << 2;
+        static constexpr uint32_t FLAG_COLOR_CACHE = 1 << 3;
+        static constexpr uint32_t FLAG_GRADIENT_LEAVES = 1 << 4;
+        static constexpr uint32_t KNOWN_FLAGS = FLAG_BINARY_SPLIT | FLAG_GRAYSCALE | FLAG_YCBCR | FLAG_COLOR_CACHE | FLAG_GRADIENT_LEAVES;
+        char identifier[4] = { 'B', 'L', 'M', 'V' };
         BaseDescriptor bd;
+        // The fields below are only stored by versioned headers.
+        uint32_t version = CURRENT_VERSION;
+        uint32_t flags = 0;
+        BlockCounts counts;
     public:
         bool isValid() const
+        {
+            if (isLegacy())
+                return true;
+            if (!hasIdentifier(DEFAULT_IDENTIFIER))
+                return false;
+            if ((flags & FLAG_GRAYSCALE) && (flags & FLAG_YCBCR))
+                return false;
+            return 0 < version && version <= CURRENT_VERSION && (flags & ~KNOWN_FLAGS) == 0;
+        }
+
+        bool isLegacy() const
+        {
+            return hasIdentifier(LEGACY_IDENTIFIER) || hasIdentifier(LEGACY_BINARY_SPLIT_IDENTIFIER);
+        }
+
+        bool hasCounts() const
+        {
+            return !isLegacy();
+        }
+
+        uint64_t size() const
+        {
+            return isLegacy() ? legacySize() : sizeof(FileHeader);
+        }
+
+        SplitMode splitMode() const
+        {
+            if (isLegacy())
+                return hasIdentifier(LEGACY_BINARY_SPLIT_IDENTIFIER) ? SplitMode::Binary : SplitMode::Quad;
+            return (flags & FLAG_BINARY_SPLIT) ? SplitMode::Binary : SplitMode::Quad;
+        }
+
+        void setSplitMode(SplitMode splitMode)
+        {
+            if (splitMode == SplitMode::Binary)
+                flags |= FLAG_BINARY_SPLIT;
+            else
+                flags &= ~FLAG_BINARY_SPLIT;
+        }
+
+        ColorMode colorMode() const
+        {
+            if (flags & FLAG_YCBCR)
+                return ColorMode::YCbCr;
+            return (flags & FLAG_GRAYSCALE) ? ColorMode::Gray : ColorMode::RGB;
+        }
+
+        void setColorMode(ColorMode colorMode)
+        {
+            flags &= ~(FLAG_GRAYSCALE | FLAG_YCBCR);
+            if (colorMode == ColorMode::Gray)
+                flags |= FLAG_GRAYSCALE;
+            else if (colorMode == ColorMode::YCbCr)
+                flags |= FLAG_YCBCR;
+        }
+
+        LeafCoding leafCoding() const
+        {
+            return (flags & FLAG_COLOR_CACHE) ? LeafCoding::Cache : LeafCoding::Literal;
+        }
+
+        void setLeafCoding(LeafCoding leafCoding)
+        {
+            if (leafCoding == LeafCoding::Cache)
+                flags |= FLAG_COLOR_CACHE;
+            else
+                flags &= ~FLAG_COLOR_CACHE;
+        }
+
+        LeafShape leafShape() const
+        {
+            return (flags & FLAG_GRADIENT_LEAVES) ? LeafShape::Gradient : LeafShape::Flat;
+        }
+
+        void setLeafShape(LeafShape leafShape)
+        {
+            if (leafShape == LeafShape::Gradient)
+                flags |= FLAG_GRADIENT_LEAVES;
+            else
+                flags &= ~FLAG_GRADIENT_LEAVES;
+        }
+
+        static constexpr uint64_t legacySize()
+        {
+            return offsetof(FileHeader, version);
+        }
+    private:
+        bool hasIdentifier(const char* other) const
         {
             for (int i = 0; i < 4; ++i)
-                if (identifier[i] != DEFAULT_IDENTIFIER[i])
+                if (identifier[i] != other[i])
                     return false;
             return true;
         }
     };
+
+    inline std::ostream& operator<<(std::ostream& oStream, const FileHeader& fileHeader)
+    {
+        return oStream.write((const char*)&fileHeader, fileHeader.size());
+    }
+
+    inline std::istream& operator>>(std::istream& iStream, FileHeader& fileHeader)
+    {
+        // Legacy headers end after the base descriptor and carry no version, flags or counts.
+        fileHeader = FileHeader();
+        if (!iStream.read((char*)&fileHeader, FileHeader::legacySize()))
+            return iStream;
+
+        if (fileHeader.isLegacy())
+        {
+            fileHeader.version = 0;
+            return iStream;
+        }
+
+        return iStream.read((char*)&fileHeader + FileHeader::legacySize(), sizeof(FileHeader) - FileHeader::legacySize());
+    }
+
+    // Reads the header at the start of a blomp file in memory.
+    // Returns the number of bytes read or 0 when the data ends within the header.
+    inline uint64_t readFileHeader(const uint8_t* data, uint64_t size, FileHeader& fileHeader)
+    {
+        fileHeader = FileHeader();
+        if (size < FileHeader::legacySize())
+            return 0;
+
+        std::memcpy((void*)&fileHeader, data, FileHeader::legacySize());
+        if (fileHeader.isLegacy())
+        {
+            fileHeader.version = 0;
+            return FileHeader::legacySize();
+        }
+
+        if (size < sizeof(FileHeader))
+            return 0;
+
+        std::memcpy((void*)&fileHeader, data, sizeof(FileHeader));
+        return sizeof(FileHeader);
+    }
+
+    struct SequenceHeader
+    {
+        static constexpr char DEFAULT_IDENTIFIER[4] = { 'B', 'L', 'M', 'Q' };
+        char identifier[4] = { 'B', 'L', 'M', 'Q' };
+        BaseDescriptor bd;
+        int32_t splitMode = (int32_t)SplitMode::Quad;
+    public:
+        bool isValid() const
+        {
+            for (int i = 0; i < 4; ++i)
+                if (identifier[i] != DEFAULT_IDENTIFIER[i])
+                    return false;
+            return splitMode == (int32_t)SplitMode::Quad || splitMode == (int32_t)SplitMode::Binary;
+        }
+    };
 }
\ No newline at end of file
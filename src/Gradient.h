@@ -0,0 +1,162 @@
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+#include <cmath>
+
+#include "ColorStats.h"
+#include "Descriptors.h"
+#include "Image.h"
+
+namespace Blomp
+{
+    // Color of a gradient leaf. Every channel stores its mean plus its change
+    // from the block center to the right (dx) and to the bottom edge (dy),
+    // so pixel (px, py) of a w x h block gets
+    //   mean + dx * (2 * px + 1 - w) / w + dy * (2 * py + 1 - h) / h
+    // Only the channels of the color mode are stored, see firstChannel and nChannels.
+    struct Gradient
+    {
+        Color mean;
+        int8_t dx[3] = { 0, 0, 0 };
+        int8_t dy[3] = { 0, 0, 0 };
+    public:
+        // Least squares fit with the slopes rounded to their stored precision.
+        // The statistics must cover exactly the w x h pixels at (x, y).
+        static Gradient fit(const ColorStats& cs, const ColorMoments& cm, int x, int y, int w, int h);
+        // Sum of squared channel differences of the pixels the statistics were taken from.
+        double squaredError(const ColorStats& cs, const ColorMoments& cm, int x, int y, int w, int h) const;
+        // Writes row py of a w x h block, leaving the channels the color mode doesn't use untouched.
+        void renderRow(int py, int w, int h, ColorMode colorMode, uint8_t* row, int nPixelChannels) const;
+        // Writes the n pixels from px on of row py, out points to pixel px.
+        void renderRun(int py, int px, int n, int w, int h, ColorMode colorMode, uint8_t* out, int nPixelChannels) const;
+    public:
+        static int firstChannel(ColorMode colorMode);
+        static int nChannels(ColorMode colorMode);
+        // Stored size of the mean and both slopes.
+        static int nBits(ColorMode colorMode);
+    private:
+        struct CenteredMoments
+        {
+            // Sums of the channel values weighted by their offset from the block center.
+            double sumX[3], sumY[3];
+            // Sums of the squared offsets.
+            double sumXX, sumYY;
+        };
+    private:
+        static CenteredMoments centerMoments(const ColorStats& cs, const ColorMoments& cm, int x, int y, int w, int h);
+    };
+
+    inline Gradient Gradient::fit(const ColorStats& cs, const ColorMoments& cm, int x, int y, int w, int h)
+    {
+        Gradient gradient;
+        gradient.mean = cs.avgColor();
+
+        CenteredMoments m = centerMoments(cs, cm, x, y, w, h);
+        for (int c = 0; c < 3; ++c)
+        {
+            // The slope per pixel times half the block dimension.
+            double dx = m.sumXX > 0.0 ? m.sumX[c] / m.sumXX * w / 2 : 0.0;
+            double dy = m.sumYY > 0.0 ? m.sumY[c] / m.sumYY * h / 2 : 0.0;
+            gradient.dx[c] = (int8_t)std::clamp(std::lround(dx), -128L, 127L);
+            gradient.dy[c] = (int8_t)std::clamp(std::lround(dy), -128L, 127L);
+        }
+
+        return gradient;
+    }
+
+    inline double Gradient::squaredError(const ColorStats& cs, const ColorMoments& cm, int x, int y, int w, int h) const
+    {
+        // The offsets from the center are orthogonal to each other and to
+        // the mean, so every slope a reduces the error of the flat block by
+        // 2 * a * sum(offset * value) - a^2 * sum(offset^2).
+        CenteredMoments m = centerMoments(cs, cm, x, y, w, h);
+
+        double error = cs.squaredError();
+        for (int c = 0; c < 3; ++c)
+        {
+            double ax = 2.0 * dx[c] / w;
+            double ay = 2.0 * dy[c] / h;
+            error -= 2.0 * ax * m.sumX[c] - ax * ax * m.sumXX;
+            error -= 2.0 * ay * m.sumY[c] - ay * ay * m.sumYY;
+        }
+
+        return std::max(error, 0.0);
+    }
+
+    inline void Gradient::renderRow(int py, int w, int h, ColorMode colorMode, uint8_t* row, int nPixelChannels) const
+    {
+        renderRun(py, 0, w, w, h, colorMode, row, nPixelChannels);
+    }
+
+    inline void Gradient::renderRun(int py, int px, int n, int w, int h, ColorMode colorMode, uint8_t* out, int nPixelChannels) const
+    {
+        int first = firstChannel(colorMode);
+        const uint8_t* meanData = &mean.r;
+
+        for (int c = first; c < first + nChannels(colorMode); ++c)
+        {
+            // 16.16 fixed point, the added half rounds to the nearest value.
+            int64_t value = (int64_t)meanData[c] * 65536 + 32768;
+            value += (int64_t)dy[c] * (2 * py + 1 - h) * 65536 / h;
+            value += (int64_t)dx[c] * (1 - w) * 65536 / w;
+            int64_t step = (int64_t)dx[c] * 2 * 65536 / w;
+            value += step * px;
+
+            for (int i = 0; i < n; ++i, value += step)
+                out[i * nPixelChannels + c] = (uint8_t)std::min<int64_t>(std::max<int64_t>(value, 0) >> 16, 255);
+        }
+
+        if (colorMode == ColorMode::Gray)
+        {
+            for (int i = 0; i < n; ++i)
+            {
+                out[i * nPixelChannels + 1] = out[i * nPixelChannels];
+                out[i * nPixelChannels + 2] = out[i * nPixelChannels];
+            }
+        }
+
+        if (nPixelChannels == 4 && colorMode != ColorMode::CbCr)
+            for (int i = 0; i < n; ++i)
+                out[i * nPixelChannels + 3] = 255;
+    }
+
+    inline int Gradient::firstChannel(ColorMode colorMode)
+    {
+        return colorMode == ColorMode::CbCr ? 1 : 0;
+    }
+
+    inline int Gradient::nChannels(ColorMode colorMode)
+    {
+        switch (colorMode)
+        {
+        case ColorMode::Gray: return 1;
+        case ColorMode::CbCr: return 2;
+        default: return 3;
+        }
+    }
+
+    inline int Gradient::nBits(ColorMode colorMode)
+    {
+        return nChannels(colorMode) * 3 * 8;
+    }
+
+    inline Gradient::CenteredMoments Gradient::centerMoments(const ColorStats& cs, const ColorMoments& cm, int x, int y, int w, int h)
+    {
+        CenteredMoments m;
+
+        double centerX = x + (w - 1) / 2.0;
+        double centerY = y + (h - 1) / 2.0;
+        for (int c = 0; c < 3; ++c)
+        {
+            m.sumX[c] = double(cm.sumX[c]) - centerX * double(cs.sum[c]);
+            m.sumY[c] = double(cm.sumY[c]) - centerY * double(cs.sum[c]);
+        }
+
+        // Sum of (i - (n - 1) / 2)^2 for i in [0, n) is n * (n^2 - 1) / 12.
+        m.sumXX = double(h) * w * (double(w) * w - 1.0) / 12.0;
+        m.sumYY = double(w) * h * (double(h) * h - 1.0) / 12.0;
+
+        return m;
+    }
+}
\ No newline at end of file
@@ -1,10 +1,15 @@
 #include "Image.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cctype>
 #include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
 
 #include "Tools.h"
+#include "Trace.h"
 
 #include "stb_image_write.h"
 
@@ -30,58 +35,270 @@ namespace Blomp
         return ImageType::UNKNOWN;
     }
 
+    static void requireDecodeMemory(int width, int height)
+    {
+        // The decoded pixels are copied into the image, so both have to fit at once.
+        MemoryTracker::require((uint64_t)width * height * sizeof(Color) * 2);
+    }
+
+    static std::atomic<ImageLayout>& defaultLayoutRef()
+    {
+        static std::atomic<ImageLayout> layout{ ImageLayout::Rows };
+        return layout;
+    }
+
     Image::Image(int width, int height)
-        : m_width(width), m_height(height), m_buffer(width * height)
+        : Image(width, height, defaultLayout())
     {}
 
+    Image::Image(int width, int height, ImageLayout layout)
+        : m_width(width), m_height(height)
+    {
+        allocate(layout);
+    }
+
     Image::Image(const std::string& filename)
     {
+        TraceScope trace("load", "io");
+        trace.arg("file", filename);
+
         int nChannels;
+        if (stbi_info(filename.c_str(), &m_width, &m_height, &nChannels))
+            requireDecodeMemory(m_width, m_height);
+
         auto data = stbi_load(filename.c_str(), &m_width, &m_height, &nChannels, 3);
     
         if (!data)
             throw std::runtime_error("Unable to load file!");
 
+        trace.arg("width", m_width);
+        trace.arg("height", m_height);
+
         //if (nChannels != 3)
         //    throw std::runtime_error("Wrong channel count!");
 
-        m_buffer.clear();
-        m_buffer.reserve(m_width * m_height);
+        takePixels(data);
+    }
+
+    Image::Image(const uint8_t* fileData, uint64_t fileSize)
+    {
+        if (fileSize > (uint64_t)std::numeric_limits<int>::max())
+            throw std::runtime_error("Unable to load file!");
+
+        TraceScope trace("load", "io");
+        trace.arg("bytes", fileSize);
+
+        int nChannels;
+        if (stbi_info_from_memory(fileData, (int)fileSize, &m_width, &m_height, &nChannels))
+            requireDecodeMemory(m_width, m_height);
+
+        auto data = stbi_load_from_memory(fileData, (int)fileSize, &m_width, &m_height, &nChannels, 3);
+
+        if (!data)
+            throw std::runtime_error("Unable to load file!");
 
-        for (int i = 0; i < m_width * m_height; ++i)
-            m_buffer.push_back(Pixel::fromCharArray((const uint8_t*)data + i * nChannels));
+        trace.arg("width", m_width);
+        trace.arg("height", m_height);
+
+        takePixels(data);
+    }
+
+    void Image::takePixels(uint8_t* data)
+    {
+        allocate(defaultLayout());
+
+        if (m_layout == ImageLayout::Rows)
+            std::memcpy(m_buffer.data(), data, m_buffer.size() * sizeof(Color));
+        else
+        {
+            TraceScope trace("tiling", "io");
+            for (int y = 0; y < m_height; ++y)
+            {
+                auto row = (const Color*)data + (uint64_t)y * m_width;
+                for (int x = 0, n; x < m_width; x += n)
+                {
+                    n = rowRunNC(x);
+                    std::memcpy(&getNC(x, y), row + x, n * sizeof(Color));
+                }
+            }
+        }
 
         stbi_image_free(data);
     }
 
+    ImageLayout Image::defaultLayout()
+    {
+        return defaultLayoutRef().load(std::memory_order_relaxed);
+    }
+
+    void Image::setDefaultLayout(ImageLayout layout)
+    {
+        defaultLayoutRef() = layout;
+    }
+
+    void Image::allocate(ImageLayout layout)
+    {
+        m_layout = layout;
+        if (layout == ImageLayout::Rows)
+        {
+            m_buffer.resize((uint64_t)m_width * m_height);
+            return;
+        }
+
+        // Tiles at the right and bottom edge are padded to the full size.
+        m_nTilesX = (m_width + TILE_SIZE - 1) >> TILE_LOG;
+        uint64_t nTilesY = (m_height + TILE_SIZE - 1) >> TILE_LOG;
+        m_buffer.resize(((uint64_t)m_nTilesX * nTilesY) << (2 * TILE_LOG));
+    }
+
+    bool Image::isGray() const
+    {
+        for (auto& px : m_buffer)
+            if (px.r != px.g || px.r != px.b)
+                return false;
+        return true;
+    }
+
+    void Image::toGray()
+    {
+        // BT.601 luma in 8-bit fixed point.
+        for (auto& px : m_buffer)
+        {
+            uint8_t y = uint8_t((77 * px.r + 150 * px.g + 29 * px.b + 128) >> 8);
+            px = Color(y, y, y);
+        }
+    }
+
+    void Image::toYCbCr()
+    {
+        for (auto& px : m_buffer)
+            px = px.toYCbCr();
+    }
+
+    void Image::fromYCbCr()
+    {
+        for (auto& px : m_buffer)
+            px = Color::fromYCbCr(px);
+    }
+
     void Image::save(const std::string& filename) const
+    {
+        BufferDesc bufDesc;
+        bufDesc.width = m_width;
+        bufDesc.height = m_height;
+        bufDesc.nChannels = 3;
+        bufDesc.stride = m_width * 3;
+
+        // Pixels in rows are already stored as tightly packed RGB bytes.
+        if (m_layout == ImageLayout::Rows)
+        {
+            bufDesc.data = (uint8_t*)m_buffer.data();
+            saveImageData(filename, bufDesc);
+            return;
+        }
+
+        std::vector<uint8_t, TrackedAllocator<uint8_t, MemoryCategory::Image>> data((uint64_t)m_width * m_height * sizeof(Color));
+        {
+            TraceScope trace("untiling", "io");
+            for (int y = 0; y < m_height; ++y)
+            {
+                uint8_t* row = data.data() + (uint64_t)y * bufDesc.stride;
+                for (int x = 0, n; x < m_width; x += n)
+                {
+                    n = rowRunNC(x);
+                    std::memcpy(row + x * sizeof(Color), &getNC(x, y), n * sizeof(Color));
+                }
+            }
+        }
+
+        bufDesc.data = data.data();
+        saveImageData(filename, bufDesc);
+    }
+
+    static ImageType checkImageData(const std::string& filename, const BufferDesc& bufDesc)
     {
         auto type = ImgTypeFromFilename(filename);
 
         if (type == ImageType::UNKNOWN)
             throw std::runtime_error("Unknown filetype!");
 
-        std::vector<stbi_uc> data;
-        data.reserve(m_width * m_height);
+        if (type != ImageType::PNG && bufDesc.stride != bufDesc.width * bufDesc.nChannels)
+            throw std::runtime_error("Filetype requires a tightly packed buffer.");
 
-        for (auto& pix : m_buffer)
-        {
-            data.push_back(stbi_uc(std::min(1.0f, std::max(0.0f, pix.r)) * 255.0f));
-            data.push_back(stbi_uc(std::min(1.0f, std::max(0.0f, pix.g)) * 255.0f));
-            data.push_back(stbi_uc(std::min(1.0f, std::max(0.0f, pix.b)) * 255.0f));
-        }
+        return type;
+    }
+
+    // Passes the encoded file to func, piece by piece.
+    static bool writeImageData(ImageType type, const BufferDesc& bufDesc, stbi_write_func* func, void* context)
+    {
+        int w = bufDesc.width;
+        int h = bufDesc.height;
+        int n = bufDesc.nChannels;
 
-        int result;
+        int result = 0;
         switch (type)
         {
-        case ImageType::PNG: result = stbi_write_png(filename.c_str(), m_width, m_height, 3, data.data(), m_width * 3); break;
-        case ImageType::BMP: result = stbi_write_bmp(filename.c_str(), m_width, m_height, 3, data.data()); break;
-        case ImageType::TGA: result = stbi_write_tga(filename.c_str(), m_width, m_height, 3, data.data()); break;
-        case ImageType::JPG: result = stbi_write_jpg(filename.c_str(), m_width, m_height, 3, data.data(), 90); break;
+        case ImageType::PNG: result = stbi_write_png_to_func(func, context, w, h, n, bufDesc.data, bufDesc.stride); break;
+        case ImageType::BMP: result = stbi_write_bmp_to_func(func, context, w, h, n, bufDesc.data); break;
+        case ImageType::TGA: result = stbi_write_tga_to_func(func, context, w, h, n, bufDesc.data); break;
+        case ImageType::JPG: result = stbi_write_jpg_to_func(func, context, w, h, n, bufDesc.data, 90); break;
         case ImageType::UNKNOWN: throw std::runtime_error("Unknown filetype!");
         }
 
-        if (result == 0)
+        return result != 0;
+    }
+
+    static void appendImageData(void* context, void* data, int size)
+    {
+        auto& fileData = *(FileData*)context;
+        fileData.insert(fileData.end(), (uint8_t*)data, (uint8_t*)data + size);
+    }
+
+    static void streamImageData(void* context, void* data, int size)
+    {
+        auto& oStream = *(std::ofstream*)context;
+        oStream.write((const char*)data, size);
+    }
+
+    FileData encodeImageData(const std::string& filename, const BufferDesc& bufDesc)
+    {
+        TraceScope trace("save", "io");
+        trace.arg("file", filename);
+
+        auto type = checkImageData(filename, bufDesc);
+
+        FileData fileData;
+        if (!writeImageData(type, bufDesc, appendImageData, &fileData))
+            throw std::runtime_error("Unable to encode image data.");
+
+        return fileData;
+    }
+
+    void saveImageData(const std::string& filename, const BufferDesc& bufDesc)
+    {
+        TraceScope trace("save", "io");
+        trace.arg("file", filename);
+
+        auto type = checkImageData(filename, bufDesc);
+
+        std::ofstream oStream(filename, std::ios::binary);
+        if (!writeImageData(type, bufDesc, streamImageData, &oStream) || !oStream.flush())
             throw std::runtime_error("Unable to write image file.");
     }
+
+    void convertYCbCrToRGB(const BufferDesc& bufDesc)
+    {
+        for (int y = 0; y < bufDesc.height; ++y)
+        {
+            uint8_t* row = bufDesc.data + (uint64_t)y * bufDesc.stride;
+            for (int x = 0; x < bufDesc.width; ++x)
+            {
+                uint8_t* px = row + x * bufDesc.nChannels;
+                Color rgb = Color::fromYCbCr(Color(px[0], px[1], px[2]));
+                px[0] = rgb.r;
+                px[1] = rgb.g;
+                px[2] = rgb.b;
+            }
+        }
+    }
 }
\ No newline at end of file
@@ -1,11 +1,15 @@
 #pragma once
 
+#include <algorithm>
 #include <string>
 #include <vector>
 #include <stdexcept>
 
 #include "stb_image.h"
 
+#include "Descriptors.h"
+#include "MemoryTracker.h"
+
 namespace Blomp
 {
     struct Pixel
@@ -22,6 +26,21 @@ namespace Blomp
         static Pixel fromCharArray(const uint8_t* pixelData);
     };
 
+    struct Color
+    {
+        uint8_t r = 0, g = 0, b = 0;
+    public:
+        Color() = default;
+        Color(uint8_t r, uint8_t g, uint8_t b) : r(r), g(g), b(b) {}
+    public:
+        Pixel toPixel() const;
+        // Full range BT.601 YCbCr, stored as (Y, Cb, Cr) in (r, g, b).
+        Color toYCbCr() const;
+        static Color fromPixel(const Pixel& pix);
+        static Color fromYCbCr(const Color& ycc);
+    };
+    static_assert(sizeof(Color) == 3, "Colors must be tightly packed.");
+
     Pixel& operator+=(Pixel& left, const Pixel& right);
     Pixel& operator-=(Pixel& left, const Pixel& right);
     Pixel& operator*=(Pixel& left, const Pixel& right);
@@ -31,28 +50,70 @@ namespace Blomp
     Pixel operator*(Pixel left, const Pixel& right);
     Pixel operator/(Pixel left, const Pixel& right);
 
+    enum class ImageLayout
+    {
+        // One row after the other.
+        Rows,
+        // Tiles of TILE_SIZE x TILE_SIZE pixels, row by row, each of them stored row by row.
+        // Blocks up to the tile size then cover a single contiguous piece of memory.
+        Tiles,
+    };
+
     class Image
     {
     public:
+        static constexpr int TILE_LOG = 6;
+        static constexpr int TILE_SIZE = 1 << TILE_LOG;
+    public:
+        // Uses the default layout.
         Image(int width, int height);
+        Image(int width, int height, ImageLayout layout);
         Image(const std::string& filename);
+        // Decodes an image file that is already in memory.
+        Image(const uint8_t* fileData, uint64_t fileSize);
     public:
         int width() const;
         int height() const;
-        Pixel& get(int x, int y);
-        const Pixel& get(int x, int y) const;
-        Pixel& getNC(int x, int y);
-        const Pixel& getNC(int x, int y) const;
-        Pixel& operator()(int x, int y);
-        const Pixel& operator()(int x, int y) const;
+        ImageLayout layout() const;
+        // Number of pixels stored contiguously from x on within a row, at least 1 for x < width().
+        int rowRunNC(int x) const;
+        Color& get(int x, int y);
+        const Color& get(int x, int y) const;
+        Color& getNC(int x, int y);
+        const Color& getNC(int x, int y) const;
+        Color& operator()(int x, int y);
+        const Color& operator()(int x, int y) const;
+    public:
+        bool isGray() const;
+        void toGray();
+        void toYCbCr();
+        void fromYCbCr();
     public:
         void save(const std::string& filename) const;
+    public:
+        // Layout of all images that aren't given one explicitly, including loaded images.
+        static ImageLayout defaultLayout();
+        static void setDefaultLayout(ImageLayout layout);
+    private:
+        void takePixels(uint8_t* data);
+        void allocate(ImageLayout layout);
+        uint64_t indexNC(int x, int y) const;
     private:
         int m_width;
         int m_height;
-        std::vector<Pixel> m_buffer;
+        ImageLayout m_layout = ImageLayout::Rows;
+        int m_nTilesX = 0;
+        std::vector<Color, TrackedAllocator<Color, MemoryCategory::Image>> m_buffer;
     };
 
+    // Whole files held in memory are booked like bitstream memory.
+    typedef std::vector<uint8_t, TrackedAllocator<uint8_t, MemoryCategory::BitStream>> FileData;
+
+    void saveImageData(const std::string& filename, const BufferDesc& bufDesc);
+    // Encodes the buffer in the format given by the filename extension without writing it.
+    FileData encodeImageData(const std::string& filename, const BufferDesc& bufDesc);
+    void convertYCbCrToRGB(const BufferDesc& bufDesc);
+
     inline void Pixel::toCharArray(uint8_t* pixelData) const
     {
         pixelData[0] = r * 255;
@@ -69,6 +130,40 @@ namespace Blomp
         return pix;
     }
 
+    inline Pixel Color::toPixel() const
+    {
+        return Pixel(float(r) / 255, float(g) / 255, float(b) / 255);
+    }
+
+    inline Color Color::fromPixel(const Pixel& pix)
+    {
+        auto toChannel = [](float c) { return uint8_t(std::min(1.0f, std::max(0.0f, c)) * 255.0f + 0.5f); };
+        return Color(toChannel(pix.r), toChannel(pix.g), toChannel(pix.b));
+    }
+
+    inline Color Color::toYCbCr() const
+    {
+        // 16-bit fixed point, rounded to nearest.
+        int y = (19595 * r + 38470 * g + 7471 * b + 32768) >> 16;
+        int cb = (-11059 * r - 21709 * g + 32768 * b + (128 << 16) + 32768) >> 16;
+        int cr = (32768 * r - 27439 * g - 5329 * b + (128 << 16) + 32768) >> 16;
+        return Color(uint8_t(y), uint8_t(std::min(cb, 255)), uint8_t(std::min(cr, 255)));
+    }
+
+    inline Color Color::fromYCbCr(const Color& ycc)
+    {
+        auto toChannel = [](int c) { return uint8_t(std::min(255, std::max(0, c))); };
+
+        int y = ycc.r;
+        int cb = ycc.g - 128;
+        int cr = ycc.b - 128;
+        return Color(
+            toChannel(y + ((91881 * cr + 32768) >> 16)),
+            toChannel(y + ((-22554 * cb - 46802 * cr + 32768) >> 16)),
+            toChannel(y + ((116130 * cb + 32768) >> 16))
+        );
+    }
+
     inline Pixel& operator+=(Pixel& left, const Pixel& right)
     {
         left.r += right.r;
@@ -124,36 +219,57 @@ namespace Blomp
         return m_height;
     }
 
-    inline Pixel& Image::get(int x, int y)
+    inline ImageLayout Image::layout() const
+    {
+        return m_layout;
+    }
+
+    inline int Image::rowRunNC(int x) const
+    {
+        if (m_layout == ImageLayout::Rows)
+            return m_width - x;
+        return std::min(TILE_SIZE - (x & (TILE_SIZE - 1)), m_width - x);
+    }
+
+    inline Color& Image::get(int x, int y)
     {
         if (x < 0 || width() <= x || y < 0 || height() <= y)
             throw std::runtime_error("Cannot read out-of-bounds pixel of image.");
         return getNC(x, y);
     }
 
-    inline const Pixel& Image::get(int x, int y) const
+    inline const Color& Image::get(int x, int y) const
     {
         if (x < 0 || width() <= x || y < 0 || height() <= y)
             throw std::runtime_error("Cannot read out-of-bounds pixel of image.");
         return getNC(x, y);
     }
 
-    inline Pixel& Image::getNC(int x, int y)
+    inline Color& Image::getNC(int x, int y)
     {
-        return m_buffer[y * width() + x];
+        return m_buffer[indexNC(x, y)];
     }
 
-    inline const Pixel& Image::getNC(int x, int y) const
+    inline const Color& Image::getNC(int x, int y) const
     {
-        return m_buffer[y * width() + x];
+        return m_buffer[indexNC(x, y)];
+    }
+
+    inline uint64_t Image::indexNC(int x, int y) const
+    {
+        if (m_layout == ImageLayout::Rows)
+            return (uint64_t)y * width() + x;
+
+        uint64_t tile = (uint64_t)(y >> TILE_LOG) * m_nTilesX + (x >> TILE_LOG);
+        return (tile << (2 * TILE_LOG)) + ((y & (TILE_SIZE - 1)) << TILE_LOG) + (x & (TILE_SIZE - 1));
     }
 
-    inline Pixel& Image::operator()(int x, int y)
+    inline Color& Image::operator()(int x, int y)
     {
         return get(x, y);
     }
 
-    inline const Pixel& Image::operator()(int x, int y) const
+    inline const Color& Image::operator()(int x, int y) const
     {
         return get(x, y);
     }
@@ -1,31 +1,234 @@
 #include "ImgCompare.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <limits>
 #include <stdexcept>
+#include <thread>
 
 #include "Image.h"
 
 namespace Blomp
 {
-    float compareImages(const Image &img1, const Image &img2)
+    struct TileSums
+    {
+        uint64_t sqErr[3] = { 0, 0, 0 };
+        double ssimSum[3] = { 0.0, 0.0, 0.0 };
+        uint64_t nWindows = 0;
+        uint64_t nPixels = 0;
+    };
+
+    static void checkDimensions(const Image& img1, const Image& img2)
     {
         if (img1.width() != img2.width() || img1.height() != img2.height())
             throw std::runtime_error("Unable to compare images with different dimensions.");
+    }
+
+    // Number of pixels from x on up to maxX that are stored contiguously in both images.
+    static int calcRunNC(const Image& img1, const Image& img2, int x, int maxX)
+    {
+        return std::min(std::min(img1.rowRunNC(x), img2.rowRunNC(x)), maxX - x);
+    }
+
+    static float calcSimilarity(uint64_t diffSum, uint64_t nPixels)
+    {
+        // Mean squared difference per channel in [0, 1].
+        double meanDiff = double(diffSum) / (3.0 * 255.0 * 255.0 * nPixels);
+
+        return std::pow(1.0f - float(meanDiff), 128);
+    }
+
+    static double calcSsim(uint64_t nPixels, uint64_t sx, uint64_t sy, uint64_t sxx, uint64_t syy, uint64_t sxy)
+    {
+        constexpr double C1 = (0.01 * 255.0) * (0.01 * 255.0);
+        constexpr double C2 = (0.03 * 255.0) * (0.03 * 255.0);
+
+        double n = double(nPixels);
+        double muX = sx / n;
+        double muY = sy / n;
+        double varX = sxx / n - muX * muX;
+        double varY = syy / n - muY * muY;
+        double cov = sxy / n - muX * muY;
+
+        return ((2.0 * muX * muY + C1) * (2.0 * cov + C2)) / ((muX * muX + muY * muY + C1) * (varX + varY + C2));
+    }
+
+    static void addWindowSsim(const Image& img1, const Image& img2, int x, int y, int w, int h, TileSums& sums)
+    {
+        // Integer sums of a window fit into 32 bits: 64 * 255^2 < 2^32.
+        uint32_t sx[3] = {}, sy[3] = {}, sxx[3] = {}, syy[3] = {}, sxy[3] = {};
+
+        for (int ry = y; ry < y + h; ++ry)
+        {
+            for (int rx = x, n; rx < x + w; rx += n)
+            {
+                n = calcRunNC(img1, img2, rx, x + w);
+                const uint8_t* row1 = &img1.getNC(rx, ry).r;
+                const uint8_t* row2 = &img2.getNC(rx, ry).r;
+                for (int i = 0; i < n * 3; i += 3)
+                {
+                    for (int c = 0; c < 3; ++c)
+                    {
+                        uint32_t a = row1[i + c];
+                        uint32_t b = row2[i + c];
+                        sx[c] += a;
+                        sy[c] += b;
+                        sxx[c] += a * a;
+                        syy[c] += b * b;
+                        sxy[c] += a * b;
+                    }
+                }
+            }
+        }
+
+        for (int c = 0; c < 3; ++c)
+            sums.ssimSum[c] += calcSsim((uint64_t)w * h, sx[c], sy[c], sxx[c], syy[c], sxy[c]);
+        ++sums.nWindows;
+    }
+
+    static TileSums calcTileSums(const Image& img1, const Image& img2, int tileX, int tileY, int tileSize)
+    {
+        TileSums sums;
+
+        int minX = tileX * tileSize;
+        int minY = tileY * tileSize;
+        int maxX = std::min(minX + tileSize, img1.width());
+        int maxY = std::min(minY + tileSize, img1.height());
+
+        for (int y = minY; y < maxY; ++y)
+        {
+            // Row sums over the interleaved channels keep the inner loop free of branches.
+            uint32_t rowErr[3] = { 0, 0, 0 };
+            for (int x = minX, n; x < maxX; x += n)
+            {
+                n = calcRunNC(img1, img2, x, maxX);
+                const uint8_t* row1 = &img1.getNC(x, y).r;
+                const uint8_t* row2 = &img2.getNC(x, y).r;
+                for (int i = 0; i < n * 3; i += 3)
+                {
+                    for (int c = 0; c < 3; ++c)
+                    {
+                        int d = row1[i + c] - row2[i + c];
+                        rowErr[c] += uint32_t(d * d);
+                    }
+                }
+            }
 
-        float diffSum = 0;
+            for (int c = 0; c < 3; ++c)
+                sums.sqErr[c] += rowErr[c];
+        }
+        sums.nPixels = (uint64_t)(maxX - minX) * (maxY - minY);
+
+        // Windows belong to the tile of their top left corner and may reach into the next tile.
+        // Images smaller than a window get a single window of their size.
+        int winW = std::min(ImageMetrics::SSIM_WINDOW, img1.width());
+        int winH = std::min(ImageMetrics::SSIM_WINDOW, img1.height());
+        for (int y = minY; y < maxY && y + winH <= img1.height(); y += ImageMetrics::SSIM_STRIDE)
+            for (int x = minX; x < maxX && x + winW <= img1.width(); x += ImageMetrics::SSIM_STRIDE)
+                addWindowSsim(img1, img2, x, y, winW, winH, sums);
+
+        return sums;
+    }
+
+    float compareImages(const Image &img1, const Image &img2)
+    {
+        checkDimensions(img1, img2);
+
+        uint64_t diffSum = 0;
         for (int y = 0; y < img1.height(); ++y)
         {
-            for (int x = 0; x < img1.width(); ++x)
+            for (int x = 0, n; x < img1.width(); x += n)
             {
-                auto pixelDiff = img1.getNC(x, y) - img2.getNC(x, y);
-                pixelDiff *= pixelDiff;
+                n = calcRunNC(img1, img2, x, img1.width());
+                const Color* row1 = &img1.getNC(x, y);
+                const Color* row2 = &img2.getNC(x, y);
+                for (int i = 0; i < n; ++i)
+                {
+                    int dr = row1[i].r - row2[i].r;
+                    int dg = row1[i].g - row2[i].g;
+                    int db = row1[i].b - row2[i].b;
+                    diffSum += uint32_t(dr * dr + dg * dg + db * db);
+                }
+            }
+        }
+
+        return calcSimilarity(diffSum, (uint64_t)img1.width() * img1.height());
+    }
+
+    ImageMetrics compareImages(const Image& img1, const Image& img2, const CompareDesc& desc)
+    {
+        checkDimensions(img1, img2);
+        // Squared errors of a tile row are summed up in 32 bits.
+        if (desc.tileSize < ImageMetrics::SSIM_STRIDE || desc.tileSize > 4096 || desc.tileSize % ImageMetrics::SSIM_STRIDE != 0)
+            throw std::runtime_error("Invalid tile size for the image comparison.");
+
+        ImageMetrics metrics;
+        metrics.tileSize = desc.tileSize;
+        metrics.nTilesX = (img1.width() + desc.tileSize - 1) / desc.tileSize;
+        metrics.nTilesY = (img1.height() + desc.tileSize - 1) / desc.tileSize;
+
+        int nTiles = metrics.nTilesX * metrics.nTilesY;
+        std::vector<TileSums> tiles(nTiles);
 
-                diffSum += (pixelDiff.r + pixelDiff.g + pixelDiff.b) / 3.0f;
+        // Tiles are handed out one by one, so uneven tiles don't stall a thread.
+        std::atomic<int> nextTile(0);
+        auto work = [&]() {
+            int i;
+            while ((i = nextTile++) < nTiles)
+                tiles[i] = calcTileSums(img1, img2, i % metrics.nTilesX, i / metrics.nTilesX, desc.tileSize);
+        };
+
+        int nThreads = std::max(1, std::min(desc.nThreads, nTiles));
+        std::vector<std::thread> threads;
+        for (int i = 1; i < nThreads; ++i)
+            threads.emplace_back(work);
+        work();
+        for (auto& thread : threads)
+            thread.join();
+
+        // Summing up in tile order keeps the result independent of the thread count.
+        TileSums total;
+        for (auto& tile : tiles)
+        {
+            for (int c = 0; c < 3; ++c)
+            {
+                total.sqErr[c] += tile.sqErr[c];
+                total.ssimSum[c] += tile.ssimSum[c];
+            }
+            total.nWindows += tile.nWindows;
+            total.nPixels += tile.nPixels;
+
+            if (desc.keepTiles)
+            {
+                uint64_t sqErr = tile.sqErr[0] + tile.sqErr[1] + tile.sqErr[2];
+                double ssimSum = tile.ssimSum[0] + tile.ssimSum[1] + tile.ssimSum[2];
+                metrics.tileMse.push_back(tile.nPixels ? double(sqErr) / (3.0 * tile.nPixels) : 0.0);
+                metrics.tileSsim.push_back(tile.nWindows ? ssimSum / (3.0 * tile.nWindows) : 1.0);
             }
         }
 
-        diffSum /= img1.width() * img1.height();
-        
-        return std::pow(1.0f - float(diffSum), 128);
+        for (int c = 0; c < 3; ++c)
+        {
+            metrics.channelMse[c] = double(total.sqErr[c]) / total.nPixels;
+            metrics.channelPsnr[c] = calcPsnr(metrics.channelMse[c]);
+            metrics.channelSsim[c] = total.nWindows ? total.ssimSum[c] / total.nWindows : 1.0;
+        }
+
+        uint64_t diffSum = total.sqErr[0] + total.sqErr[1] + total.sqErr[2];
+        metrics.mse = double(diffSum) / (3.0 * total.nPixels);
+        metrics.psnr = calcPsnr(metrics.mse);
+        metrics.ssim = (metrics.channelSsim[0] + metrics.channelSsim[1] + metrics.channelSsim[2]) / 3.0;
+        metrics.similarity = calcSimilarity(diffSum, total.nPixels);
+
+        return metrics;
+    }
+
+    double calcPsnr(double mse)
+    {
+        if (mse <= 0.0)
+            return std::numeric_limits<double>::infinity();
+
+        return 10.0 * std::log10(255.0 * 255.0 / mse);
     }
 }
\ No newline at end of file
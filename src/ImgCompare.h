@@ -2,10 +2,47 @@
 
 #include <string>
 #include <stdint.h>
+#include <vector>
 
 #include "Image.h"
 
 namespace Blomp
 {
+    struct CompareDesc
+    {
+        // Edge length of the tiles the images are split into, a multiple of SSIM_STRIDE up to 4096.
+        int tileSize = 64;
+        int nThreads = 1;
+        // Keeps the error of every tile for error maps.
+        bool keepTiles = false;
+    };
+
+    // Standard metrics of an image against a reference. Squared errors are
+    // given per channel sample on the 8-bit scale, PSNR in dB (infinite
+    // for identical images). SSIM uses 8x8 windows in steps of 4 pixels.
+    struct ImageMetrics
+    {
+        static constexpr int SSIM_WINDOW = 8;
+        static constexpr int SSIM_STRIDE = 4;
+    public:
+        double mse = 0.0;
+        double psnr = 0.0;
+        double ssim = 1.0;
+        double channelMse[3] = { 0.0, 0.0, 0.0 };
+        double channelPsnr[3] = { 0.0, 0.0, 0.0 };
+        double channelSsim[3] = { 1.0, 1.0, 1.0 };
+        // Same score as compareImages.
+        float similarity = 1.0f;
+    public:
+        int tileSize = 0;
+        int nTilesX = 0;
+        int nTilesY = 0;
+        // Row by row, only filled in when CompareDesc::keepTiles is set.
+        std::vector<double> tileMse;
+        std::vector<double> tileSsim;
+    };
+
     float compareImages(const Image& img1, const Image& img2);
+    ImageMetrics compareImages(const Image& img1, const Image& img2, const CompareDesc& desc);
+    double calcPsnr(double mse);
 }
\ No newline at end of file
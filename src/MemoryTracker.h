@@ -0,0 +1,212 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+namespace Blomp
+{
+    enum class MemoryCategory
+    {
+        Image, Tree, BitStream, Stats, Count
+    };
+
+    // Process wide accounting of the large allocations: image pixels, block
+    // tree nodes including their shared pointer control blocks, bitstream and
+    // file buffers and block statistics. An allocation that would exceed the
+    // budget throws before anything is allocated.
+    class MemoryTracker
+    {
+    public:
+        static constexpr uint64_t UNLIMITED = UINT64_MAX;
+    public:
+        static void acquire(MemoryCategory category, uint64_t nBytes);
+        static void release(MemoryCategory category, uint64_t nBytes) noexcept;
+        static void require(uint64_t nBytes);
+        static bool fits(uint64_t nBytes);
+    public:
+        static void setBudget(uint64_t nBytes);
+        static uint64_t budget();
+        static uint64_t current();
+        static uint64_t peak();
+        static uint64_t peak(MemoryCategory category);
+        static const char* categoryName(MemoryCategory category);
+        static std::string format(uint64_t nBytes);
+    private:
+        struct Counter
+        {
+            std::atomic<uint64_t> current{ 0 };
+            std::atomic<uint64_t> peak{ 0 };
+        public:
+            void add(uint64_t nBytes);
+            void updatePeak(uint64_t value);
+        };
+    private:
+        static Counter& total();
+        static Counter& counter(MemoryCategory category);
+        static std::atomic<uint64_t>& budgetRef();
+    };
+
+    // Minimal allocator for standard containers that books its memory
+    // under the given category.
+    template <typename T, MemoryCategory Category>
+    struct TrackedAllocator
+    {
+        typedef T value_type;
+        template <typename U> struct rebind { typedef TrackedAllocator<U, Category> other; };
+    public:
+        TrackedAllocator() = default;
+        template <typename U> TrackedAllocator(const TrackedAllocator<U, Category>&) {}
+    public:
+        T* allocate(size_t n);
+        void deallocate(T* p, size_t n) noexcept;
+    };
+
+    template <typename T, typename U, MemoryCategory Category>
+    bool operator==(const TrackedAllocator<T, Category>&, const TrackedAllocator<U, Category>&) { return true; }
+    template <typename T, typename U, MemoryCategory Category>
+    bool operator!=(const TrackedAllocator<T, Category>&, const TrackedAllocator<U, Category>&) { return false; }
+
+    inline void MemoryTracker::acquire(MemoryCategory category, uint64_t nBytes)
+    {
+        // Checking and booking happen in one step, so parallel jobs can't overrun the budget together.
+        auto& used = total().current;
+        uint64_t oldUsed = used;
+        do
+        {
+            if (oldUsed > budget() || nBytes > budget() - oldUsed)
+                require(nBytes);
+        } while (!used.compare_exchange_weak(oldUsed, oldUsed + nBytes));
+
+        total().updatePeak(oldUsed + nBytes);
+        counter(category).add(nBytes);
+    }
+
+    inline void MemoryTracker::release(MemoryCategory category, uint64_t nBytes) noexcept
+    {
+        total().current -= nBytes;
+        counter(category).current -= nBytes;
+    }
+
+    inline void MemoryTracker::require(uint64_t nBytes)
+    {
+        if (!fits(nBytes))
+            throw std::runtime_error(
+                "Memory budget of " + format(budget()) + " exceeded, " +
+                format(current()) + " are in use and " + format(nBytes) + " more are needed."
+            );
+    }
+
+    inline bool MemoryTracker::fits(uint64_t nBytes)
+    {
+        uint64_t used = current();
+        return used <= budget() && nBytes <= budget() - used;
+    }
+
+    inline void MemoryTracker::setBudget(uint64_t nBytes)
+    {
+        budgetRef() = nBytes;
+    }
+
+    inline uint64_t MemoryTracker::budget()
+    {
+        return budgetRef();
+    }
+
+    inline uint64_t MemoryTracker::current()
+    {
+        return total().current;
+    }
+
+    inline uint64_t MemoryTracker::peak()
+    {
+        return total().peak;
+    }
+
+    inline uint64_t MemoryTracker::peak(MemoryCategory category)
+    {
+        return counter(category).peak;
+    }
+
+    inline const char* MemoryTracker::categoryName(MemoryCategory category)
+    {
+        switch (category)
+        {
+        case MemoryCategory::Image: return "images";
+        case MemoryCategory::Tree: return "trees";
+        case MemoryCategory::BitStream: return "bitstreams";
+        case MemoryCategory::Stats: return "statistics";
+        default: return "unknown";
+        }
+    }
+
+    inline std::string MemoryTracker::format(uint64_t nBytes)
+    {
+        std::ostringstream oss;
+        oss.precision(1);
+        oss << std::fixed;
+        if (nBytes < 1024)
+            oss << nBytes << " bytes";
+        else if (nBytes < (1 << 20))
+            oss << nBytes / 1024.0 << " KiB";
+        else
+            oss << nBytes / 1048576.0 << " MiB";
+        return oss.str();
+    }
+
+    inline void MemoryTracker::Counter::add(uint64_t nBytes)
+    {
+        updatePeak(current += nBytes);
+    }
+
+    inline void MemoryTracker::Counter::updatePeak(uint64_t value)
+    {
+        uint64_t oldPeak = peak;
+        while (oldPeak < value && !peak.compare_exchange_weak(oldPeak, value))
+            ;
+    }
+
+    inline MemoryTracker::Counter& MemoryTracker::total()
+    {
+        static Counter counter;
+        return counter;
+    }
+
+    inline MemoryTracker::Counter& MemoryTracker::counter(MemoryCategory category)
+    {
+        static Counter counters[(int)MemoryCategory::Count];
+        return counters[(int)category];
+    }
+
+    inline std::atomic<uint64_t>& MemoryTracker::budgetRef()
+    {
+        static std::atomic<uint64_t> budget{ UNLIMITED };
+        return budget;
+    }
+
+    template <typename T, MemoryCategory Category>
+    T* TrackedAllocator<T, Category>::allocate(size_t n)
+    {
+        MemoryTracker::acquire(Category, n * sizeof(T));
+
+        try
+        {
+            return std::allocator<T>().allocate(n);
+        }
+        catch (...)
+        {
+            MemoryTracker::release(Category, n * sizeof(T));
+            throw;
+        }
+    }
+
+    template <typename T, MemoryCategory Category>
+    void TrackedAllocator<T, Category>::deallocate(T* p, size_t n) noexcept
+    {
+        std::allocator<T>().deallocate(p, n);
+        MemoryTracker::release(Category, n * sizeof(T));
+    }
+}
\ No newline at end of file
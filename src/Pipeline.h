@@ -0,0 +1,159 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Trace.h"
+
+namespace Blomp
+{
+    // Fixed capacity FIFO queue between two pipeline stages.
+    // push() blocks while the queue is full, pop() blocks while it is empty
+    // and returns false once the queue is closed and drained.
+    template <typename T>
+    class BoundedQueue
+    {
+    public:
+        BoundedQueue() = delete;
+        BoundedQueue(size_t capacity);
+    public:
+        void push(T item);
+        bool pop(T& item);
+        void close();
+    private:
+        std::mutex m_mutex;
+        std::condition_variable m_notFull;
+        std::condition_variable m_notEmpty;
+        std::deque<T> m_items;
+        size_t m_capacity;
+        bool m_closed = false;
+    };
+
+    struct PipelineDesc
+    {
+        int nWorkers = 1;
+        int queueCapacity = 2;
+    };
+
+    template <typename Job>
+    using PipelineStage = std::function<void(Job& job)>;
+
+    // Runs every job through a read, a compute and a write stage.
+    // Reading runs on its own thread, computing on nWorkers threads and
+    // writing on the calling thread, so file IO overlaps with encoding
+    // and decoding. The bounded queues limit how many jobs hold their
+    // data at the same time.
+    // Jobs need a 'std::string error' member. An exception in a stage is
+    // stored there and the remaining stages of the job are skipped.
+    // 'report' is called on the calling thread for every finished job.
+    template <typename Job>
+    void runPipeline(std::vector<Job>& jobs, const PipelineDesc& desc, const PipelineStage<Job>& read, const PipelineStage<Job>& compute, const PipelineStage<Job>& write, const PipelineStage<Job>& report);
+
+    template <typename T>
+    BoundedQueue<T>::BoundedQueue(size_t capacity)
+        : m_capacity(capacity > 0 ? capacity : 1)
+    {}
+
+    template <typename T>
+    void BoundedQueue<T>::push(T item)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_notFull.wait(lock, [this]() { return m_items.size() < m_capacity; });
+        m_items.push_back(std::move(item));
+        m_notEmpty.notify_one();
+    }
+
+    template <typename T>
+    bool BoundedQueue<T>::pop(T& item)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_notEmpty.wait(lock, [this]() { return !m_items.empty() || m_closed; });
+        if (m_items.empty())
+            return false;
+
+        item = std::move(m_items.front());
+        m_items.pop_front();
+        m_notFull.notify_one();
+        return true;
+    }
+
+    template <typename T>
+    void BoundedQueue<T>::close()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_closed = true;
+        m_notEmpty.notify_all();
+    }
+
+    template <typename Job>
+    void runPipelineStage(Job& job, const PipelineStage<Job>& stage)
+    {
+        if (!job.error.empty())
+            return;
+
+        try
+        {
+            stage(job);
+        }
+        catch (std::exception& e)
+        {
+            job.error = e.what();
+            if (job.error.empty())
+                job.error = "Unknown error.";
+        }
+    }
+
+    template <typename Job>
+    void runPipeline(std::vector<Job>& jobs, const PipelineDesc& desc, const PipelineStage<Job>& read, const PipelineStage<Job>& compute, const PipelineStage<Job>& write, const PipelineStage<Job>& report)
+    {
+        int nWorkers = desc.nWorkers > 0 ? desc.nWorkers : 1;
+
+        BoundedQueue<Job*> readQueue(desc.queueCapacity);
+        BoundedQueue<Job*> writeQueue(desc.queueCapacity);
+        std::atomic<int> nActiveWorkers(nWorkers);
+
+        std::thread reader([&]() {
+            Trace::setThreadName("reader");
+            for (auto& job : jobs)
+            {
+                runPipelineStage(job, read);
+                readQueue.push(&job);
+            }
+            readQueue.close();
+        });
+
+        std::vector<std::thread> workers;
+        for (int i = 0; i < nWorkers; ++i)
+        {
+            workers.emplace_back([&, i]() {
+                Trace::setThreadName("worker " + std::to_string(i + 1));
+                Job* pJob;
+                while (readQueue.pop(pJob))
+                {
+                    runPipelineStage(*pJob, compute);
+                    writeQueue.push(pJob);
+                }
+                if (--nActiveWorkers == 0)
+                    writeQueue.close();
+            });
+        }
+
+        Job* pJob;
+        while (writeQueue.pop(pJob))
+        {
+            runPipelineStage(*pJob, write);
+            report(*pJob);
+        }
+
+        reader.join();
+        for (auto& worker : workers)
+            worker.join();
+    }
+}
\ No newline at end of file
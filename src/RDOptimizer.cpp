@@ -0,0 +1,188 @@
+#include "RDOptimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace Blomp
+{
+    RDOptimizer::RDOptimizer(const Image& img, int maxDepth, ColorMode colorMode, LeafCoding leafCoding)
+        : m_img(img), m_pyramid(img, colorMode, checkMaxDepth(maxDepth), 1), m_maxDepth(maxDepth), m_colorMode(colorMode)
+    {
+        // Bits of a ColorBlock: parent flag + 24 bit color, or 8 bit in grayscale mode.
+        m_leafBits = 1 + (colorMode == ColorMode::Gray ? 8 : 3 * 8);
+
+        // With the color cache a leaf stores one more bit unless its color is cached.
+        // Hits depend on the order the leaves are written in, so every leaf is
+        // counted as a miss and the size target is never exceeded.
+        if (leafCoding == LeafCoding::Cache)
+            ++m_leafBits;
+
+        m_levels.resize(maxDepth + 1);
+        for (int levelID = 1; levelID <= maxDepth; ++levelID)
+            buildLevel(levelID);
+    }
+
+    void RDOptimizer::optimize(double lambda)
+    {
+        for (int levelID = 1; levelID <= m_maxDepth; ++levelID)
+        {
+            auto& level = m_levels[levelID];
+            auto* pChildLevel = levelID > 1 ? &m_levels[levelID - 1] : nullptr;
+
+            for (int cy = 0; cy < level.height; ++cy)
+            {
+                for (int cx = 0; cx < level.width; ++cx)
+                {
+                    int i = cy * level.width + cx;
+                    const ColorStats& stats = m_pyramid.getNC(levelID, cx, cy);
+                    uint64_t nPixels = stats.nPixels;
+
+                    // Sum of squared errors when the whole cell is represented by its average color.
+                    double leafDist = stats.squaredError() / MAX_CHANNEL_ERROR;
+                    double leafCost = leafDist + lambda * m_leafBits;
+
+                    double splitDist = 0.0;
+                    uint64_t splitBits = 1;
+                    if (!pChildLevel)
+                    {
+                        splitBits += nPixels * m_leafBits;
+                    }
+                    else
+                    {
+                        for (int sy = cy * 2; sy < cy * 2 + 2 && sy < pChildLevel->height; ++sy)
+                        {
+                            for (int sx = cx * 2; sx < cx * 2 + 2 && sx < pChildLevel->width; ++sx)
+                            {
+                                int j = sy * pChildLevel->width + sx;
+                                splitDist += pChildLevel->dist[j];
+                                splitBits += pChildLevel->bits[j];
+                            }
+                        }
+                    }
+                    double splitCost = splitDist + lambda * splitBits;
+
+                    bool split = splitCost < leafCost;
+                    level.split[i] = split;
+                    level.dist[i] = split ? splitDist : leafDist;
+                    level.bits[i] = split ? splitBits : m_leafBits;
+                }
+            }
+        }
+
+        m_nBits = 1;
+        m_distortion = 0.0;
+
+        if (m_maxDepth == 0)
+        {
+            m_nBits += (uint64_t)m_img.width() * m_img.height() * m_leafBits;
+            return;
+        }
+
+        auto& topLevel = m_levels[m_maxDepth];
+        for (int i = 0; i < topLevel.width * topLevel.height; ++i)
+        {
+            m_nBits += topLevel.bits[i];
+            m_distortion += topLevel.dist[i];
+        }
+    }
+
+    double RDOptimizer::optimizeForSize(uint64_t nBits)
+    {
+        // The bit count never increases with a growing lambda,
+        // so the smallest lambda reaching the target is searched.
+        double lo = 1e-12;
+        optimize(lo);
+        if (m_nBits <= nBits)
+            return lo;
+
+        double hi = 1e-6;
+        for (optimize(hi); m_nBits > nBits && hi < 1e12; optimize(hi))
+        {
+            lo = hi;
+            hi *= 16.0;
+        }
+
+        for (int i = 0; i < 48; ++i)
+        {
+            double mid = std::sqrt(lo * hi);
+            optimize(mid);
+            if (m_nBits > nBits)
+                lo = mid;
+            else
+                hi = mid;
+        }
+
+        optimize(hi);
+        return hi;
+    }
+
+    double RDOptimizer::optimizeForDistortion(double maxDist)
+    {
+        // The distortion never decreases with a growing lambda,
+        // so the largest lambda staying below the limit is searched.
+        double lo = 1e-12;
+        optimize(lo);
+        if (m_distortion > maxDist)
+            return lo;
+
+        double hi = 1e-6;
+        for (optimize(hi); m_distortion <= maxDist && hi < 1e12; optimize(hi))
+        {
+            lo = hi;
+            hi *= 16.0;
+        }
+
+        for (int i = 0; i < 48; ++i)
+        {
+            double mid = std::sqrt(lo * hi);
+            optimize(mid);
+            if (m_distortion <= maxDist)
+                lo = mid;
+            else
+                hi = mid;
+        }
+
+        optimize(lo);
+        return lo;
+    }
+
+    bool RDOptimizer::isSplit(int x, int y, int depth) const
+    {
+        int levelID = m_maxDepth - depth;
+        if (levelID <= 0)
+            return false;
+
+        auto& level = m_levels[levelID];
+        return level.split[(y >> levelID) * level.width + (x >> levelID)];
+    }
+
+    Color RDOptimizer::avgColor(int x, int y, int depth) const
+    {
+        int levelID = m_maxDepth - depth;
+        if (levelID <= 0)
+            return m_img.getNC(x, y);
+
+        return m_pyramid.getNC(levelID, x >> levelID, y >> levelID).avgColor();
+    }
+
+    void RDOptimizer::buildLevel(int levelID)
+    {
+        auto& level = m_levels[levelID];
+        level.width = m_pyramid.levelWidth(levelID);
+        level.height = m_pyramid.levelHeight(levelID);
+
+        int nCells = level.width * level.height;
+        level.dist.resize(nCells);
+        level.bits.resize(nCells);
+        level.split.resize(nCells);
+    }
+
+    int RDOptimizer::checkMaxDepth(int maxDepth)
+    {
+        if (maxDepth < 0 || 30 < maxDepth)
+            throw std::runtime_error("Invalid maxDepth for rate-distortion optimization.");
+
+        return maxDepth;
+    }
+}
\ No newline at end of file
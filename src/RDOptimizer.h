@@ -0,0 +1,77 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include "Image.h"
+#include "ColorStats.h"
+#include "Descriptors.h"
+#include "StatsPyramid.h"
+
+namespace Blomp
+{
+    class RDOptimizer
+    {
+    public:
+        RDOptimizer() = delete;
+        RDOptimizer(const Image& img, int maxDepth, ColorMode colorMode, LeafCoding leafCoding = LeafCoding::Literal);
+    public:
+        void optimize(double lambda);
+        double optimizeForSize(uint64_t nBits);
+        double optimizeForDistortion(double maxDist);
+    public:
+        uint64_t nBits() const;
+        double distortion() const;
+        bool isSplit(int x, int y, int depth) const;
+        Color avgColor(int x, int y, int depth) const;
+        const Image& image() const;
+        int maxDepth() const;
+        ColorMode colorMode() const;
+    private:
+        struct Level
+        {
+            int width, height;
+            std::vector<double, TrackedAllocator<double, MemoryCategory::Stats>> dist;
+            std::vector<uint64_t, TrackedAllocator<uint64_t, MemoryCategory::Stats>> bits;
+            std::vector<uint8_t, TrackedAllocator<uint8_t, MemoryCategory::Stats>> split;
+        };
+    private:
+        void buildLevel(int levelID);
+    private:
+        static int checkMaxDepth(int maxDepth);
+    private:
+        const Image& m_img;
+        StatsPyramid m_pyramid;
+        int m_maxDepth;
+        ColorMode m_colorMode;
+        uint64_t m_leafBits;
+        std::vector<Level> m_levels;
+        uint64_t m_nBits = 0;
+        double m_distortion = 0.0;
+    };
+
+    inline uint64_t RDOptimizer::nBits() const
+    {
+        return m_nBits;
+    }
+
+    inline double RDOptimizer::distortion() const
+    {
+        return m_distortion;
+    }
+
+    inline const Image& RDOptimizer::image() const
+    {
+        return m_img;
+    }
+
+    inline int RDOptimizer::maxDepth() const
+    {
+        return m_maxDepth;
+    }
+
+    inline ColorMode RDOptimizer::colorMode() const
+    {
+        return m_colorMode;
+    }
+}
\ No newline at end of file
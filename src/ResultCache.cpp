@@ -0,0 +1,318 @@
+#include "ResultCache.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+#include <vector>
+
+#include "Trace.h"
+
+namespace Blomp
+{
+    // Temporary files this old are left behind by a writer that crashed.
+    static constexpr auto STALE_TEMP_AGE = std::chrono::hours(1);
+
+    static uint64_t rotl(uint64_t value, int n)
+    {
+        return (value << n) | (value >> (64 - n));
+    }
+
+    static uint64_t mix(uint64_t value)
+    {
+        // Finalizer of splitmix64.
+        value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ull;
+        value = (value ^ (value >> 27)) * 0x94D049BB133111EBull;
+        return value ^ (value >> 31);
+    }
+
+    CacheKey::CacheKey()
+        : m_h1(0x9E3779B97F4A7C15ull), m_h2(0xC2B2AE3D27D4EB4Full)
+    {
+        add(ResultCache::FORMAT_VERSION);
+    }
+
+    CacheKey& CacheKey::add(const void* data, uint64_t size)
+    {
+        auto bytes = (const uint8_t*)data;
+
+        uint64_t i = 0;
+        for (; i + 8 <= size; i += 8)
+        {
+            uint64_t word;
+            std::memcpy(&word, bytes + i, 8);
+            addWord(word);
+        }
+
+        uint64_t tail = 0;
+        std::memcpy(&tail, bytes + i, size - i);
+        // The length separates consecutive fields, so "ab" + "c" differs from "a" + "bc".
+        addWord(tail ^ (size << 56));
+
+        m_size += size;
+        return *this;
+    }
+
+    CacheKey& CacheKey::add(const std::string& str)
+    {
+        return add(str.data(), str.size());
+    }
+
+    CacheKey& CacheKey::add(int64_t value)
+    {
+        return add(&value, sizeof(value));
+    }
+
+    CacheKey& CacheKey::add(float value)
+    {
+        return add(&value, sizeof(value));
+    }
+
+    CacheKey& CacheKey::add(const Image& img)
+    {
+        add((int64_t)img.width());
+        add((int64_t)img.height());
+
+        // Row by row, so the key doesn't depend on the layout of the image.
+        std::vector<Color> row(img.width());
+        for (int y = 0; y < img.height(); ++y)
+        {
+            for (int x = 0, n; x < img.width(); x += n)
+            {
+                n = img.rowRunNC(x);
+                std::copy_n(&img.getNC(x, y), n, row.data() + x);
+            }
+            add(row.data(), row.size() * sizeof(Color));
+        }
+        return *this;
+    }
+
+    CacheKey& CacheKey::add(const BlockTreeDesc& btDesc)
+    {
+        add((int64_t)btDesc.maxDepth);
+        add(btDesc.variationThreshold);
+        add((int64_t)btDesc.splitMode);
+        add((int64_t)btDesc.colorMode);
+        add((int64_t)btDesc.leafCoding);
+        add((int64_t)btDesc.leafShape);
+        return *this;
+    }
+
+    std::string CacheKey::toString() const
+    {
+        uint64_t h1 = mix(m_h1 ^ m_size);
+        uint64_t h2 = mix(m_h2 + h1);
+
+        char buf[33];
+        std::snprintf(buf, sizeof(buf), "%016llx%016llx", (unsigned long long)h1, (unsigned long long)h2);
+        return buf;
+    }
+
+    void CacheKey::addWord(uint64_t word)
+    {
+        // Two lanes with different multipliers and rotations.
+        m_h1 = rotl(m_h1 ^ (word * 0x87C37B91114253D5ull), 31) * 0x4CF5AD432745937Full;
+        m_h2 = rotl(m_h2 + (word * 0x4CF5AD432745937Full), 27) * 0x87C37B91114253D5ull + 0x52DCE729;
+    }
+
+    ResultCache::ResultCache(const std::string& dir, uint64_t maxBytes)
+        : m_dir(dir), m_maxBytes(maxBytes)
+    {
+        std::error_code ec;
+        std::filesystem::create_directories(m_dir, ec);
+        if (!std::filesystem::is_directory(m_dir))
+            throw std::runtime_error("Unable to create cache directory.");
+    }
+
+    bool ResultCache::load(const CacheKey& key, const std::string& blpFile, CacheEntry& entry) const
+    {
+        TraceScope trace("cache load", "io");
+        trace.arg("key", key.toString());
+
+        auto metaPath = entryPath(key, ".meta");
+
+        std::ifstream ifStream(metaPath);
+        if (!ifStream.is_open())
+            return false;
+
+        CacheEntry loaded;
+        std::string name;
+        while (ifStream >> name)
+        {
+            if (name == "depth")
+                ifStream >> loaded.maxDepth;
+            else if (name == "variation")
+                ifStream >> loaded.variationThreshold;
+            else if (name == "iterations")
+                ifStream >> loaded.nIterations;
+            else if (name == "blocks")
+                ifStream >> loaded.counts.nBlocks;
+            else if (name == "colorblocks")
+                ifStream >> loaded.counts.nColorBlocks;
+            else if (name == "bits")
+                ifStream >> loaded.counts.nBits;
+            else
+                return false;
+        }
+        if (ifStream.bad() || (ifStream.fail() && !ifStream.eof()))
+            return false;
+        ifStream.close();
+
+        // An entry removed by another process in the meantime is a miss as well.
+        std::error_code ec;
+        std::filesystem::copy_file(entryPath(key, ".blp"), blpFile, std::filesystem::copy_options::overwrite_existing, ec);
+        if (ec)
+            return false;
+
+        trace.arg("hit", 1);
+
+        // The time of the last use orders the entries for the eviction.
+        std::filesystem::last_write_time(metaPath, std::filesystem::file_time_type::clock::now(), ec);
+
+        entry = loaded;
+        return true;
+    }
+
+    void ResultCache::store(const CacheKey& key, const std::string& blpFile, const CacheEntry& entry)
+    {
+        TraceScope trace("cache store", "io");
+        trace.arg("key", key.toString());
+
+        auto blpPath = entryPath(key, ".blp");
+        auto tempPath = createTempPath(blpPath);
+
+        std::error_code ec;
+        std::filesystem::copy_file(blpFile, tempPath, ec);
+        if (!ec)
+            std::filesystem::rename(tempPath, blpPath, ec);
+        if (ec)
+        {
+            std::filesystem::remove(tempPath, ec);
+            throw std::runtime_error("Unable to write cache entry.");
+        }
+
+        std::ostringstream meta;
+        meta.precision(9);
+        meta << "depth " << entry.maxDepth << "\n";
+        meta << "variation " << entry.variationThreshold << "\n";
+        meta << "iterations " << entry.nIterations << "\n";
+        meta << "blocks " << entry.counts.nBlocks << "\n";
+        meta << "colorblocks " << entry.counts.nColorBlocks << "\n";
+        meta << "bits " << entry.counts.nBits << "\n";
+        writeAtomic(entryPath(key, ".meta"), meta.str());
+
+        evict();
+    }
+
+    std::filesystem::path ResultCache::entryPath(const CacheKey& key, const char* ext) const
+    {
+        return m_dir / (key.toString() + ext);
+    }
+
+    void ResultCache::evict()
+    {
+        struct Entry
+        {
+            std::filesystem::file_time_type lastUse;
+            uint64_t nBytes = 0;
+            bool hasMeta = false;
+        };
+
+        std::map<std::string, Entry> entries;
+        uint64_t totalBytes = 0;
+
+        std::error_code ec;
+        for (auto& dirEntry : std::filesystem::directory_iterator(m_dir, ec))
+        {
+            auto path = dirEntry.path();
+            auto ext = path.extension();
+
+            // The temporary files of running writers count against the limit, stale ones are removed.
+            if (ext == ".tmp")
+            {
+                auto lastWrite = dirEntry.last_write_time(ec);
+                if (ec)
+                    continue;
+
+                if (std::filesystem::file_time_type::clock::now() - lastWrite > STALE_TEMP_AGE)
+                    std::filesystem::remove(path, ec);
+                else
+                {
+                    uint64_t nBytes = dirEntry.file_size(ec);
+                    if (!ec)
+                        totalBytes += nBytes;
+                }
+                continue;
+            }
+
+            if (ext != ".blp" && ext != ".meta")
+                continue;
+
+            uint64_t nBytes = dirEntry.file_size(ec);
+            if (ec)
+                continue;
+
+            auto& entry = entries[path.stem().string()];
+            entry.nBytes += nBytes;
+            totalBytes += nBytes;
+
+            // Entries without a '.meta' file are ordered by their '.blp' file.
+            if (ext == ".meta" || !entry.hasMeta)
+                entry.lastUse = dirEntry.last_write_time(ec);
+            entry.hasMeta = entry.hasMeta || ext == ".meta";
+        }
+
+        if (totalBytes <= m_maxBytes)
+            return;
+
+        std::vector<std::pair<std::string, Entry>> sorted(entries.begin(), entries.end());
+        std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) { return a.second.lastUse < b.second.lastUse; });
+
+        for (auto& [stem, entry] : sorted)
+        {
+            if (totalBytes <= m_maxBytes)
+                break;
+
+            // Removing the '.meta' file first turns the entry into a miss before the '.blp' file is gone.
+            std::filesystem::remove(m_dir / (stem + ".meta"), ec);
+            std::filesystem::remove(m_dir / (stem + ".blp"), ec);
+            totalBytes -= entry.nBytes;
+        }
+    }
+
+    void ResultCache::writeAtomic(const std::filesystem::path& path, const std::string& data)
+    {
+        auto tempPath = createTempPath(path);
+
+        bool written;
+        {
+            std::ofstream ofStream(tempPath, std::ios::binary | std::ios::out | std::ios::trunc);
+            written = ofStream.is_open() && ofStream.write(data.data(), data.size()) && ofStream.flush();
+        }
+
+        std::error_code ec;
+        if (written)
+            std::filesystem::rename(tempPath, path, ec);
+        if (!written || ec)
+        {
+            std::filesystem::remove(tempPath, ec);
+            throw std::runtime_error("Unable to write cache entry.");
+        }
+    }
+
+    std::filesystem::path ResultCache::createTempPath(const std::filesystem::path& path)
+    {
+        // Parallel writers of the same entry must not share a temporary file.
+        static thread_local std::mt19937_64 rng(std::random_device{}());
+
+        char buf[17];
+        std::snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)rng());
+        return path.string() + "." + buf + ".tmp";
+    }
+}
\ No newline at end of file
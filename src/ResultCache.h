@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdint.h>
+#include <filesystem>
+#include <string>
+
+#include "Descriptors.h"
+#include "Image.h"
+
+namespace Blomp
+{
+    // Incremental 128-bit hash of everything a result depends on. It is no
+    // cryptographic hash, which is fine for inputs nobody crafts to collide.
+    class CacheKey
+    {
+    public:
+        CacheKey();
+    public:
+        CacheKey& add(const void* data, uint64_t size);
+        CacheKey& add(const std::string& str);
+        CacheKey& add(int64_t value);
+        CacheKey& add(float value);
+        CacheKey& add(const Image& img);
+        CacheKey& add(const BlockTreeDesc& btDesc);
+        std::string toString() const;
+    private:
+        void addWord(uint64_t word);
+    private:
+        uint64_t m_h1;
+        uint64_t m_h2;
+        uint64_t m_size = 0;
+    };
+
+    // Parameters chosen while the cached result was computed.
+    struct CacheEntry
+    {
+        int maxDepth = 0;
+        float variationThreshold = 0.0f;
+        int nIterations = 0;
+        // The counts the mode reports for its result.
+        BlockCounts counts;
+    };
+
+    // Directory of blomp files named by their CacheKey. Every entry is a
+    // '.blp' file and a '.meta' file, both are written to temporary files
+    // and renamed, the '.meta' file last, so readers never see a partial
+    // entry. When the directory grows beyond its size limit, the least
+    // recently used entries are removed. Temporary files count against the
+    // limit and are removed once they are stale.
+    class ResultCache
+    {
+    public:
+        // Changes whenever the encoder may produce different results for the same key.
+        static constexpr int64_t FORMAT_VERSION = 1;
+    public:
+        ResultCache() = delete;
+        ResultCache(const std::string& dir, uint64_t maxBytes);
+    public:
+        // Copies the cached blomp file to blpFile, returns false on a miss.
+        bool load(const CacheKey& key, const std::string& blpFile, CacheEntry& entry) const;
+        void store(const CacheKey& key, const std::string& blpFile, const CacheEntry& entry);
+    private:
+        std::filesystem::path entryPath(const CacheKey& key, const char* ext) const;
+        void evict();
+    private:
+        static void writeAtomic(const std::filesystem::path& path, const std::string& data);
+        static std::filesystem::path createTempPath(const std::filesystem::path& path);
+    private:
+        std::filesystem::path m_dir;
+        uint64_t m_maxBytes;
+    };
+}
\ No newline at end of file
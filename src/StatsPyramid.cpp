@@ -0,0 +1,313 @@
+#include "StatsPyramid.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace Blomp
+{
+    static ColorStats scanGrayRectStats(int x, int y, int width, int height, const Image& img)
+    {
+        ColorStats cs;
+
+        // All channels of a grayscale image are equal, so only the first one is summed up.
+        for (int ry = y; ry < y + height; ++ry)
+        {
+            uint64_t rowSum = 0;
+            uint64_t rowSum2 = 0;
+
+            // Tiled images store a row in pieces of up to the tile size.
+            for (int rx = x, n; rx < x + width; rx += n)
+            {
+                n = std::min(img.rowRunNC(rx), x + width - rx);
+                const Color* row = &img.getNC(rx, ry);
+                for (int i = 0; i < n; ++i)
+                {
+                    rowSum += row[i].r;
+                    rowSum2 += row[i].r * row[i].r;
+                }
+            }
+
+            cs.sum[0] += rowSum;
+            cs.sum2[0] += rowSum2;
+        }
+
+        for (int c = 1; c < 3; ++c)
+        {
+            cs.sum[c] = cs.sum[0];
+            cs.sum2[c] = cs.sum2[0];
+        }
+
+        cs.nPixels = (uint64_t)width * height;
+
+        return cs;
+    }
+
+    static ColorStats scanChromaRectStats(int x, int y, int width, int height, const Image& img)
+    {
+        ColorStats cs;
+
+        // Chroma images hold Cb and Cr in the last two channels, the first one is ignored.
+        for (int ry = y; ry < y + height; ++ry)
+        {
+            uint64_t rowSum[2] = { 0, 0 };
+            uint64_t rowSum2[2] = { 0, 0 };
+
+            for (int rx = x, n; rx < x + width; rx += n)
+            {
+                n = std::min(img.rowRunNC(rx), x + width - rx);
+                const Color* row = &img.getNC(rx, ry);
+                for (int i = 0; i < n; ++i)
+                {
+                    rowSum[0] += row[i].g;
+                    rowSum[1] += row[i].b;
+                    rowSum2[0] += row[i].g * row[i].g;
+                    rowSum2[1] += row[i].b * row[i].b;
+                }
+            }
+
+            for (int c = 0; c < 2; ++c)
+            {
+                cs.sum[c + 1] += rowSum[c];
+                cs.sum2[c + 1] += rowSum2[c];
+            }
+        }
+
+        cs.nPixels = (uint64_t)width * height;
+
+        return cs;
+    }
+
+    StatsPyramid::StatsPyramid(const Image& img, ColorMode colorMode, int maxLevel, int minLevel, bool withMoments)
+        : m_img(img), m_colorMode(colorMode), m_minLevel(minLevel), m_maxLevel(maxLevel), m_withMoments(withMoments)
+    {
+        if (minLevel < 0 || 30 < maxLevel)
+            throw std::runtime_error("Invalid level range for the statistics pyramid.");
+        if (colorMode == ColorMode::YCbCr)
+            throw std::runtime_error("The statistics pyramid needs a single plane color mode.");
+
+        TraceScope trace("statistics", "build");
+        trace.arg("minLevel", minLevel);
+        trace.arg("maxLevel", maxLevel);
+        trace.arg("moments", (int)withMoments);
+
+        for (int level = m_minLevel; level <= m_maxLevel; ++level)
+        {
+            m_levels.emplace_back();
+            buildLevel(level);
+        }
+    }
+
+    ColorStats StatsPyramid::calcRectStats(int x, int y, int maxWidth, int maxHeight) const
+    {
+        int level = findLevel(x, y, maxWidth, maxHeight);
+        if (!hasLevel(level))
+            return scanRectStats(x, y, maxWidth, maxHeight, m_colorMode, m_img);
+
+        auto& lvl = m_levels[level - m_minLevel];
+
+        int minCX = x >> level;
+        int minCY = y >> level;
+        int maxCX = std::min(minCX + (maxWidth >> level), lvl.width);
+        int maxCY = std::min(minCY + (maxHeight >> level), lvl.height);
+
+        ColorStats cs;
+        for (int cy = minCY; cy < maxCY; ++cy)
+            for (int cx = minCX; cx < maxCX; ++cx)
+                cs += lvl.stats[(size_t)cy * lvl.width + cx];
+
+        return cs;
+    }
+
+    ColorMoments StatsPyramid::calcRectMoments(int x, int y, int maxWidth, int maxHeight) const
+    {
+        int level = findLevel(x, y, maxWidth, maxHeight);
+        if (!m_withMoments || !hasLevel(level))
+            return scanRectMoments(x, y, maxWidth, maxHeight, m_colorMode, m_img);
+
+        auto& lvl = m_levels[level - m_minLevel];
+
+        int minCX = x >> level;
+        int minCY = y >> level;
+        int maxCX = std::min(minCX + (maxWidth >> level), lvl.width);
+        int maxCY = std::min(minCY + (maxHeight >> level), lvl.height);
+
+        ColorMoments cm;
+        for (int cy = minCY; cy < maxCY; ++cy)
+            for (int cx = minCX; cx < maxCX; ++cx)
+                cm += lvl.moments[(size_t)cy * lvl.width + cx];
+
+        return cm;
+    }
+
+    ColorStats StatsPyramid::scanRectStats(int x, int y, int maxWidth, int maxHeight, ColorMode colorMode, const Image& img)
+    {
+        ColorStats cs;
+
+        int width = std::min(img.width() - x, maxWidth);
+        int height = std::min(img.height() - y, maxHeight);
+        if (width <= 0 || height <= 0)
+            return cs;
+
+        if (colorMode == ColorMode::Gray)
+            return scanGrayRectStats(x, y, width, height, img);
+        if (colorMode == ColorMode::CbCr)
+            return scanChromaRectStats(x, y, width, height, img);
+
+        for (int ry = y; ry < y + height; ++ry)
+        {
+            // Local row sums keep the inner loop free of stores to the result.
+            uint64_t rowSum[3] = { 0, 0, 0 };
+            uint64_t rowSum2[3] = { 0, 0, 0 };
+
+            for (int rx = x, n; rx < x + width; rx += n)
+            {
+                n = std::min(img.rowRunNC(rx), x + width - rx);
+                const Color* row = &img.getNC(rx, ry);
+                for (int i = 0; i < n; ++i)
+                {
+                    const Color& px = row[i];
+                    rowSum[0] += px.r;
+                    rowSum[1] += px.g;
+                    rowSum[2] += px.b;
+                    rowSum2[0] += px.r * px.r;
+                    rowSum2[1] += px.g * px.g;
+                    rowSum2[2] += px.b * px.b;
+                }
+            }
+
+            for (int c = 0; c < 3; ++c)
+            {
+                cs.sum[c] += rowSum[c];
+                cs.sum2[c] += rowSum2[c];
+            }
+        }
+
+        cs.nPixels = (uint64_t)width * height;
+
+        return cs;
+    }
+
+    ColorMoments StatsPyramid::scanRectMoments(int x, int y, int maxWidth, int maxHeight, ColorMode colorMode, const Image& img)
+    {
+        ColorMoments cm;
+
+        int width = std::min(img.width() - x, maxWidth);
+        int height = std::min(img.height() - y, maxHeight);
+        if (width <= 0 || height <= 0)
+            return cm;
+
+        // Grayscale images only need their first channel, chroma images their last two.
+        int firstChannel = colorMode == ColorMode::CbCr ? 1 : 0;
+        int lastChannel = colorMode == ColorMode::Gray ? 0 : 2;
+
+        for (int ry = y; ry < y + height; ++ry)
+        {
+            for (int rx = x, n; rx < x + width; rx += n)
+            {
+                n = std::min(img.rowRunNC(rx), x + width - rx);
+                const uint8_t* row = &img.getNC(rx, ry).r;
+                for (int c = firstChannel; c <= lastChannel; ++c)
+                {
+                    // Offsets within the run keep the products small, rx is added per run.
+                    uint64_t runSum = 0;
+                    uint64_t runSumX = 0;
+                    for (int i = 0; i < n; ++i)
+                    {
+                        uint64_t value = row[i * 3 + c];
+                        runSum += value;
+                        runSumX += (uint64_t)i * value;
+                    }
+
+                    cm.sumX[c] += (uint64_t)rx * runSum + runSumX;
+                    cm.sumY[c] += (uint64_t)ry * runSum;
+                }
+            }
+        }
+
+        if (colorMode == ColorMode::Gray)
+        {
+            for (int c = 1; c < 3; ++c)
+            {
+                cm.sumX[c] = cm.sumX[0];
+                cm.sumY[c] = cm.sumY[0];
+            }
+        }
+
+        return cm;
+    }
+
+    void StatsPyramid::buildLevel(int level)
+    {
+        auto& lvl = m_levels[level - m_minLevel];
+        lvl.width = calcLevelDim(m_img.width(), level);
+        lvl.height = calcLevelDim(m_img.height(), level);
+        lvl.stats.resize((size_t)lvl.width * lvl.height);
+        if (m_withMoments)
+            lvl.moments.resize((size_t)lvl.width * lvl.height);
+
+        if (level == m_minLevel)
+        {
+            int dim = 1 << level;
+            for (int cy = 0; cy < lvl.height; ++cy)
+            {
+                for (int cx = 0; cx < lvl.width; ++cx)
+                {
+                    lvl.stats[(size_t)cy * lvl.width + cx] = scanRectStats(cx * dim, cy * dim, dim, dim, m_colorMode, m_img);
+                    if (m_withMoments)
+                        lvl.moments[(size_t)cy * lvl.width + cx] = scanRectMoments(cx * dim, cy * dim, dim, dim, m_colorMode, m_img);
+                }
+            }
+            return;
+        }
+
+        auto& childLvl = m_levels[level - 1 - m_minLevel];
+        for (int sy = 0; sy < childLvl.height; ++sy)
+            for (int sx = 0; sx < childLvl.width; ++sx)
+                lvl.stats[(size_t)(sy / 2) * lvl.width + sx / 2] += childLvl.stats[(size_t)sy * childLvl.width + sx];
+
+        // Moments are taken about the image origin, so they add up like the sums.
+        if (m_withMoments)
+            for (int sy = 0; sy < childLvl.height; ++sy)
+                for (int sx = 0; sx < childLvl.width; ++sx)
+                    lvl.moments[(size_t)(sy / 2) * lvl.width + sx / 2] += childLvl.moments[(size_t)sy * childLvl.width + sx];
+    }
+
+    uint64_t StatsPyramid::calcBytes(int width, int height, int maxLevel, int minLevel, bool withMoments)
+    {
+        uint64_t cellBytes = sizeof(ColorStats) + (withMoments ? sizeof(ColorMoments) : 0);
+
+        uint64_t nBytes = 0;
+        for (int level = minLevel; level <= maxLevel; ++level)
+            nBytes += (uint64_t)calcLevelDim(width, level) * calcLevelDim(height, level) * cellBytes;
+
+        return nBytes;
+    }
+
+    int StatsPyramid::minLevelWithinBudget(const Image& img, int maxLevel, bool withMoments)
+    {
+        // Half of the remaining budget is left to the block tree. Without
+        // the lower levels, the stats of small blocks are summed up from the pixels.
+        int minLevel = DEFAULT_MIN_LEVEL;
+        while (minLevel <= maxLevel && !MemoryTracker::fits(2 * calcBytes(img.width(), img.height(), maxLevel, minLevel, withMoments)))
+            ++minLevel;
+
+        return minLevel;
+    }
+
+    int StatsPyramid::findLevel(int x, int y, int width, int height) const
+    {
+        // Only rectangles made of whole, aligned cells are covered by the pyramid.
+        int dim = std::min(width, height);
+        if (dim <= 0 || (width & (width - 1)) != 0 || (height & (height - 1)) != 0)
+            return -1;
+        if ((x & (dim - 1)) != 0 || (y & (dim - 1)) != 0)
+            return -1;
+
+        int level = 0;
+        while ((1 << level) < dim)
+            ++level;
+
+        return level;
+    }
+}
\ No newline at end of file
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <vector>
+
+#include "Image.h"
+#include "ColorStats.h"
+#include "Descriptors.h"
+#include "MemoryTracker.h"
+
+namespace Blomp
+{
+    // Per-cell color statistics of an image for every power of two cell size.
+    // Level L holds cells of 2^L x 2^L pixels and is built from level L - 1,
+    // so the image is scanned only once. Rectangles smaller than the lowest
+    // stored level are summed up from the pixels directly.
+    // The moments needed by gradient leaves are only stored on request,
+    // otherwise they are always summed up from the pixels.
+    class StatsPyramid
+    {
+    public:
+        // A cell takes 56 bytes, so with cells of 8x8 pixels all levels
+        // together need about 1.2 bytes per pixel, less than the image itself.
+        static constexpr int DEFAULT_MIN_LEVEL = 3;
+    public:
+        StatsPyramid() = delete;
+        StatsPyramid(const Image& img, ColorMode colorMode, int maxLevel, int minLevel = DEFAULT_MIN_LEVEL, bool withMoments = false);
+    public:
+        ColorStats calcRectStats(int x, int y, int maxWidth, int maxHeight) const;
+        ColorMoments calcRectMoments(int x, int y, int maxWidth, int maxHeight) const;
+        bool hasLevel(int level) const;
+        int levelWidth(int level) const;
+        int levelHeight(int level) const;
+        const ColorStats& getNC(int level, int cx, int cy) const;
+        const Image& image() const;
+        ColorMode colorMode() const;
+        int minLevel() const;
+        int maxLevel() const;
+        bool hasMoments() const;
+    public:
+        static ColorStats scanRectStats(int x, int y, int maxWidth, int maxHeight, ColorMode colorMode, const Image& img);
+        static ColorMoments scanRectMoments(int x, int y, int maxWidth, int maxHeight, ColorMode colorMode, const Image& img);
+        static uint64_t calcBytes(int width, int height, int maxLevel, int minLevel, bool withMoments = false);
+        // Lowest level, starting at DEFAULT_MIN_LEVEL, whose pyramid fits into half of the remaining memory budget.
+        // The result is above maxLevel when not even the top level fits.
+        static int minLevelWithinBudget(const Image& img, int maxLevel, bool withMoments = false);
+    private:
+        struct Level
+        {
+            int width, height;
+            std::vector<ColorStats, TrackedAllocator<ColorStats, MemoryCategory::Stats>> stats;
+            std::vector<ColorMoments, TrackedAllocator<ColorMoments, MemoryCategory::Stats>> moments;
+        };
+    private:
+        void buildLevel(int level);
+        int findLevel(int x, int y, int width, int height) const;
+    private:
+        static int calcLevelDim(int imgDim, int level);
+    private:
+        const Image& m_img;
+        ColorMode m_colorMode;
+        int m_minLevel;
+        int m_maxLevel;
+        bool m_withMoments;
+        std::vector<Level> m_levels;
+    };
+
+    inline int StatsPyramid::calcLevelDim(int imgDim, int level)
+    {
+        return imgDim > 0 ? ((imgDim - 1) >> level) + 1 : 0;
+    }
+
+    inline bool StatsPyramid::hasLevel(int level) const
+    {
+        return m_minLevel <= level && level <= m_maxLevel;
+    }
+
+    inline int StatsPyramid::levelWidth(int level) const
+    {
+        return m_levels[level - m_minLevel].width;
+    }
+
+    inline int StatsPyramid::levelHeight(int level) const
+    {
+        return m_levels[level - m_minLevel].height;
+    }
+
+    inline const ColorStats& StatsPyramid::getNC(int level, int cx, int cy) const
+    {
+        auto& lvl = m_levels[level - m_minLevel];
+        return lvl.stats[(size_t)cy * lvl.width + cx];
+    }
+
+    inline const Image& StatsPyramid::image() const
+    {
+        return m_img;
+    }
+
+    inline ColorMode StatsPyramid::colorMode() const
+    {
+        return m_colorMode;
+    }
+
+    inline int StatsPyramid::minLevel() const
+    {
+        return m_minLevel;
+    }
+
+    inline int StatsPyramid::maxLevel() const
+    {
+        return m_maxLevel;
+    }
+
+    inline bool StatsPyramid::hasMoments() const
+    {
+        return m_withMoments;
+    }
+}
\ No newline at end of file
@@ -0,0 +1,196 @@
+#include "Trace.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+namespace Blomp
+{
+    struct TraceEvent
+    {
+        std::string name;
+        const char* category;
+        // 'X' for complete events, 'M' for thread names.
+        char phase;
+        int tid;
+        uint64_t start;
+        uint64_t duration;
+        std::string args;
+    };
+
+    struct TraceState
+    {
+        std::atomic<bool> enabled{ false };
+        std::atomic<int> nThreads{ 0 };
+        std::chrono::steady_clock::time_point origin;
+        std::mutex mutex;
+        std::vector<TraceEvent> events;
+    };
+
+    static TraceState& traceState()
+    {
+        static TraceState state;
+        return state;
+    }
+
+    static int traceThreadID()
+    {
+        // Small sequential IDs are easier to read in the viewer than native thread IDs.
+        thread_local int tid = traceState().nThreads++;
+        return tid;
+    }
+
+    static void appendEscaped(std::string& out, const std::string& str)
+    {
+        for (char c : str)
+        {
+            if (c == '"' || c == '\\')
+            {
+                out += '\\';
+                out += c;
+            }
+            else if ((unsigned char)c < 0x20)
+            {
+                char buf[8];
+                std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+                out += buf;
+            }
+            else
+                out += c;
+        }
+    }
+
+    std::string escapeJson(const std::string& str)
+    {
+        std::string out;
+        appendEscaped(out, str);
+        return out;
+    }
+
+    void Trace::enable()
+    {
+        auto& state = traceState();
+        state.origin = std::chrono::steady_clock::now();
+        state.enabled = true;
+        setThreadName("main");
+    }
+
+    bool Trace::isEnabled()
+    {
+        return traceState().enabled.load(std::memory_order_relaxed);
+    }
+
+    void Trace::setThreadName(const std::string& name)
+    {
+        if (!isEnabled())
+            return;
+
+        std::string args = "\"name\":\"";
+        appendEscaped(args, name);
+        args += "\"";
+
+        auto& state = traceState();
+        std::lock_guard<std::mutex> lock(state.mutex);
+        state.events.push_back({ "thread_name", "__metadata", 'M', traceThreadID(), 0, 0, args });
+    }
+
+    void Trace::save(const std::string& filename)
+    {
+        auto& state = traceState();
+        std::lock_guard<std::mutex> lock(state.mutex);
+
+        std::ofstream ofStream(filename, std::ios::out | std::ios::trunc);
+        if (!ofStream.is_open())
+            throw std::runtime_error("Unable to open trace file.");
+
+        ofStream << "{\"traceEvents\":[\n";
+        for (size_t i = 0; i < state.events.size(); ++i)
+        {
+            auto& event = state.events[i];
+            std::string name;
+            appendEscaped(name, event.name);
+
+            ofStream << (i ? ",\n" : "")
+                << "{\"name\":\"" << name << "\",\"cat\":\"" << event.category
+                << "\",\"ph\":\"" << event.phase << "\",\"pid\":1,\"tid\":" << event.tid
+                << ",\"ts\":" << event.start;
+            if (event.phase == 'X')
+                ofStream << ",\"dur\":" << event.duration;
+            ofStream << ",\"args\":{" << event.args << "}}";
+        }
+        ofStream << "\n],\"displayTimeUnit\":\"ms\"}\n";
+
+        if (!ofStream)
+            throw std::runtime_error("Unable to write trace file.");
+    }
+
+    uint64_t Trace::now()
+    {
+        auto elapsed = std::chrono::steady_clock::now() - traceState().origin;
+        return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+    }
+
+    void Trace::addEvent(const char* name, const char* category, uint64_t start, uint64_t duration, const std::string& args)
+    {
+        int tid = traceThreadID();
+
+        auto& state = traceState();
+        std::lock_guard<std::mutex> lock(state.mutex);
+        state.events.push_back({ name, category, 'X', tid, start, duration, args });
+    }
+
+    void TraceScope::arg(const char* key, int64_t value)
+    {
+        if (!m_enabled)
+            return;
+
+        addArgKey(key);
+        m_args += std::to_string(value);
+    }
+
+    void TraceScope::arg(const char* key, uint64_t value)
+    {
+        if (!m_enabled)
+            return;
+
+        addArgKey(key);
+        m_args += std::to_string(value);
+    }
+
+    void TraceScope::arg(const char* key, double value)
+    {
+        if (!m_enabled)
+            return;
+
+        std::ostringstream oss;
+        oss << value;
+
+        addArgKey(key);
+        m_args += oss.str();
+    }
+
+    void TraceScope::arg(const char* key, const std::string& value)
+    {
+        if (!m_enabled)
+            return;
+
+        addArgKey(key);
+        m_args += '"';
+        appendEscaped(m_args, value);
+        m_args += '"';
+    }
+
+    void TraceScope::addArgKey(const char* key)
+    {
+        if (!m_args.empty())
+            m_args += ',';
+        m_args += '"';
+        m_args += key;
+        m_args += "\":";
+    }
+}
\ No newline at end of file
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+
+namespace Blomp
+{
+    // Collects Chrome trace events ("complete" events with thread IDs and
+    // arguments), which can be viewed in chrome://tracing or Perfetto.
+    // While tracing is disabled, scopes don't read the clock.
+    class Trace
+    {
+    public:
+        static void enable();
+        static bool isEnabled();
+        static void setThreadName(const std::string& name);
+        static void save(const std::string& filename);
+    public:
+        static uint64_t now();
+        static void addEvent(const char* name, const char* category, uint64_t start, uint64_t duration, const std::string& args);
+    };
+
+    // Escapes a string for use inside double quotes in JSON output.
+    std::string escapeJson(const std::string& str);
+
+    // Records the time from its construction until its destruction as one event.
+    class TraceScope
+    {
+    public:
+        TraceScope() = delete;
+        TraceScope(const TraceScope&) = delete;
+        TraceScope(const char* name, const char* category);
+        ~TraceScope();
+    public:
+        void arg(const char* key, int64_t value);
+        void arg(const char* key, uint64_t value);
+        void arg(const char* key, int value);
+        void arg(const char* key, double value);
+        void arg(const char* key, const std::string& value);
+    private:
+        void addArgKey(const char* key);
+    private:
+        const char* m_name;
+        const char* m_category;
+        bool m_enabled;
+        uint64_t m_start = 0;
+        std::string m_args;
+    };
+
+    inline TraceScope::TraceScope(const char* name, const char* category)
+        : m_name(name), m_category(category), m_enabled(Trace::isEnabled())
+    {
+        if (m_enabled)
+            m_start = Trace::now();
+    }
+
+    inline TraceScope::~TraceScope()
+    {
+        if (m_enabled)
+            Trace::addEvent(m_name, m_category, m_start, Trace::now() - m_start, m_args);
+    }
+
+    inline void TraceScope::arg(const char* key, int value)
+    {
+        arg(key, (int64_t)value);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "Descriptors.h"
+#include "Gradient.h"
+#include "Image.h"
+#include "StatsPyramid.h"
+
+namespace Blomp
+{
+    struct DepthReport
+    {
+        uint64_t nLeaves = 0;
+        uint64_t nParents = 0;
+        // Pixels covered by the leaves of this depth.
+        uint64_t leafArea = 0;
+    };
+
+    // Structure of a single block tree plane, gathered while its bits are read.
+    struct PlaneReport
+    {
+        // Leaves with a variation up to VARIATION_LIMITS[i] are counted in bin i,
+        // the last bin holds all leaves above the largest limit.
+        static constexpr int N_VARIATION_BINS = 9;
+        static constexpr double VARIATION_LIMITS[N_VARIATION_BINS - 1] = {
+            0.0001, 0.0003, 0.001, 0.003, 0.01, 0.03, 0.1, 0.3
+        };
+    public:
+        std::string name;
+        int maxDepth = 0;
+        // In the binary split mode the depth counts splits, so it can exceed maxDepth.
+        std::vector<DepthReport> depths;
+        // Leaf and split flags plus split types.
+        uint64_t structureBits = 0;
+        // Leaf colors including their cache flags and indices, gradients and their shape bits.
+        uint64_t colorBits = 0;
+        uint64_t nGradientLeaves = 0;
+        // Only filled in when the source image is known.
+        uint64_t variationBins[N_VARIATION_BINS] = {};
+        double variationSum = 0.0;
+        double maxVariation = 0.0;
+    public:
+        // The variation of gradient leaves is taken from a gradient fitted to the source pixels.
+        void addLeaf(int depth, int x, int y, int w, int h, int nColorBits, bool isGradient, ColorMode colorMode, const Image* pSourceImg);
+        void addParent(int depth, int nStructureBits);
+        uint64_t nLeaves() const;
+        uint64_t nParents() const;
+    private:
+        DepthReport& atDepth(int depth);
+    };
+
+    struct TreeReport
+    {
+        // Blocks and bits outside of the planes: the root block and, in the
+        // YCbCr mode, the plane roots and the chroma depth.
+        int nRootBlocks = 0;
+        uint64_t rootBits = 0;
+        bool hasVariations = false;
+        std::vector<PlaneReport> planes;
+    public:
+        BlockCounts counts() const;
+        uint64_t structureBits() const;
+        uint64_t colorBits() const;
+    };
+
+    inline void PlaneReport::addLeaf(int depth, int x, int y, int w, int h, int nColorBits, bool isGradient, ColorMode colorMode, const Image* pSourceImg)
+    {
+        auto& dr = atDepth(depth);
+        ++dr.nLeaves;
+        dr.leafArea += (uint64_t)w * h;
+        structureBits += 1;
+        colorBits += nColorBits;
+        nGradientLeaves += isGradient;
+
+        if (!pSourceImg)
+            return;
+
+        ColorStats cs = StatsPyramid::scanRectStats(x, y, w, h, colorMode, *pSourceImg);
+        double error = cs.squaredError();
+        if (isGradient)
+        {
+            ColorMoments cm = StatsPyramid::scanRectMoments(x, y, w, h, colorMode, *pSourceImg);
+            error = Gradient::fit(cs, cm, x, y, w, h).squaredError(cs, cm, x, y, w, h);
+        }
+        double variation = cs.nPixels ? error / (cs.nPixels * MAX_CHANNEL_ERROR) : 0.0;
+
+        int bin = 0;
+        while (bin < N_VARIATION_BINS - 1 && variation > VARIATION_LIMITS[bin])
+            ++bin;
+
+        ++variationBins[bin];
+        variationSum += variation;
+        maxVariation = std::max(maxVariation, variation);
+    }
+
+    inline void PlaneReport::addParent(int depth, int nStructureBits)
+    {
+        ++atDepth(depth).nParents;
+        structureBits += nStructureBits;
+    }
+
+    inline uint64_t PlaneReport::nLeaves() const
+    {
+        uint64_t n = 0;
+        for (auto& dr : depths)
+            n += dr.nLeaves;
+        return n;
+    }
+
+    inline uint64_t PlaneReport::nParents() const
+    {
+        uint64_t n = 0;
+        for (auto& dr : depths)
+            n += dr.nParents;
+        return n;
+    }
+
+    inline DepthReport& PlaneReport::atDepth(int depth)
+    {
+        if (depth >= (int)depths.size())
+            depths.resize(depth + 1);
+        return depths[depth];
+    }
+
+    inline BlockCounts TreeReport::counts() const
+    {
+        BlockCounts bc;
+        bc.nBlocks = nRootBlocks;
+        for (auto& plane : planes)
+        {
+            bc.nBlocks += (int)(plane.nLeaves() + plane.nParents());
+            bc.nColorBlocks += (int)plane.nLeaves();
+        }
+        bc.nBits = structureBits() + colorBits();
+        return bc;
+    }
+
+    inline uint64_t TreeReport::structureBits() const
+    {
+        uint64_t nBits = rootBits;
+        for (auto& plane : planes)
+            nBits += plane.structureBits;
+        return nBits;
+    }
+
+    inline uint64_t TreeReport::colorBits() const
+    {
+        uint64_t nBits = 0;
+        for (auto& plane : planes)
+            nBits += plane.colorBits;
+        return nBits;
+    }
+}
\ No newline at end of file